@@ -1,5 +1,6 @@
 #include <RcppEigen.h>
 #include "Fncs.h"
+#include <chrono>
 using namespace Rcpp;
 
 /**
@@ -258,3 +259,129 @@ Eigen::MatrixXd selectIndM(Eigen::MatrixXd original, std::vector<int> indices) {
 
   return submat;
 }
+
+
+/**
+ * gaussPostSolve
+ * @brief Gaussian full conditional for a system of a given matrix type
+ *
+ * @param prec precision matrix, only the lower triangle is used
+ * @param b right-hand side
+ * @param z standard normal draws (scaled)
+ * @param mean posterior mean prec^-1 * b
+ * @param draw mean + chol(prec^-1) * z
+ * @returns log determinant of chol(prec^-1)
+ */
+template<typename Mat, typename Vec>
+static double gaussPostSolve(const Eigen::MatrixXd &prec, const Eigen::VectorXd &b,
+                             const Eigen::VectorXd &z, Eigen::VectorXd &mean,
+                             Eigen::VectorXd &draw)
+{
+  const int p = prec.rows();
+  Mat P(p, p);
+  P.template triangularView<Eigen::Lower>() = prec;
+  Mat V(p, p);
+  V.template triangularView<Eigen::Lower>() =
+    P.template selfadjointView<Eigen::Lower>().llt().solve(Mat::Identity(p, p));
+  const Mat L = V.template selfadjointView<Eigen::Lower>().llt().matrixL();
+  const Vec m = V.template selfadjointView<Eigen::Lower>() * Vec(b);
+
+  mean = m;
+  draw = m;
+  draw.noalias() += L * Vec(z);
+  return(L.diagonal().array().log().sum());
+}
+
+/**
+ * gaussPostDraw
+ * @brief Draw from the Gaussian full conditional of terminal node effects,
+ * N(prec^-1 * b, sd^2 * prec^-1). Systems of up to 8 terminal nodes use
+ * fixed-size (unrolled) kernels and up to 16 use stack-allocated kernels;
+ * larger systems use heap-allocated matrices.
+ *
+ * @param prec precision matrix, only the lower triangle is used
+ * @param b right-hand side
+ * @param sd standard deviation
+ * @param mean posterior mean
+ * @param draw posterior draw
+ * @returns log determinant of chol(prec^-1)
+ */
+double gaussPostDraw(const Eigen::MatrixXd &prec, const Eigen::VectorXd &b,
+                     double sd, Eigen::VectorXd &mean, Eigen::VectorXd &draw)
+{
+  using Eigen::Matrix;
+  using Eigen::Dynamic;
+  const int p = prec.rows();
+  const Eigen::VectorXd z = as<Eigen::VectorXd>(rnorm(p, 0, sd));
+
+  switch (p) {
+    case 1: return(gaussPostSolve<Matrix<double, 1, 1>, Matrix<double, 1, 1> >(prec, b, z, mean, draw));
+    case 2: return(gaussPostSolve<Matrix<double, 2, 2>, Matrix<double, 2, 1> >(prec, b, z, mean, draw));
+    case 3: return(gaussPostSolve<Matrix<double, 3, 3>, Matrix<double, 3, 1> >(prec, b, z, mean, draw));
+    case 4: return(gaussPostSolve<Matrix<double, 4, 4>, Matrix<double, 4, 1> >(prec, b, z, mean, draw));
+    case 5: return(gaussPostSolve<Matrix<double, 5, 5>, Matrix<double, 5, 1> >(prec, b, z, mean, draw));
+    case 6: return(gaussPostSolve<Matrix<double, 6, 6>, Matrix<double, 6, 1> >(prec, b, z, mean, draw));
+    case 7: return(gaussPostSolve<Matrix<double, 7, 7>, Matrix<double, 7, 1> >(prec, b, z, mean, draw));
+    case 8: return(gaussPostSolve<Matrix<double, 8, 8>, Matrix<double, 8, 1> >(prec, b, z, mean, draw));
+    default:
+      if (p <= 16)
+        return(gaussPostSolve<Matrix<double, Dynamic, Dynamic, 0, 16, 16>,
+                              Matrix<double, Dynamic, 1, 0, 16, 1> >(prec, b, z, mean, draw));
+      return(gaussPostSolve<Eigen::MatrixXd, Eigen::VectorXd>(prec, b, z, mean, draw));
+  }
+}
+
+
+
+/**
+ * gaussPostDrawGeneric
+ * @brief Reference for gaussPostDraw: dynamic-size inverse() and llt(), as
+ * used by the tree MHR functions before the fixed-size kernels
+ */
+static double gaussPostDrawGeneric(const Eigen::MatrixXd &prec,
+                                   const Eigen::VectorXd &b, double sd,
+                                   Eigen::VectorXd &mean, Eigen::VectorXd &draw)
+{
+  const Eigen::MatrixXd P = prec.selfadjointView<Eigen::Lower>();
+  const Eigen::MatrixXd V = P.inverse();
+  const Eigen::MatrixXd VChol = V.llt().matrixL();
+  mean = V * b;
+  draw = mean;
+  draw.noalias() += VChol * as<Eigen::VectorXd>(rnorm(prec.rows(), 0, sd));
+  return(VChol.diagonal().array().log().sum());
+}
+
+//' Gaussian full conditional draw of terminal node effects (for testing)
+//'
+//' @param prec precision matrix, only the lower triangle is used
+//' @param b right-hand side
+//' @param sd standard deviation
+//' @param generic use the dynamic-size inverse()/llt() reference path instead
+//' of the fixed-size kernels
+//' @param reps number of repetitions to time
+//' @returns A list with the posterior mean, draw and log determinant of
+//' chol(prec^-1) of the last repetition, and seconds per repetition
+//' @export
+// [[Rcpp::export]]
+Rcpp::List gaussPostDraw_Cpp(const Eigen::MatrixXd prec, const Eigen::VectorXd b,
+                             double sd, bool generic = false, int reps = 1)
+{
+  if ((prec.rows() != prec.cols()) || (prec.rows() != b.size()))
+    stop("`prec` must be square with as many rows as `b` has elements");
+  Eigen::VectorXd mean, draw;
+  double logDet = 0.0;
+  std::chrono::steady_clock::time_point t0 = std::chrono::steady_clock::now();
+  for (int r = 0; r < std::max(reps, 1); ++r) {
+    if (generic)
+      logDet = gaussPostDrawGeneric(prec, b, sd, mean, draw);
+    else
+      logDet = gaussPostDraw(prec, b, sd, mean, draw);
+  }
+  double sec = std::chrono::duration<double>(
+    std::chrono::steady_clock::now() - t0).count() / std::max(reps, 1);
+
+  return(Rcpp::List::create(Named("mean")    = wrap(mean),
+                            Named("draw")    = wrap(draw),
+                            Named("logDet")  = wrap(logDet),
+                            Named("seconds") = wrap(sec)));
+}
@@ -5,6 +5,7 @@ using namespace Rcpp;
 // * sampling
 // * densities
 // * sets
+// * small Gaussian systems
 
 int sampleInt(const std::vector<double> &probs, double totProb);
 int sampleInt(const Eigen::VectorXd &probs);
@@ -21,3 +22,5 @@ std::pair<std::vector<int>, std::vector<int> >
 std::vector<int> cppIntersection(const IntegerVector& A, const IntegerVector& B);
 Eigen::VectorXd selectInd(Eigen::VectorXd original, std::vector<int> indices);
 Eigen::MatrixXd selectIndM(Eigen::MatrixXd original, std::vector<int> indices);
+double gaussPostDraw(const Eigen::MatrixXd &prec, const Eigen::VectorXd &b,
+                     double sd, Eigen::VectorXd &mean, Eigen::VectorXd &draw);
@@ -13,20 +13,26 @@ NodeVals::NodeVals(int n, int pZ)
   tempV.resize(0, 0);
   updateXmat = 1;
   nestedTree = 0;
+  active = 0;
+  staged = 0;
 }
 NodeVals::NodeVals(int n)
 {
   updateXmat = 1;
   nestedTree = 0;
+  active = 0;
+  staged = 0;
 }
 NodeVals::~NodeVals()
 {
   X.resize(0);
   ZtX.resize(0);
   VgZtX.resize(0);
-  XtX.resize(0, 0);
-  ZtXmat.resize(0, 0);
-  VgZtXmat.resize(0, 0);
+  for (int i = 0; i < 2; ++i) {
+    XtXslot[i].resize(0, 0);
+    ZtXmatSlot[i].resize(0, 0);
+    VgZtXmatSlot[i].resize(0, 0);
+  }
   tempV.resize(0, 0);
   if (nestedTree != 0) {
     delete nestedTree;
@@ -38,16 +44,18 @@ NodeVals::NodeVals(const NodeVals& x)
   X                 = x.X;
   Xpl               = x.Xpl;
   XplProposed       = x.XplProposed;
-  XtX               = x.XtX;
   ZtX               = x.ZtX;
-  ZtXmat            = x.ZtXmat;
   ZtXmatProposed    = x.ZtXmatProposed;
   VgZtX             = x.VgZtX;
-  VgZtXmat          = x.VgZtXmat;
   VgZtXmatProposed  = x.VgZtXmatProposed;
   tempV             = x.tempV;
   idx               = x.idx;
   updateXmat        = x.updateXmat;
+  XtXslot[0]        = x.XtXslot[x.active];
+  ZtXmatSlot[0]     = x.ZtXmatSlot[x.active];
+  VgZtXmatSlot[0]   = x.VgZtXmatSlot[x.active];
+  active            = 0;
+  staged            = 0;
   nestedTree        = 0;
   if (x.nestedTree != 0) {
     nestedTree = new Node(*(x.nestedTree));
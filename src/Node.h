@@ -11,11 +11,8 @@ struct NodeVals {
   
 public:
   Eigen::VectorXd X;
-  Eigen::MatrixXd XtX;
   Eigen::VectorXd ZtX;
-  Eigen::MatrixXd ZtXmat;
   Eigen::VectorXd VgZtX;
-  Eigen::MatrixXd VgZtXmat;
   Eigen::MatrixXd tempV;
   bool updateXmat;
   std::vector<int> idx;
@@ -25,6 +22,22 @@ public:
   Eigen::MatrixXd ZtXmatProposed;
   Eigen::MatrixXd VgZtXmatProposed;
   Eigen::MatrixXd Xpl;
+
+  // Nested tree statistics are double-buffered: while a proposal is staged,
+  // reads and writes go to the inactive slot; accept flips the active index
+  // and reject drops the staged slot, so neither copies a matrix.
+  Eigen::MatrixXd XtXslot[2];
+  Eigen::MatrixXd ZtXmatSlot[2];
+  Eigen::MatrixXd VgZtXmatSlot[2];
+  int active;
+  bool staged;
+
+  Eigen::MatrixXd& XtX() { return(XtXslot[active ^ staged]); }
+  Eigen::MatrixXd& ZtXmat() { return(ZtXmatSlot[active ^ staged]); }
+  Eigen::MatrixXd& VgZtXmat() { return(VgZtXmatSlot[active ^ staged]); }
+  void stage() { staged = 1; } // direct XtX, ZtXmat, VgZtXmat to inactive slot
+  void commit() { active ^= staged; staged = 0; } // staged slot becomes active
+  void discard() { staged = 0; } // keep active slot
 };
 
 class Node {
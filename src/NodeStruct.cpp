@@ -22,10 +22,12 @@ int NodeStruct::get(int a) {return(0);}
 std::vector<int> NodeStruct::get2(int a){ std::vector<int> b; return(b); }
 std::vector<std::vector<int> > NodeStruct::get3(int a)
   { std::vector<std::vector<int> > b; return(b); }
+Eigen::VectorXd NodeStruct::get4(int a) {Eigen::VectorXd b; return(b);}
 bool NodeStruct::checkEqual(NodeStruct* n) {return(0);}
 void NodeStruct::setTimeRange(int lower, int upper) {}
 void NodeStruct::setTimeProbs(Eigen::VectorXd newProbs) {}
 Eigen::VectorXd NodeStruct::getTimeProbs() {Eigen::VectorXd a; return(a);}
+std::string NodeStruct::splitKey() {return("");}
 
 
 /**
@@ -71,7 +73,12 @@ DLNMStruct::DLNMStruct(const DLNMStruct& ns)
 
 
 Eigen::VectorXd DLNMStruct::getTimeProbs()  { return(this->Tp); }
-void DLNMStruct::setTimeProbs(Eigen::VectorXd newProbs) { Tp = newProbs; }
+void DLNMStruct::setTimeProbs(Eigen::VectorXd newProbs)
+{
+  Tp = newProbs;
+  if ((tmax > tmin) && (Tp.size() >= tmax - 1))
+    totTp = Tp.segment(tmin - 1, tmax - tmin).sum();
+}
 
 
 bool DLNMStruct::proposeSplit()
@@ -210,6 +217,18 @@ void DLNMStruct::printStruct()
         logPRule() << ", totXp = " << totXp << ", totTp = " << totTp << "\n";
 }
 
+/**
+ * @brief compact description of the split, used to serialize tree topologies
+ * 
+ * @return "x<xsplit>;" for exposure splits or "t<tsplit>;" for time splits
+ */
+std::string DLNMStruct::splitKey()
+{
+  if (xsplit > 0)
+    return("x" + std::to_string(xsplit) + ";");
+  return("t" + std::to_string(tsplit) + ";");
+}
+
 int DLNMStruct::get(int a)
 {
   switch (a) {
@@ -257,6 +276,7 @@ ModStruct::ModStruct(const ModStruct& ns)
   splitVal  = ns.splitVal;
   splitVar  = ns.splitVar;
   splitVec  = ns.splitVec;
+  splitCoef = ns.splitCoef;
 }
 
 // Proposed new split based on availMod
@@ -264,6 +284,19 @@ bool ModStruct::proposeSplit()
 {
   std::size_t i;
 
+  if (modFncs->oblProb > 0) {
+    // Change step (the clone still holds its split): half of the proposals
+    // perturb the direction of an oblique split, which keeps the change
+    // proposal symmetric
+    if ((splitVar != -1) && (R::runif(0, 1) < 0.5))
+      return(rotateOblique());
+    splitVal = -1;
+    splitVec.clear();
+    splitCoef.resize(0);
+    if (R::runif(0, 1) < modFncs->oblProb)
+      return(proposeOblique());
+  }
+
   // Determine which modifiers are available for split
   std::vector<int> whichAvail;
   std::vector<double> modProbAvail;
@@ -332,18 +365,59 @@ bool ModStruct::proposeSplit()
   return(0);
 }
 
+/**
+ * @brief propose an oblique split: 2 or 3 continuous modifiers chosen
+ * uniformly, coefficients uniform on the unit sphere and a threshold from the
+ * grid of projected scores
+ */
+bool ModStruct::proposeOblique()
+{
+  std::vector<int> cand = modFncs->oblMods;
+  const int k = ((cand.size() > 2) && (R::runif(0, 1) < 0.5)) ? 3 : 2;
+  splitVec.clear();
+  for (int j = 0; j < k; ++j) {
+    int c = floor(R::runif(0, cand.size()));
+    splitVec.push_back(cand[c]);
+    cand.erase(cand.begin() + c);
+  }
+  std::sort(splitVec.begin(), splitVec.end());
+
+  splitCoef.resize(k);
+  for (int j = 0; j < k; ++j)
+    splitCoef(j) = R::rnorm(0.0, 1.0);
+  splitCoef.normalize();
+  splitVar = OBLIQUE_SPLIT;
+  splitVal = floor(R::runif(0, modFncs->oblCut.size()));
+  return(1);
+}
+
+/**
+ * @brief random walk of the coefficients of an oblique split on the unit
+ * sphere, keeping its modifiers and threshold
+ */
+bool ModStruct::rotateOblique()
+{
+  if (splitVar != OBLIQUE_SPLIT)
+    return(0);
+  for (int j = 0; j < splitCoef.size(); ++j)
+    splitCoef(j) += 0.2 * R::rnorm(0.0, 1.0);
+  splitCoef.normalize();
+  return(1);
+}
+
 // Reset split
 void ModStruct::dropSplit()
 {
   splitVal = -1;
   splitVar = -1;
   splitVec.clear();
+  splitCoef.resize(0);
 }
 
 // Check that split is valid
 bool ModStruct::valid()
 {
-  if (splitVar == -1)
+  if ((splitVar == -1) || (splitVar == OBLIQUE_SPLIT))
     return(1);
   if (availMod[splitVar].size() == 0)
     return(0);
@@ -370,9 +444,12 @@ bool ModStruct::valid()
 
 bool ModStruct::checkEqual(NodeStruct* ns)
 {
+  Eigen::VectorXd coef = ns->get4(1);
   if ((splitVar == ns->get(1)) &&
       (splitVal == ns->get(2)) &&
-      (splitVec == ns->get2(1))) {
+      (splitVec == ns->get2(1)) &&
+      (coef.size() == splitCoef.size()) &&
+      ((coef.size() == 0) || (coef == splitCoef))) {
     return(1);
   } else {
     return(0);
@@ -408,13 +485,23 @@ double ModStruct::logPRule()
   if (splitVar == -1)
     return(0);
 
+  if (splitVar == OBLIQUE_SPLIT) { // Oblique split
+    const double nObl = modFncs->oblMods.size();
+    double lp = log(modFncs->oblProb) - log(modFncs->oblCut.size()) -
+      R::lchoose(nObl, splitVec.size());
+    if (nObl > 2)
+      lp -= log(2.0);
+    return(lp);
+  }
+  const double logAxis = (modFncs->oblProb > 0) ? log(1.0 - modFncs->oblProb) : 0.0;
+
   if (modFncs->varIsNum[splitVar]) { // Continuous split
-    return(log(modFncs->modProb(splitVar)) -
+    return(logAxis + log(modFncs->modProb(splitVar)) -
            log(modFncs->totalProb(availMod)) -
            log(availMod[splitVar].size()));
 
   } else { // Categorical split
-    return(log(modFncs->modProb(splitVar)) -
+    return(logAxis + log(modFncs->modProb(splitVar)) -
            log(modFncs->totalProb(availMod)) -
            log(pow(2.0, double(availMod[splitVar].size()) - 1.0) - 1.0));
   }
@@ -446,6 +533,38 @@ std::vector<std::vector<int> > ModStruct::get3(int a)
   stop("incorrect call to ModStruct::get3");
 }
 
+Eigen::VectorXd ModStruct::get4(int a)
+{
+  switch(a) {
+    case 1: return(splitCoef);
+  }
+  stop("incorrect call to ModStruct::get4");
+}
+
+
+/**
+ * @brief compact description of the split, used to serialize tree topologies
+ * 
+ * @return "m<var><<val>;" for continuous, "m<var>{<levels>};" for
+ * categorical modifiers or "o<vars><<val>;" for oblique splits (the
+ * coefficients vary continuously and are left out of the topology)
+ */
+std::string ModStruct::splitKey()
+{
+  if (splitVar == OBLIQUE_SPLIT) {
+    std::string key = "o";
+    for (std::size_t i = 0; i < splitVec.size(); ++i)
+      key += (i ? "," : "") + std::to_string(splitVec[i]);
+    return(key + "<" + std::to_string(splitVal) + ";");
+  }
+  std::string key = "m" + std::to_string(splitVar);
+  if (splitVec.empty())
+    return(key + "<" + std::to_string(splitVal) + ";");
+  key += "{";
+  for (std::size_t i = 0; i < splitVec.size(); ++i)
+    key += (i ? "," : "") + std::to_string(splitVec[i]);
+  return(key + "};");
+}
 
 void ModStruct::printStruct()
 {
@@ -453,4 +572,6 @@ void ModStruct::printStruct()
     " splitVal = " << splitVal << " splitVec = ";
   for (int i : splitVec)
     Rcout << i << " ";
+  if (splitCoef.size() > 0)
+    Rcout << "splitCoef = " << splitCoef.transpose();
 }
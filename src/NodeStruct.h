@@ -2,6 +2,10 @@
 #include <RcppEigen.h>
 #include <Rcpp.h>
 
+// splitVar of an oblique modifier split: a linear combination of continuous
+// modifiers (splitVec, coefficients splitCoef) below threshold splitVal
+#define OBLIQUE_SPLIT -2
+
 class modDat;
 
 class NodeStruct {
@@ -21,9 +25,11 @@ public: //virtual = override parent functions
   virtual void setTimeProbs(Eigen::VectorXd);
   virtual std::vector<int> get2(int);
   virtual std::vector<std::vector<int> > get3(int);
+  virtual Eigen::VectorXd get4(int);
   virtual void updateStruct(NodeStruct*, bool);
   virtual bool checkEqual(NodeStruct*);
   virtual void setTimeRange(int, int);
+  virtual std::string splitKey();
 };
 
 class DLNMStruct: public NodeStruct {
@@ -54,6 +60,7 @@ public:
   void updateStruct(NodeStruct* parStruct, bool left);
   void setTimeRange(int lower, int upper);
   void setTimeProbs(Eigen::VectorXd newProbs);
+  std::string splitKey();
 };
 
 class ModStruct: public NodeStruct {
@@ -66,7 +73,10 @@ public:
   int splitVar;   // splitting modifier
   int splitVal;   // splitting value (continuous modifier)
   std::vector<int> splitVec;
-                  // splitting vector (categorical modifier)
+                  // splitting vector (categorical modifier, or
+                  // modifiers of an oblique split)
+  Eigen::VectorXd splitCoef;
+                  // unit-norm coefficients of an oblique split
   std::vector<std::vector<int> > availMod;
                   // index of remaining splits
   modDat *modFncs;// pointer to modifier functions (get avail modifiers)
@@ -79,6 +89,8 @@ public:
                   // get new list of available modifiers for subStructs
 
   bool proposeSplit();
+  bool proposeOblique();
+  bool rotateOblique();
   void dropSplit();
   bool valid();
   bool checkEqual(NodeStruct* ns);
@@ -92,6 +104,8 @@ public:
   int get(int a);
   std::vector<int> get2(int a);
   std::vector<std::vector<int> > get3(int a);
+  Eigen::VectorXd get4(int a);
   void printStruct();
+  std::string splitKey();
 
 };
@@ -24,6 +24,63 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// gaussPostDraw_Cpp
+Rcpp::List gaussPostDraw_Cpp(const Eigen::MatrixXd prec, const Eigen::VectorXd b, double sd, bool generic, int reps);
+RcppExport SEXP _dlmtree_gaussPostDraw_Cpp(SEXP precSEXP, SEXP bSEXP, SEXP sdSEXP, SEXP genericSEXP, SEXP repsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Eigen::MatrixXd >::type prec(precSEXP);
+    Rcpp::traits::input_parameter< const Eigen::VectorXd >::type b(bSEXP);
+    Rcpp::traits::input_parameter< double >::type sd(sdSEXP);
+    Rcpp::traits::input_parameter< bool >::type generic(genericSEXP);
+    Rcpp::traits::input_parameter< int >::type reps(repsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gaussPostDraw_Cpp(prec, b, sd, generic, reps));
+    return rcpp_result_gen;
+END_RCPP
+}
+// combineFrames_Cpp
+Rcpp::List combineFrames_Cpp(const Rcpp::List frames, const NumericVector iterOffset);
+RcppExport SEXP _dlmtree_combineFrames_Cpp(SEXP framesSEXP, SEXP iterOffsetSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type frames(framesSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type iterOffset(iterOffsetSEXP);
+    rcpp_result_gen = Rcpp::wrap(combineFrames_Cpp(frames, iterOffset));
+    return rcpp_result_gen;
+END_RCPP
+}
+// lagEffectDraws_Cpp
+NumericMatrix lagEffectDraws_Cpp(const IntegerVector iter, const IntegerVector exp, const IntegerVector tmin, const IntegerVector tmax, const NumericVector est, int nIter, int nLags, int nExp);
+RcppExport SEXP _dlmtree_lagEffectDraws_Cpp(SEXP iterSEXP, SEXP expSEXP, SEXP tminSEXP, SEXP tmaxSEXP, SEXP estSEXP, SEXP nIterSEXP, SEXP nLagsSEXP, SEXP nExpSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const IntegerVector >::type iter(iterSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type exp(expSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type tmin(tminSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type tmax(tmaxSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type est(estSEXP);
+    Rcpp::traits::input_parameter< int >::type nIter(nIterSEXP);
+    Rcpp::traits::input_parameter< int >::type nLags(nLagsSEXP);
+    Rcpp::traits::input_parameter< int >::type nExp(nExpSEXP);
+    rcpp_result_gen = Rcpp::wrap(lagEffectDraws_Cpp(iter, exp, tmin, tmax, est, nIter, nLags, nExp));
+    return rcpp_result_gen;
+END_RCPP
+}
+// chainDiag_Cpp
+Rcpp::List chainDiag_Cpp(const NumericMatrix draws, int nChains);
+RcppExport SEXP _dlmtree_chainDiag_Cpp(SEXP drawsSEXP, SEXP nChainsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const NumericMatrix >::type draws(drawsSEXP);
+    Rcpp::traits::input_parameter< int >::type nChains(nChainsSEXP);
+    rcpp_result_gen = Rcpp::wrap(chainDiag_Cpp(draws, nChains));
+    return rcpp_result_gen;
+END_RCPP
+}
 // dlmtreeGPFixedGaussian
 Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model);
 RcppExport SEXP _dlmtree_dlmtreeGPFixedGaussian(SEXP modelSEXP) {
@@ -171,6 +228,18 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// gpKernelCompare_Cpp
+Rcpp::List gpKernelCompare_Cpp(const Rcpp::List model, const Rcpp::CharacterVector kernels);
+RcppExport SEXP _dlmtree_gpKernelCompare_Cpp(SEXP modelSEXP, SEXP kernelsSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type model(modelSEXP);
+    Rcpp::traits::input_parameter< const Rcpp::CharacterVector >::type kernels(kernelsSEXP);
+    rcpp_result_gen = Rcpp::wrap(gpKernelCompare_Cpp(model, kernels));
+    return rcpp_result_gen;
+END_RCPP
+}
 // monotdlnm_Cpp
 Rcpp::List monotdlnm_Cpp(const Rcpp::List model);
 RcppExport SEXP _dlmtree_monotdlnm_Cpp(SEXP modelSEXP) {
@@ -219,6 +288,49 @@ BEGIN_RCPP
     return rcpp_result_gen;
 END_RCPP
 }
+// shinyBackendBuild
+Rcpp::List shinyBackendBuild(const IntegerVector ruleId, const IntegerVector iter, const IntegerVector exp, const IntegerVector tmin, const IntegerVector tmax, const NumericVector est, int nRules);
+RcppExport SEXP _dlmtree_shinyBackendBuild(SEXP ruleIdSEXP, SEXP iterSEXP, SEXP expSEXP, SEXP tminSEXP, SEXP tmaxSEXP, SEXP estSEXP, SEXP nRulesSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const IntegerVector >::type ruleId(ruleIdSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type iter(iterSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type exp(expSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type tmin(tminSEXP);
+    Rcpp::traits::input_parameter< const IntegerVector >::type tmax(tmaxSEXP);
+    Rcpp::traits::input_parameter< const NumericVector >::type est(estSEXP);
+    Rcpp::traits::input_parameter< int >::type nRules(nRulesSEXP);
+    rcpp_result_gen = Rcpp::wrap(shinyBackendBuild(ruleId, iter, exp, tmin, tmax, est, nRules));
+    return rcpp_result_gen;
+END_RCPP
+}
+// shinyBackendQuery_Cpp
+Rcpp::List shinyBackendQuery_Cpp(const Rcpp::List backend, const LogicalMatrix atoms, int exposure, double level, bool average);
+RcppExport SEXP _dlmtree_shinyBackendQuery_Cpp(SEXP backendSEXP, SEXP atomsSEXP, SEXP exposureSEXP, SEXP levelSEXP, SEXP averageSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type backend(backendSEXP);
+    Rcpp::traits::input_parameter< const LogicalMatrix >::type atoms(atomsSEXP);
+    Rcpp::traits::input_parameter< int >::type exposure(exposureSEXP);
+    Rcpp::traits::input_parameter< double >::type level(levelSEXP);
+    Rcpp::traits::input_parameter< bool >::type average(averageSEXP);
+    rcpp_result_gen = Rcpp::wrap(shinyBackendQuery_Cpp(backend, atoms, exposure, level, average));
+    return rcpp_result_gen;
+END_RCPP
+}
+// simLarge_Cpp
+Rcpp::List simLarge_Cpp(const Rcpp::List sim);
+RcppExport SEXP _dlmtree_simLarge_Cpp(SEXP simSEXP) {
+BEGIN_RCPP
+    Rcpp::RObject rcpp_result_gen;
+    Rcpp::RNGScope rcpp_rngScope_gen;
+    Rcpp::traits::input_parameter< const Rcpp::List >::type sim(simSEXP);
+    rcpp_result_gen = Rcpp::wrap(simLarge_Cpp(sim));
+    return rcpp_result_gen;
+END_RCPP
+}
 // tdlmm_Cpp
 Rcpp::List tdlmm_Cpp(const Rcpp::List model);
 RcppExport SEXP _dlmtree_tdlmm_Cpp(SEXP modelSEXP) {
@@ -244,6 +356,10 @@ END_RCPP
 
 static const R_CallMethodDef CallEntries[] = {
     {"_dlmtree_cppIntersection", (DL_FUNC) &_dlmtree_cppIntersection, 2},
+    {"_dlmtree_gaussPostDraw_Cpp", (DL_FUNC) &_dlmtree_gaussPostDraw_Cpp, 5},
+    {"_dlmtree_combineFrames_Cpp", (DL_FUNC) &_dlmtree_combineFrames_Cpp, 2},
+    {"_dlmtree_lagEffectDraws_Cpp", (DL_FUNC) &_dlmtree_lagEffectDraws_Cpp, 8},
+    {"_dlmtree_chainDiag_Cpp", (DL_FUNC) &_dlmtree_chainDiag_Cpp, 2},
     {"_dlmtree_dlmtreeGPFixedGaussian", (DL_FUNC) &_dlmtree_dlmtreeGPFixedGaussian, 1},
     {"_dlmtree_dlmtreeGPGaussian", (DL_FUNC) &_dlmtree_dlmtreeGPGaussian, 1},
     {"_dlmtree_dlmtreeHDLMGaussian", (DL_FUNC) &_dlmtree_dlmtreeHDLMGaussian, 1},
@@ -256,10 +372,14 @@ static const R_CallMethodDef CallEntries[] = {
     {"_dlmtree_dlnmPLEst", (DL_FUNC) &_dlmtree_dlnmPLEst, 5},
     {"_dlmtree_dlmEst", (DL_FUNC) &_dlmtree_dlmEst, 3},
     {"_dlmtree_mixEst", (DL_FUNC) &_dlmtree_mixEst, 3},
+    {"_dlmtree_gpKernelCompare_Cpp", (DL_FUNC) &_dlmtree_gpKernelCompare_Cpp, 2},
     {"_dlmtree_monotdlnm_Cpp", (DL_FUNC) &_dlmtree_monotdlnm_Cpp, 1},
     {"_dlmtree_zeroToInfNormCDF", (DL_FUNC) &_dlmtree_zeroToInfNormCDF, 2},
     {"_dlmtree_rtmvnorm", (DL_FUNC) &_dlmtree_rtmvnorm, 3},
     {"_dlmtree_rcpp_pgdraw", (DL_FUNC) &_dlmtree_rcpp_pgdraw, 2},
+    {"_dlmtree_shinyBackendBuild", (DL_FUNC) &_dlmtree_shinyBackendBuild, 7},
+    {"_dlmtree_shinyBackendQuery_Cpp", (DL_FUNC) &_dlmtree_shinyBackendQuery_Cpp, 5},
+    {"_dlmtree_simLarge_Cpp", (DL_FUNC) &_dlmtree_simLarge_Cpp, 1},
     {"_dlmtree_tdlmm_Cpp", (DL_FUNC) &_dlmtree_tdlmm_Cpp, 1},
     {"_dlmtree_tdlnm_Cpp", (DL_FUNC) &_dlmtree_tdlnm_Cpp, 1},
     {NULL, NULL, 0}
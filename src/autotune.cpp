@@ -0,0 +1,199 @@
+/**
+ * @file autotune.cpp
+ * @brief Start-up micro-benchmarks choosing between interchangeable
+ * computation strategies for a given data set
+ * @version 1.0
+ *
+ * Candidates are timed on the data passed to the model so the choice
+ * reflects n, the number of lags, exposure splits and fixed effects:
+ *  - DLNM node values from precalculated cumulative counts (Xsave) or
+ *    counted on demand (lowmem), subject to a memory budget
+ *  - single or multi-threaded Eigen products for node design matrices
+ * Direct vs Gram-based assembly of node designs and dense vs block solves
+ * are not candidates: each sampler implements only one of them.
+ */
+#include <RcppEigen.h>
+#include "modelCtr.h"
+#include "exposureDat.h"
+#include <chrono>
+#include <random>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+using namespace Rcpp;
+using Eigen::VectorXd;
+using Eigen::MatrixXd;
+
+/**
+ * @brief wall-clock seconds since an arbitrary fixed point
+ */
+static double tuneClock()
+{
+  return(std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief time Xd^T Xd for a design of size n x pXd with the current number
+ * of Eigen threads, the dominant product in the tree MHR functions
+ *
+ * @param Xd design matrix
+ * @param reps number of repetitions
+ * @return seconds per product
+ */
+static double timeGram(const MatrixXd &Xd, int reps)
+{
+  MatrixXd XtX(Xd.cols(), Xd.cols());
+  double t0 = tuneClock();
+  for (int r = 0; r < reps; ++r)
+    XtX.noalias() = Xd.transpose() * Xd;
+  return((tuneClock() - t0) / reps);
+}
+
+/**
+ * @brief choose the number of threads used by Eigen products
+ *
+ * @param Tcalc cumulative exposure columns used to build a typical design
+ * @param timings named timings, appended to
+ * @return chosen number of threads (1 if compiled without OpenMP); the
+ * caller holds an eigenThreadGuard to restore the previous count after the run
+ */
+int autotuneThreads(const MatrixXd &Tcalc, std::map<std::string, double> &timings)
+{
+  int maxThreads = 1;
+#ifdef _OPENMP
+  maxThreads = omp_get_max_threads();
+#endif
+  int pXd = std::min(8, int(Tcalc.cols()));
+  const MatrixXd Xd = Tcalc.leftCols(pXd);
+  int reps = std::max(3, std::min(50, int(2e7 / (double(Xd.size()) + 1.0))));
+
+  Eigen::setNbThreads(1);
+  double t1 = timeGram(Xd, reps);
+  timings["gram.threads1"] = t1;
+  int best = 1;
+  if (maxThreads > 1) {
+    Eigen::setNbThreads(maxThreads);
+    double tN = timeGram(Xd, reps);
+    timings["gram.threadsMax"] = tN;
+    if (tN < t1)
+      best = maxThreads;
+  }
+  Eigen::setNbThreads(best);
+  return(best);
+} // end autotuneThreads
+
+/**
+ * @brief choose between precalculated (Xsave) and on-demand (lowmem) DLNM
+ * node values, by timing one split's worth of precalculation and random
+ * node evaluations under both strategies
+ *
+ * @param model model list from R
+ * @param ctr model control data (n, pZ, nTrees, iter, burn, Z, Vg set)
+ * @param memBudget memory budget in bytes for the precalculated counts
+ * @param timings named timings, appended to
+ * @return true if lowmem should be used
+ */
+bool autotuneLowmem(const Rcpp::List &model, modelCtr *ctr, double memBudget,
+                    std::map<std::string, double> &timings)
+{
+  const MatrixXd X      = as<MatrixXd>(model["X"]);
+  const MatrixXd SE     = as<MatrixXd>(model["SE"]);
+  const VectorXd Xsplit = as<VectorXd>(model["Xsplits"]);
+  const MatrixXd Xcalc  = as<MatrixXd>(model["Xcalc"]);
+  const MatrixXd Tcalc  = as<MatrixXd>(model["Tcalc"]);
+  int nSplits = Xsplit.size();
+  int pX      = X.cols();
+  bool gaussian = !(ctr->binomial || ctr->scaleMix || ctr->zinb);
+
+  // Memory required by Xsave (and ZtXsave, VgZtXsave for gaussian)
+  double memPreset = 8.0 * nSplits * pX * (double(ctr->n) + (gaussian ? 2.0 * ctr->pZ : 0.0));
+  timings["preset.bytes"] = memPreset;
+  if ((nSplits == 0) || (memPreset > memBudget))
+    return(nSplits > 0);
+
+  // Lightweight exposure object for on-demand counts
+  exposureDat *Exp = new exposureDat(X, SE, Xsplit, Xcalc, Tcalc, 1);
+  int reps = 20;
+  std::vector<int> xlo(reps), xhi(reps), tlo(reps), thi(reps);
+  // Local generator: benchmarking must not advance R's RNG stream
+  std::mt19937 gen(20240611u);
+  for (int r = 0; r < reps; ++r) {
+    xlo[r] = std::uniform_int_distribution<int>(0, nSplits - 1)(gen);
+    xhi[r] = std::uniform_int_distribution<int>(xlo[r] + 1, nSplits)(gen);
+    tlo[r] = std::uniform_int_distribution<int>(1, pX)(gen);
+    thi[r] = std::uniform_int_distribution<int>(tlo[r], pX)(gen);
+  }
+
+  // On-demand: count exposures in node, then project on Z
+  VectorXd Xvec, ZtX, VgZtX;
+  double t0 = tuneClock();
+  for (int r = 0; r < reps; ++r) {
+    double xmin = (xlo[r] == 0) ? R_NegInf : Xsplit(xlo[r] - 1);
+    double xmax = (xhi[r] == nSplits + 1) ? R_PosInf : Xsplit(xhi[r] - 1);
+    Xvec = nodeCount(Exp, xmin, xmax, tlo[r], thi[r]);
+    if (gaussian)
+      ZtX = ctr->Z.transpose() * Xvec;
+  }
+  double tLow = (tuneClock() - t0) / reps;
+  timings["lowmem.node"] = tLow;
+
+  // Precalculated: build two splits' cumulative counts (bounding a node's
+  // exposure range), then look up
+  int iLo = nSplits / 3, iHi = std::min(nSplits - 1, iLo + 1);
+  MatrixXd XsLo(ctr->n, pX), XsHi(ctr->n, pX);
+  MatrixXd ZtXsLo, ZtXsHi, VgZtXsLo, VgZtXsHi;
+  t0 = tuneClock();
+  for (int t = 0; t < pX; ++t) {
+    XsLo.col(t) = nodeCount(Exp, R_NegInf, Xsplit(iLo), 1, t + 1);
+    XsHi.col(t) = nodeCount(Exp, R_NegInf, Xsplit(iHi), 1, t + 1);
+  }
+  if (gaussian) {
+    ZtXsLo = ctr->Z.transpose() * XsLo;
+    ZtXsHi = ctr->Z.transpose() * XsHi;
+    VgZtXsLo = ctr->Vg * ZtXsLo;
+    VgZtXsHi = ctr->Vg * ZtXsHi;
+  }
+  double tBuild = (tuneClock() - t0) * nSplits / 2.0;
+  timings["preset.build"] = tBuild;
+
+  t0 = tuneClock();
+  for (int r = 0; r < reps; ++r) { // worst case of updateNodeVals: 4 lookups
+    int t1 = thi[r] - 1, t0c = std::max(tlo[r] - 2, 0);
+    Xvec = XsHi.col(t1) - XsLo.col(t1);
+    Xvec -= XsHi.col(t0c) - XsLo.col(t0c);
+    if (gaussian) {
+      ZtX = ZtXsHi.col(t1) - ZtXsLo.col(t1);
+      ZtX -= ZtXsHi.col(t0c) - ZtXsLo.col(t0c);
+      VgZtX = VgZtXsHi.col(t1) - VgZtXsLo.col(t1);
+      VgZtX -= VgZtXsHi.col(t0c) - VgZtXsLo.col(t0c);
+    }
+  }
+  double tPre = (tuneClock() - t0) / reps;
+  timings["preset.node"] = tPre;
+  delete Exp;
+
+  // Projected cost over the run: about two node updates per proposal
+  double calls = 2.0 * ctr->nTrees * (ctr->iter + ctr->burn);
+  timings["lowmem.total"] = calls * tLow;
+  timings["preset.total"] = tBuild + calls * tPre;
+
+  return((calls * tLow) < (tBuild + calls * tPre));
+} // end autotuneLowmem
+
+/**
+ * @brief convert named timings to an R numeric vector
+ */
+Rcpp::NumericVector autotuneTimings(const std::map<std::string, double> &timings)
+{
+  Rcpp::NumericVector out(timings.size());
+  Rcpp::CharacterVector nm(timings.size());
+  int k = 0;
+  for (const auto &tm : timings) {
+    out[k] = tm.second;
+    nm[k] = tm.first;
+    ++k;
+  }
+  out.names() = nm;
+  return(out);
+}
@@ -0,0 +1,350 @@
+/**
+ * @file combineModels.cpp
+ * @brief Merge of MCMC chains and convergence diagnostics
+ * @version 1.0
+ *
+ * Tree logs of several chains are concatenated column by column into
+ * preallocated vectors, shifting the iteration index of each chain. R-hat
+ * and ESS follow Vehtari et al. (2021): rank-normalized split-R-hat (maximum
+ * of bulk and folded), bulk ESS of the rank-normalized split chains and tail
+ * ESS as the minimum ESS of the 5% and 95% quantile indicators. ESS uses
+ * FFT autocovariances and Geyer's initial monotone sequence.
+ */
+#include <RcppEigen.h>
+#include <unsupported/Eigen/FFT>
+#include <algorithm>
+#include <numeric>
+using namespace Rcpp;
+using Eigen::VectorXd;
+using Eigen::MatrixXd;
+
+//' Concatenate tree log data frames of several chains
+//'
+//' @param frames list of data frames with identical columns
+//' @param iterOffset offset added to the 'Iter' column of each data frame
+//' @returns A data frame
+//' @export
+// [[Rcpp::export]]
+Rcpp::List combineFrames_Cpp(const Rcpp::List frames, const NumericVector iterOffset)
+{
+  const int nFrames = frames.size();
+  if (iterOffset.size() != nFrames)
+    stop("iterOffset must have one value per data frame");
+  const Rcpp::List first = frames[0];
+  const CharacterVector names = first.names();
+  const int nCols = first.size();
+
+  std::vector<R_xlen_t> rowStart(nFrames + 1, 0);
+  for (int f = 0; f < nFrames; ++f) {
+    const Rcpp::List fr = frames[f];
+    if (fr.size() != nCols)
+      stop("data frames must have the same columns");
+    rowStart[f + 1] = rowStart[f] + (fr.size() ? Rf_xlength(fr[0]) : 0);
+  }
+  const R_xlen_t nRows = rowStart[nFrames];
+
+  Rcpp::List out(nCols);
+  for (int c = 0; c < nCols; ++c) {
+    SEXP col0 = first[c];
+    const int type = TYPEOF(col0);
+    const bool isIter = (std::string(names[c]) == "Iter");
+    SEXP col = PROTECT(Rf_allocVector(type, nRows));
+
+    for (int f = 0; f < nFrames; ++f) {
+      const Rcpp::List fr = frames[f];
+      SEXP src = fr[c];
+      if (TYPEOF(src) != type)
+        stop("column '" + std::string(names[c]) + "' differs in type between data frames");
+      if (Rf_isFactor(src) && !R_compute_identical(Rf_getAttrib(src, R_LevelsSymbol),
+                                                   Rf_getAttrib(col0, R_LevelsSymbol), 16))
+        stop("factor column '" + std::string(names[c]) + "' differs in levels between data frames");
+      const R_xlen_t r0 = rowStart[f], m = rowStart[f + 1] - r0;
+      switch (type) {
+        case REALSXP: {
+          double *dst = REAL(col) + r0;
+          std::copy(REAL(src), REAL(src) + m, dst);
+          if (isIter)
+            for (R_xlen_t i = 0; i < m; ++i) dst[i] += iterOffset[f];
+          break;
+        }
+        case INTSXP: {
+          int *dst = INTEGER(col) + r0;
+          std::copy(INTEGER(src), INTEGER(src) + m, dst);
+          if (isIter)
+            for (R_xlen_t i = 0; i < m; ++i) dst[i] += (int) iterOffset[f];
+          break;
+        }
+        case LGLSXP:
+          std::copy(LOGICAL(src), LOGICAL(src) + m, LOGICAL(col) + r0);
+          break;
+        case STRSXP:
+          for (R_xlen_t i = 0; i < m; ++i)
+            SET_STRING_ELT(col, r0 + i, STRING_ELT(src, i));
+          break;
+        default:
+          stop("unsupported type of column '" + std::string(names[c]) + "'");
+      }
+    }
+    Rf_copyMostAttrib(col0, col);
+    out[c] = col;
+    UNPROTECT(1);
+  }
+
+  out.attr("names")     = names;
+  out.attr("row.names") = IntegerVector::create(NA_INTEGER, -((int) nRows));
+  out.attr("class")     = "data.frame";
+  return(out);
+}
+
+//' Lag effects and cumulative effect of each iteration from linear DLM trees
+//'
+//' @param iter iteration of each terminal node (1-based)
+//' @param exp exposure of each terminal node (0-based)
+//' @param tmin first lag of each terminal node (1-based)
+//' @param tmax last lag of each terminal node (1-based)
+//' @param est estimate of each terminal node
+//' @param nIter number of iterations
+//' @param nLags number of lags
+//' @param nExp number of exposures
+//' @returns matrix of iterations x (nExp * (nLags + 1)): lags 1 to nLags then the
+//' cumulative effect for each exposure
+//' @export
+// [[Rcpp::export]]
+NumericMatrix lagEffectDraws_Cpp(const IntegerVector iter, const IntegerVector exp,
+                                 const IntegerVector tmin, const IntegerVector tmax,
+                                 const NumericVector est, int nIter, int nLags, int nExp)
+{
+  NumericMatrix out(nIter, nExp * (nLags + 1));
+  for (R_xlen_t k = 0; k < est.size(); ++k) {
+    const int off = exp[k] * (nLags + 1);
+    const int i = iter[k] - 1;
+    for (int t = tmin[k]; t <= tmax[k]; ++t)
+      out(i, off + t - 1) += est[k];
+    out(i, off + nLags) += est[k] * (tmax[k] - tmin[k] + 1);
+  }
+  return(out);
+}
+
+/**
+ * @brief normal scores of average ranks, (r - 3/8) / (S + 1/4)
+ */
+static VectorXd rankNormalize(const VectorXd &x)
+{
+  const int S = x.size();
+  std::vector<int> ord(S);
+  std::iota(ord.begin(), ord.end(), 0);
+  std::sort(ord.begin(), ord.end(), [&x](int a, int b) { return(x(a) < x(b)); });
+  VectorXd z(S);
+  for (int i = 0; i < S; ) {
+    int j = i;
+    while ((j + 1 < S) && (x(ord[j + 1]) == x(ord[i])))
+      ++j;
+    const double r = 0.5 * (i + j) + 1.0;
+    for (int k = i; k <= j; ++k)
+      z(ord[k]) = R::qnorm((r - 0.375) / (S + 0.25), 0.0, 1.0, 1, 0);
+    i = j + 1;
+  }
+  return(z);
+}
+
+/**
+ * @brief quantile of x matching R's default (type 7)
+ */
+static double quantile7(VectorXd x, double p)
+{
+  const double h = (x.size() - 1) * p;
+  const int lo = (int) floor(h);
+  std::nth_element(x.data(), x.data() + lo, x.data() + x.size());
+  const double xlo = x(lo);
+  if (lo + 1 >= x.size())
+    return(xlo);
+  const double xhi = *std::min_element(x.data() + lo + 1, x.data() + x.size());
+  return(xlo + (h - lo) * (xhi - xlo));
+}
+
+/**
+ * @brief autocovariance (divisor n) of a chain by FFT
+ */
+static VectorXd autocov(const VectorXd &x)
+{
+  const int n = x.size();
+  int nfft = 1;
+  while (nfft < 2 * n)
+    nfft <<= 1;
+  std::vector<double> y(nfft, 0.0);
+  const double m = x.mean();
+  for (int i = 0; i < n; ++i)
+    y[i] = x(i) - m;
+
+  Eigen::FFT<double> fft;
+  std::vector<std::complex<double> > f;
+  fft.fwd(f, y);
+  for (std::complex<double> &c : f)
+    c = std::complex<double>(std::norm(c), 0.0);
+  fft.inv(y, f);
+
+  VectorXd ac(n);
+  for (int t = 0; t < n; ++t)
+    ac(t) = y[t] / n;
+  return(ac);
+}
+
+/**
+ * @brief rank-normalized split-R-hat of chains (columns)
+ */
+static double rhatChains(const MatrixXd &x)
+{
+  const int n = x.rows(), M = x.cols();
+  const VectorXd mu = x.colwise().mean();
+  double W = 0.0;
+  for (int m = 0; m < M; ++m)
+    W += (x.col(m).array() - mu(m)).square().sum() / (n - 1);
+  W /= M;
+  const double B = n * (mu.array() - mu.mean()).square().sum() / (M - 1);
+  return(sqrt(((n - 1.0) / n * W + B / n) / W));
+}
+
+/**
+ * @brief multi-chain ESS of chains (columns)
+ */
+static double essChains(const MatrixXd &x)
+{
+  const int n = x.rows(), M = x.cols();
+  if (n < 4)
+    return(NA_REAL);
+  MatrixXd ac(n, M);
+  VectorXd mu(M), s2(M);
+  for (int m = 0; m < M; ++m) {
+    ac.col(m) = autocov(x.col(m));
+    mu(m)     = x.col(m).mean();
+    s2(m)     = ac(0, m) * n / (n - 1.0);
+  }
+  const double W = s2.mean();
+  double varPlus = W * (n - 1.0) / n;
+  if (M > 1)
+    varPlus += (mu.array() - mu.mean()).square().sum() / (M - 1);
+  if (!(varPlus > 0))
+    return(NA_REAL);
+
+  const VectorXd acMean = ac.rowwise().mean();
+  auto rho = [&](int t) { return(1.0 - (W - acMean(t)) / varPlus); };
+
+  // Geyer's initial positive and monotone sequence
+  double tau = -1.0, prev = R_PosInf;
+  for (int t = 0; t + 1 < n; t += 2) {
+    double P = (t == 0 ? 1.0 : rho(t)) + rho(t + 1);
+    if (P < 0)
+      break;
+    P = std::min(P, prev);
+    tau += 2.0 * P;
+    prev = P;
+  }
+  tau = std::max(tau, 1.0 / log10((double) n * M));
+  return(n * M / tau);
+}
+
+/**
+ * @brief columns of x (draws x chains) as 2 * chains split chains
+ */
+static MatrixXd splitChains(const MatrixXd &x)
+{
+  const int h = x.rows() / 2, M = x.cols();
+  MatrixXd s(h, 2 * M);
+  for (int m = 0; m < M; ++m) {
+    s.col(2 * m)     = x.col(m).head(h);
+    s.col(2 * m + 1) = x.col(m).tail(h);
+  }
+  return(s);
+}
+
+/**
+ * @brief draws (chain-major) reshaped to draws x chains
+ */
+static MatrixXd reshapeChains(const VectorXd &v, int n, int M)
+{
+  return(Eigen::Map<const MatrixXd>(v.data(), n, M));
+}
+
+//' Convergence diagnostics across chains
+//'
+//' @param draws matrix of posterior draws (rows) by parameter (columns), with the
+//' draws of each chain stacked in order and chains of equal length
+//' @param nChains number of chains
+//' @returns A list of split-R-hat, bulk and tail ESS for each parameter and a
+//' chains x parameters matrix of z-statistics comparing the mean of each chain
+//' to the mean of the other chains
+//' @export
+// [[Rcpp::export]]
+Rcpp::List chainDiag_Cpp(const NumericMatrix draws, int nChains)
+{
+  const int S = draws.nrow(), P = draws.ncol(), M = nChains;
+  if ((M < 1) || (S % M != 0))
+    stop("number of draws must be a multiple of the number of chains");
+  const int n = S / M;
+  const Eigen::Map<const MatrixXd> D(REAL(draws), S, P);
+
+  NumericVector rhat(P), essBulk(P), essTail(P);
+  NumericMatrix chainZ(M, P);
+
+  for (int p = 0; p < P; ++p) {
+    const VectorXd x = D.col(p);
+    const double mu = x.mean();
+    if (((x.array() - mu).abs().maxCoeff() == 0.0) || !x.allFinite() || (n < 4)) {
+      rhat[p] = essBulk[p] = essTail[p] = NA_REAL;
+      for (int m = 0; m < M; ++m)
+        chainZ(m, p) = NA_REAL;
+      continue;
+    }
+
+    // Rank-normalized split chains
+    const MatrixXd xs = splitChains(reshapeChains(x, n, M));
+    const VectorXd xsv = Eigen::Map<const VectorXd>(xs.data(), xs.size());
+    const MatrixXd zBulk = reshapeChains(rankNormalize(xsv), xs.rows(), xs.cols());
+    const double med = quantile7(xsv, 0.5);
+    const MatrixXd zTail = reshapeChains(rankNormalize((xsv.array() - med).abs().matrix()),
+                                         xs.rows(), xs.cols());
+    rhat[p]    = std::max(rhatChains(zBulk), rhatChains(zTail));
+    essBulk[p] = essChains(zBulk);
+
+    const double q05 = quantile7(xsv, 0.05), q95 = quantile7(xsv, 0.95);
+    const MatrixXd i05 = (xs.array() <= q05).cast<double>();
+    const MatrixXd i95 = (xs.array() <= q95).cast<double>();
+    const double e05 = essChains(i05), e95 = essChains(i95);
+    essTail[p] = (R_IsNA(e05) || R_IsNA(e95)) ? NA_REAL : std::min(e05, e95);
+
+    // Each chain against the pooled other chains, scaled by Monte Carlo SE
+    if (M > 1) {
+      const MatrixXd xc = reshapeChains(x, n, M);
+      VectorXd cm(M), cv(M), ce(M);
+      for (int m = 0; m < M; ++m) {
+        cm(m) = xc.col(m).mean();
+        cv(m) = (xc.col(m).array() - cm(m)).square().sum() / (n - 1);
+        ce(m) = (cv(m) > 0) ? essChains(xc.col(m)) : NA_REAL;
+      }
+      for (int m = 0; m < M; ++m) {
+        double sm = 0.0, ss = 0.0, se = 0.0;
+        for (int k = 0; k < M; ++k) {
+          if (k == m) continue;
+          sm += cm(k);
+        }
+        const double restMean = sm / (M - 1);
+        for (int k = 0; k < M; ++k) {
+          if (k == m) continue;
+          ss += (xc.col(k).array() - restMean).square().sum();
+          se += R_IsNA(ce(k)) ? n : ce(k);
+        }
+        const double restVar = ss / ((M - 1.0) * n - 1.0);
+        const double ownEss  = R_IsNA(ce(m)) ? n : ce(m);
+        const double mcse2   = cv(m) / ownEss + restVar / se;
+        chainZ(m, p) = (mcse2 > 0) ? (cm(m) - restMean) / sqrt(mcse2) : NA_REAL;
+      }
+    } else {
+      chainZ(0, p) = NA_REAL;
+    }
+  }
+
+  return(Rcpp::List::create(Named("rhat")    = rhat,
+                            Named("essBulk") = essBulk,
+                            Named("essTail") = essTail,
+                            Named("chainZ")  = chainZ));
+}
@@ -5,20 +5,23 @@
 #include "exposureDat.h"
 #include "Fncs.h"
 #include "modelCtr.h"
+#include "gpKernel.h"
 using namespace Rcpp;
 
 void dlmtreeGPFixed_Gaussian_TreeMCMC(int t, std::vector<Node*> fixedNodes,
                                       dlmtreeCtr* ctr, dlmtreeLog *dgn);
 
-treeMHR dlmtreeFixedMHR(std::vector<Node*> fixedNodes,
-                        dlmtreeCtr* ctr, 
-                        Eigen::VectorXd ZtR,
-                        double treevar);
+void dlmtreeFixedMHR(const std::vector<Node*> &fixedNodes,
+                     dlmtreeCtr* ctr, 
+                     const Eigen::VectorXd &ZtR,
+                     double treevar, treeMHR &out);
 
 
 //' dlmtree model with fixed Gaussian process approach
 //'
-//' @param model A list of parameter and data contained for the model fitting
+//' @param model A list of parameter and data contained for the model fitting. The
+//' GP kernel of the lag effects is gpKernel, one of matern12 (default), matern32,
+//' matern52, sqexp or periodic (with period gpPeriod in lags)
 //' @returns A list of dlmtree model fit, mainly posterior mcmc samples
 //' @export
 // [[Rcpp::export]]
@@ -31,6 +34,7 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
   ctr->burn     = as<int>(model["nBurn"]);
   ctr->thin     = as<int>(model["nThin"]);
   ctr->nRec     = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   ctr->nTrees   = as<int>(model["nTrees"]);
   ctr->Y        = as<Eigen::VectorXd>(model["Y"]);
   ctr->n        = (ctr->Y).size();
@@ -50,14 +54,12 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
   ctr->X            = as<Eigen::MatrixXd>(model["X"]);
   ctr->pX           = ctr->X.cols();
   ctr->DistMat      = as<Eigen::MatrixXd>(model["DistMat"]);
-  ctr->LambdaInv    = ctr->DistMat.array().exp().matrix().inverse();
-  ctr->LambdaInvNew = ctr->LambdaInv;
-
-  Eigen::MatrixXd LambdaInvChol = ctr->LambdaInv.llt().matrixL();
-  ctr->logLambdaDet             = -2.0 * LambdaInvChol.diagonal().array().log().sum();
-  ctr->logLambdaDetNew          = ctr->logLambdaDet;
   ctr->phi    = 1;
   ctr->phiNew = 1;
+  gpKernel *kernel  = gpKernelCreate(model);
+  kernel->precision(ctr->phi, ctr->LambdaInv, ctr->logLambdaDet);
+  ctr->LambdaInvNew     = ctr->LambdaInv;
+  ctr->logLambdaDetNew  = ctr->logLambdaDet;
   double logphiLow  = log(-log(.95));
   double logphiHigh = log(-log(.05));
   double logphi     = log(ctr->phi);
@@ -79,9 +81,9 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
       Ztemp.row(i) = ctr->Z.row(fixedNodes[t]->nodevals->idx[i]);
     }
 
-    fixedNodes[t]->nodevals->XtX        = Xtemp.transpose() * Xtemp;
-    fixedNodes[t]->nodevals->ZtXmat     = Ztemp.transpose() * Xtemp;
-    fixedNodes[t]->nodevals->VgZtXmat   = ctr->Vg * fixedNodes[t]->nodevals->ZtXmat;
+    fixedNodes[t]->nodevals->XtX()        = Xtemp.transpose() * Xtemp;
+    fixedNodes[t]->nodevals->ZtXmat()     = Ztemp.transpose() * Xtemp;
+    fixedNodes[t]->nodevals->VgZtXmat()   = ctr->Vg * fixedNodes[t]->nodevals->ZtXmat();
     fixedNodes[t]->nodevals->updateXmat = 0;
   }
 
@@ -138,8 +140,14 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
 
   std::size_t s;
   // ---- MCMC ----
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
     } else {
@@ -185,7 +193,7 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
       (ctr->phiMHNew - ctr->phiMH) / (2.0 * ctr->nu * ctr->sigma2) +
       (R::dgamma(ctr->phiNew, 0.5, 2.0, 1) - 
        R::dgamma(ctr->phi, 0.5, 2.0, 1));
-    if (log(R::runif(0, 1) < phiMHRatio)) {
+    if (log(R::runif(0, 1)) < phiMHRatio) {
       ctr->phi          = ctr->phiNew;
       logphi            = logphiNew;
       ctr->LambdaInv    = ctr->LambdaInvNew;
@@ -202,9 +210,7 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
     }
 
     ctr->phiNew           = exp(logphiNew);
-    ctr->LambdaInvNew     = (ctr->phiNew * ctr->DistMat).array().exp().matrix().inverse();
-    LambdaInvChol         = ctr->LambdaInvNew.llt().matrixL();
-    ctr->logLambdaDetNew  = -2.0 * LambdaInvChol.diagonal().array().log().sum();
+    kernel->precision(ctr->phiNew, ctr->LambdaInvNew, ctr->logLambdaDetNew);
     
     // -- Record --
     if (ctr->record > 0) {
@@ -221,6 +227,16 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
     prog->printMark();
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
 
   // -- Prepare outout --
   // Eigen::MatrixXd exDLM = dgn->exDLM.transpose();
@@ -236,28 +252,35 @@ Rcpp::List dlmtreeGPFixedGaussian(const Rcpp::List model)
   Eigen::VectorXd sigma2  = dgn->sigma2;
   Eigen::VectorXd nu      = dgn->nu;
   Eigen::MatrixXd tau     = (dgn->tau).transpose();
-  Eigen::VectorXd fhat    = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat    = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma   = (dgn->gamma).transpose();
   Eigen::VectorXd phi     = dgn->phi;
 
   delete prog;
+  std::string kernelName = kernel->name;
+  delete kernel;
   delete ctr;
   delete dgn;
   for (s = 0; s < fixedNodes.size(); ++s) {
     delete fixedNodes[s];
   }
 
-  return(Rcpp::List::create(// Named("DLM") = wrap(exDLM),
-                            // Named("DLMse") = wrap(ex2DLM),
-                            // Named("DLfun") = wrap(cumDLM),
-                            // Named("DLfunse") = wrap(cum2DLM),
-                            Named("TreeStructs")  = wrap(TreeStructs),
-                            Named("fhat")         = wrap(fhat),
-                            Named("sigma2")       = wrap(sigma2),
-                            Named("nu")           = wrap(nu),
-                            Named("tau")          = wrap(tau),
-                            Named("gamma")        = wrap(gamma),
-                            Named("phi")          = wrap(phi)));
+  Rcpp::List out = Rcpp::List::create(// Named("DLM") = wrap(exDLM),
+                                      // Named("DLMse") = wrap(ex2DLM),
+                                      // Named("DLfun") = wrap(cumDLM),
+                                      // Named("DLfunse") = wrap(cum2DLM),
+                                      Named("TreeStructs")  = wrap(TreeStructs),
+                                      Named("fhat")         = wrap(fhat),
+                                      Named("sigma2")       = wrap(sigma2),
+                                      Named("nu")           = wrap(nu),
+                                      Named("tau")          = wrap(tau),
+                                      Named("gamma")        = wrap(gamma),
+                                      Named("phi")          = wrap(phi));
+  out["mcmcIter"] = mcmcIter;
+  out["gpKernel"] = kernelName;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeGPGaussian
 
@@ -269,7 +292,8 @@ void dlmtreeGPFixed_Gaussian_TreeMCMC(int t, std::vector<Node*> fixedNodes,
   double treevar = (ctr->nu) * (ctr->tau)(t);
   std::size_t s;
   Eigen::VectorXd ZtR = (ctr->Z).transpose() * (ctr->R);
-  treeMHR mhr0        = dlmtreeFixedMHR(fixedNodes, ctr, ZtR, treevar);
+  treeMHR &mhr0       = mhrPair(ctr, t)[0];
+  dlmtreeFixedMHR(fixedNodes, ctr, ZtR, treevar, mhr0);
   
   // -- Update variance and residuals --
   double xiInv      = R::rgamma(1, 1.0 / (1.0 + 1.0 / (ctr->tau)(t)));
@@ -300,13 +324,12 @@ void dlmtreeGPFixed_Gaussian_TreeMCMC(int t, std::vector<Node*> fixedNodes,
 
 
 // function to calculate part of MH ratio
-treeMHR dlmtreeFixedMHR(std::vector<Node*> fixedNodes,
-                   dlmtreeCtr* ctr, 
-                   Eigen::VectorXd ZtR,
-                   double treevar)
+void dlmtreeFixedMHR(const std::vector<Node*> &fixedNodes,
+                     dlmtreeCtr* ctr, 
+                     const Eigen::VectorXd &ZtR,
+                     double treevar, treeMHR &out)
 {
   std::size_t s;
-  treeMHR out;
   int pX = ctr->pX * fixedNodes.size();
   Eigen::MatrixXd Linv = ctr->LambdaInv / treevar;
 
@@ -320,9 +343,9 @@ treeMHR dlmtreeFixedMHR(std::vector<Node*> fixedNodes,
   // Create block matrices corresponding to modifier nodes
   int start = 0;
   for (Node* n : fixedNodes) {      
-    XXiblock.block(start, start, ctr->pX, ctr->pX)  = (n->nodevals->XtX + Linv).inverse();
-    ZtX.block(0, start, ctr->pZ, ctr->pX)           = n->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, ctr->pX)         = n->nodevals->VgZtXmat;
+    XXiblock.block(start, start, ctr->pX, ctr->pX)  = (n->nodevals->XtX() + Linv).inverse();
+    ZtX.block(0, start, ctr->pZ, ctr->pX)           = n->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, ctr->pX)         = n->nodevals->VgZtXmat();
     
     for (int i : n->nodevals->idx) {
       XtR.segment(start, ctr->pX).noalias() += ctr->X.row(i).transpose() * ctr->R(i);
@@ -354,6 +377,4 @@ treeMHR dlmtreeFixedMHR(std::vector<Node*> fixedNodes,
   
   out.beta          = ThetaHat.dot(XtVzInvR);
   out.logVThetaChol = VThetaChol.diagonal().array().log().sum();
-  
-  return(out);
 } // end dlmtreeMHR function
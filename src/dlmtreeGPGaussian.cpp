@@ -5,6 +5,7 @@
 #include "exposureDat.h"
 #include "Fncs.h"
 #include "modelCtr.h"
+#include "gpKernel.h"
 using namespace Rcpp;
 
 
@@ -12,15 +13,17 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree,
                                  dlmtreeCtr* ctr, dlmtreeLog *dgn,
                                  modDat* Mod);
 
-treeMHR dlmtreeGP_MHR(std::vector<Node*> modTerm,
-                      dlmtreeCtr* ctr, 
-                      Eigen::VectorXd ZtR,
-                      double treevar);
+void dlmtreeGP_MHR(const std::vector<Node*> &modTerm,
+                   dlmtreeCtr* ctr, 
+                   const Eigen::VectorXd &ZtR,
+                   double treevar, treeMHR &out);
 
 
 //' dlmtree model with Gaussian process approach
 //'
-//' @param model A list of parameter and data contained for the model fitting
+//' @param model A list of parameter and data contained for the model fitting. The
+//' GP kernel of the lag effects is gpKernel, one of matern12 (default), matern32,
+//' matern52, sqexp or periodic (with period gpPeriod in lags)
 //' @returns A list of dlmtree model fit, mainly posterior mcmc samples
 //' @export
 // [[Rcpp::export]]
@@ -33,6 +36,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   ctr->burn       = as<int>(model["nBurn"]);
   ctr->thin       = as<int>(model["nThin"]);
   ctr->nRec       = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   ctr->nTrees     = as<int>(model["nTrees"]);
   ctr->Y          = as<Eigen::VectorXd>(model["Y"]);
   ctr->n          = (ctr->Y).size();
@@ -59,6 +63,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   modDat *Mod = new modDat(as<std::vector<int> >(model["modIsNum"]),
                            as<Rcpp::List>(model["modSplitIdx"]),
                            as<std::vector<int> >(model["fullIdx"]));
+  Mod->setOblique(model);
 
   NodeStruct *modNS;
   modNS   = new ModStruct(Mod);
@@ -75,7 +80,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   // ---- Setup covariance matrix ----
   ctr->covarType  = as<int>(model["covarianceType"]);
   ctr->DistMat    = as<Eigen::MatrixXd>(model["DistMat"]);
-  Eigen::MatrixXd LambdaInvChol(ctr->pX, ctr->pX);
+  gpKernel *kernel = 0;
   ctr->LambdaInv.resize(ctr->pX, ctr->pX); ctr->LambdaInv.setZero();
   ctr->LambdaInvNew.resize(ctr->pX, ctr->pX); ctr->LambdaInvNew.setZero();
   ctr->logLambdaDet     = 0; 
@@ -89,10 +94,9 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   double logphiNew  = logphi;
 
   if (ctr->covarType == 1) {
-    ctr->LambdaInv        = ctr->DistMat.array().exp().matrix().inverse();
+    kernel = gpKernelCreate(model);
+    kernel->precision(ctr->phi, ctr->LambdaInv, ctr->logLambdaDet);
     ctr->LambdaInvNew     = ctr->LambdaInv;
-    LambdaInvChol = ctr->LambdaInv.llt().matrixL();
-    ctr->logLambdaDet     = -2.0 * LambdaInvChol.diagonal().array().log().sum();
     ctr->logLambdaDetNew  = ctr->logLambdaDet;
   } else {
     ctr->LambdaInv.diagonal().array() += 1;
@@ -120,6 +124,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   (dgn->fhat).resize(ctr->n); (dgn->fhat).setZero();
   (dgn->modProb).resize(ctr->pM, ctr->nRec); (dgn->modProb).setZero();
   (dgn->modCount).resize(ctr->pM, ctr->nRec); (dgn->modCount).setZero();
+  (dgn->modPairCount).resize(ctr->pM, ctr->pM);   (dgn->modPairCount).setZero();
   (dgn->modInf).resize(ctr->pM, ctr->nRec); (dgn->modInf).setZero();
   (dgn->modKappa).resize(ctr->nRec); (dgn->modKappa).setZero();
 
@@ -169,6 +174,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
 
   (ctr->Rmat).resize(ctr->n, ctr->nTrees);  ctr->Rmat.setZero();
   ctr->modCount.resize(ctr->pM);            ctr->modCount.setZero();
+  ctr->modPair.resize(ctr->pM, ctr->pM);  ctr->modPair.setZero();
   ctr->modInf.resize(ctr->pM);              ctr->modInf.setZero();
   // ctr->exDLM.resize(ctr->pX, ctr->n); ctr->exDLM.setZero();
   
@@ -177,8 +183,14 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
 
   std::size_t s;
   // ---- MCMC ----
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
     } else {
@@ -192,6 +204,8 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
     ctr->sumTermT2  = 0.0;
     // ctr->exDLM.setZero();
     ctr->modCount.setZero();
+    ctr->modPair.setZero();
+    ctr->modTriple.clear();
     ctr->modInf.setZero();
     ctr->phiMH = 0; ctr->phiMHNew = 0;
     for (t = 0; t < ctr->nTrees; t++) {
@@ -235,7 +249,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
         (R::dgamma(ctr->phiNew, 0.5, 2.0, 1) - 
         R::dgamma(ctr->phi, 0.5, 2.0, 1));
 
-      if (log(R::runif(0, 1) < phiMHRatio)) {
+      if (log(R::runif(0, 1)) < phiMHRatio) {
         ctr->phi          = ctr->phiNew;
         logphi            = logphiNew;
         ctr->LambdaInv    = ctr->LambdaInvNew;
@@ -251,9 +265,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
       }
 
       ctr->phiNew           = exp(logphiNew);
-      ctr->LambdaInvNew     = (ctr->phiNew * ctr->DistMat).array().exp().matrix().inverse();
-      LambdaInvChol         = ctr->LambdaInvNew.llt().matrixL();
-      ctr->logLambdaDetNew  = -2.0*LambdaInvChol.diagonal().array().log().sum();
+      kernel->precision(ctr->phiNew, ctr->LambdaInvNew, ctr->logLambdaDetNew);
     }
     
     // -- Record --
@@ -265,6 +277,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
       (dgn->termNodesMod).col(ctr->record - 1)  = ctr->nTermMod;
       (dgn->modProb).col(ctr->record - 1)       = Mod->modProb;
       (dgn->modCount).col(ctr->record - 1)      = ctr->modCount;
+      recordModPairs(ctr, dgn);
       (dgn->modInf).col(ctr->record - 1)        = ctr->modInf / ctr->modInf.maxCoeff();
       (dgn->modKappa)(ctr->record - 1)          = ctr->modKappa;
       (dgn->phi)(ctr->record - 1)               = ctr->phi;
@@ -276,6 +289,16 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
     prog->printMark();
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
 
   // -- Prepare outout --
   // Eigen::MatrixXd exDLM = dgn->exDLM.transpose();
@@ -294,7 +317,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   Eigen::VectorXd sigma2  = dgn->sigma2;
   Eigen::VectorXd nu      = dgn->nu;
   Eigen::MatrixXd tau     = (dgn->tau).transpose();
-  Eigen::VectorXd fhat    = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat    = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma   = (dgn->gamma).transpose();
   Eigen::VectorXd phi     = dgn->phi;
 
@@ -302,10 +325,14 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
   Eigen::VectorXd kappa         = dgn->modKappa;
   Eigen::MatrixXd modProb       = (dgn->modProb).transpose();
   Eigen::MatrixXd modCount      = (dgn->modCount).transpose();
+  Eigen::MatrixXd modPairCount  = dgn->modPairCount;
+  Eigen::MatrixXd modTriples    = modTripleMatrix(dgn, ctr->pM);
   Eigen::MatrixXd modInf        = (dgn->modInf).transpose();
 
   Eigen::MatrixXd modAccept((dgn->treeModAccept).size(), 5);
 
+  std::string kernelName = kernel ? kernel->name : "";
+  delete kernel;
   delete prog;
   delete ctr;
   delete dgn;
@@ -314,7 +341,7 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
     delete modTrees[s];
   }
 
-  return(Rcpp::List::create(// Named("DLM") = wrap(exDLM),
+  Rcpp::List out = Rcpp::List::create(// Named("DLM") = wrap(exDLM),
                             // Named("DLMse") = wrap(ex2DLM),
                             // Named("DLfun") = wrap(cumDLM),
                             // Named("DLfunse") = wrap(cum2DLM),
@@ -331,7 +358,15 @@ Rcpp::List dlmtreeGPGaussian(const Rcpp::List model)
                             Named("modProb")        = wrap(modProb),
                             Named("modCount")       = wrap(modCount),
                             Named("modInf")         = wrap(modInf),
-                            Named("treeModAccept")  = wrap(modAccept)));
+                            Named("treeModAccept")  = wrap(modAccept));
+  out["modPairCount"]   = wrap(modPairCount);
+  out["modTripleCount"] = wrap(modTriples);
+  out["mcmcIter"] = mcmcIter;
+  if (kernelName.size() > 0)
+    out["gpKernel"] = kernelName;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeGPGaussian
 
@@ -350,11 +385,12 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree, dlmtreeCtr* ctr, dlmtreeL
   double RtR          = (ctr->R).dot(ctr->R);
   double RtZVgZtR     = ZtR.dot((ctr->Vg).selfadjointView<Eigen::Lower>() * ZtR);
 
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // -- modifier tree proposal --
   modTerm = modTree->listTerminal(); 
-  mhr0    = dlmtreeGP_MHR(modTerm, ctr, ZtR, treevar);
+  dlmtreeGP_MHR(modTerm, ctr, ZtR, treevar, mhr0);
   switch (modTerm.size()) {
     case 1: step  = 0; break;
     case 2: step  = sampleInt(ctr->stepProbMod, 1 - ctr->stepProbMod[3]); break;
@@ -365,7 +401,7 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree, dlmtreeCtr* ctr, dlmtreeL
 
   if (success && (stepMhr == stepMhr)) {
     newModTerm  = modTree->listTerminal(1);
-    mhr         = dlmtreeGP_MHR(newModTerm, ctr, ZtR, treevar);
+    dlmtreeGP_MHR(newModTerm, ctr, ZtR, treevar, mhr);
 
     ratio = stepMhr +
       mhr.logVThetaChol - mhr0.logVThetaChol -
@@ -382,7 +418,7 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree, dlmtreeCtr* ctr, dlmtreeL
     }
     
     if (log(R::runif(0, 1)) < ratio) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       modTree->accept();
       modTerm = modTree->listTerminal();
@@ -424,13 +460,16 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree, dlmtreeCtr* ctr, dlmtreeL
   } // end loop over modTerm
   
   // -- Count modifiers used in tree --
-  Eigen::VectorXd modCount = countMods(modTree, Mod);
+  Eigen::VectorXd oblCount;
+  Eigen::VectorXd modCount = countMods(modTree, Mod, &oblCount);
   ctr->modCount += modCount;
+  if (ctr->record > 0)
+    countModPairs(modTree, ctr);
 
   // -- Record --
   if (ctr->record > 0) {    
     for (int i = 0; i < modCount.size(); ++i) {
-      if (modCount(i) > 0)
+      if (modCount(i) + oblCount(i) > 0)
         ctr->modInf(i) += ctr->tau(t);
     }
   } // end record
@@ -439,13 +478,12 @@ void dlmtreeGP_Gaussian_TreeMCMC(int t, Node* modTree, dlmtreeCtr* ctr, dlmtreeL
 
 
 // function to calculate part of MH ratio
-treeMHR dlmtreeGP_MHR(std::vector<Node*> modTerm,
-                      dlmtreeCtr* ctr, 
-                      Eigen::VectorXd ZtR,
-                      double treevar)
+void dlmtreeGP_MHR(const std::vector<Node*> &modTerm,
+                   dlmtreeCtr* ctr, 
+                   const Eigen::VectorXd &ZtR,
+                   double treevar, treeMHR &out)
 {
   std::size_t s;
-  treeMHR out;
   int pX = ctr->pX * modTerm.size();
   Eigen::MatrixXd Linv = ctr->LambdaInv / treevar;
 
@@ -464,9 +502,9 @@ treeMHR dlmtreeGP_MHR(std::vector<Node*> modTerm,
       updateGPMats(n, ctr);
     }
       
-    XXiblock.block(start, start, ctr->pX, ctr->pX)  = (n->nodevals->XtX + Linv).inverse();
-    ZtX.block(0, start, ctr->pZ, ctr->pX)           = n->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, ctr->pX)         = n->nodevals->VgZtXmat;
+    XXiblock.block(start, start, ctr->pX, ctr->pX)  = (n->nodevals->XtX() + Linv).inverse();
+    ZtX.block(0, start, ctr->pZ, ctr->pX)           = n->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, ctr->pX)         = n->nodevals->VgZtXmat();
     
     for (int i : n->nodevals->idx) {
       XtR.segment(start, ctr->pX).noalias() += ctr->X.row(i).transpose() * ctr->R(i);
@@ -500,6 +538,4 @@ treeMHR dlmtreeGP_MHR(std::vector<Node*> modTerm,
   
   out.beta          = ThetaHat.dot(XtVzInvR);
   out.logVThetaChol = VThetaChol.diagonal().array().log().sum();
-
-  return(out);
 } // end dlmtreeGP_MHR function
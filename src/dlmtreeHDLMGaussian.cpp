@@ -12,11 +12,11 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
                                   dlmtreeCtr* ctr, dlmtreeLog *dgn,
                                   modDat* Mod, exposureDat* Exp);
 
-treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
-                        std::vector<Node*> dlmTerm,
-                        dlmtreeCtr* ctr, 
-                        Eigen::VectorXd ZtR, 
-                        double treevar);
+void dlmtreeTDLM_MHR(const std::vector<Node*> &modTerm,
+                     const std::vector<Node*> &dlmTerm,
+                     dlmtreeCtr* ctr, 
+                     const Eigen::VectorXd &ZtR, 
+                     double treevar, treeMHR &out);
 
 
 //' dlmtree model with shared HDLM approach
@@ -34,6 +34,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
   ctr->burn       = as<int>(model["nBurn"]);
   ctr->thin       = as<int>(model["nThin"]);
   ctr->nRec       = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   ctr->nTrees     = as<int>(model["nTrees"]);
   ctr->Y          = as<Eigen::VectorXd>(model["Y"]);
   ctr->n          = (ctr->Y).size();
@@ -62,6 +63,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
   modDat *Mod = new modDat(as<std::vector<int> >(model["modIsNum"]),
                            as<Rcpp::List>(model["modSplitIdx"]),
                            as<std::vector<int> >(model["fullIdx"]));
+  Mod->setOblique(model);
 
   NodeStruct *modNS;
   modNS   = new ModStruct(Mod);
@@ -110,6 +112,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
 
   // ---- Logs ----
   dlmtreeLog *dgn = new dlmtreeLog;
+  topoInit(&(dgn->topo), ctr->nTrees, as<int>(model["topologyK"]));
   (dgn->gamma).resize(ctr->pZ, ctr->nRec);    (dgn->gamma).setZero();
   (dgn->sigma2).resize(ctr->nRec);            (dgn->sigma2).setZero();
   (dgn->nu).resize(ctr->nRec);                (dgn->nu).setZero();
@@ -119,6 +122,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
 
   (dgn->modProb).resize(ctr->pM, ctr->nRec);  (dgn->modProb).setZero();
   (dgn->modCount).resize(ctr->pM, ctr->nRec); (dgn->modCount).setZero();
+  (dgn->modPairCount).resize(ctr->pM, ctr->pM);   (dgn->modPairCount).setZero();
   (dgn->modInf).resize(ctr->pM, ctr->nRec);   (dgn->modInf).setZero();
   (dgn->modKappa).resize(ctr->nRec);          (dgn->modKappa).setZero();
 
@@ -168,6 +172,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
   (ctr->nTerm).array() = 1;                   ctr->nTermMod.array() = 1;
   (ctr->Rmat).resize(ctr->n, ctr->nTrees);    ctr->Rmat.setZero();
   ctr->modCount.resize(ctr->pM);              ctr->modCount.setZero();
+  ctr->modPair.resize(ctr->pM, ctr->pM);  ctr->modPair.setZero();
   ctr->modInf.resize(ctr->pM);                ctr->modInf.setZero();
   // ctr->exDLM.resize(ctr->pX, ctr->n);
   
@@ -176,8 +181,14 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
 
   std::size_t s;
   // ---- MCMC ----
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
     } else {
@@ -190,6 +201,8 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
     ctr->totTerm = 0.0; ctr->sumTermT2 = 0.0;
     // ctr->exDLM.setZero();
     ctr->modCount.setZero();
+    ctr->modPair.setZero();
+    ctr->modTriple.clear();
     ctr->modInf.setZero();
 
     for (t = 0; t < ctr->nTrees; t++) {
@@ -235,6 +248,9 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
       (dgn->termNodesMod).col(ctr->record - 1)  = ctr->nTermMod;
       (dgn->modProb).col(ctr->record - 1)       = Mod->modProb;
       (dgn->modCount).col(ctr->record - 1)      = ctr->modCount;
+      recordModPairs(ctr, dgn);
+      for (t = 0; t < ctr->nTrees; t++)
+        topoRecord(&(dgn->topo), t, modTrees[t], Mod, "", dlmTrees[t]);
       (dgn->modInf).col(ctr->record - 1)        = ctr->modInf / ctr->modInf.maxCoeff();
       (dgn->modKappa)(ctr->record - 1)          = ctr->modKappa;
       (dgn->totTerm)(ctr->record - 1)           = ctr->totTerm;
@@ -250,6 +266,16 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
     // } // end progress
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
 
   // -- Prepare outout --
   // Eigen::MatrixXd exDLM, ex2DLM;
@@ -273,7 +299,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
   Eigen::VectorXd sigma2        = dgn->sigma2;
   Eigen::VectorXd nu            = dgn->nu;
   Eigen::MatrixXd tau           = (dgn->tau).transpose();
-  Eigen::VectorXd fhat          = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat          = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::VectorXd totTerm       = dgn->totTerm;  
   Eigen::MatrixXd gamma         = (dgn->gamma).transpose();
 
@@ -281,11 +307,17 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
   Eigen::VectorXd kappa         = dgn->modKappa;
   Eigen::MatrixXd modProb       = (dgn->modProb).transpose();
   Eigen::MatrixXd modCount      = (dgn->modCount).transpose();
+  Eigen::MatrixXd modPairCount  = dgn->modPairCount;
+  Eigen::MatrixXd modTriples    = modTripleMatrix(dgn, ctr->pM);
   Eigen::MatrixXd modInf        = (dgn->modInf).transpose();
 
   Eigen::MatrixXd modAccept((dgn->treeModAccept).size(), 5);
   Eigen::MatrixXd dlmAccept((dgn->treeDLMAccept).size(), 5);
 
+  Rcpp::List topology;
+  if (dgn->topo.topK > 0)
+    topology = topoSummary(&(dgn->topo));
+
   delete prog;
   delete ctr;
   delete dgn;
@@ -296,7 +328,7 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
     delete dlmTrees[s];
   }
 
-  return(Rcpp::List::create(// Named("DLM") = wrap(exDLM),
+  Rcpp::List out = Rcpp::List::create(// Named("DLM") = wrap(exDLM),
                             // Named("DLMse") = wrap(ex2DLM),
                             // Named("DLfun") = wrap(cumDLM),
                             // Named("DLfunse") = wrap(cum2DLM),
@@ -315,7 +347,15 @@ Rcpp::List dlmtreeHDLMGaussian(const Rcpp::List model)
                             Named("modCount")       = wrap(modCount),
                             Named("modInf")         = wrap(modInf),
                             Named("treeModAccept")  = wrap(modAccept),
-                            Named("treeDLMAccept")  = wrap(dlmAccept)));
+                            Named("treeDLMAccept")  = wrap(dlmAccept));
+  out["modPairCount"]   = wrap(modPairCount);
+  out["modTripleCount"] = wrap(modTriples);
+  out["mcmcIter"] = mcmcIter;
+  if (topology.size() > 0)
+    out["topology"] = topology;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeHDLMGaussian
 
@@ -336,12 +376,13 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
   double RtR          = (ctr->R).dot(ctr->R);
   double RtZVgZtR     = ZtR.dot((ctr->Vg).selfadjointView<Eigen::Lower>() * ZtR);
 
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // -- List terminal nodes --
   modTerm = modTree->listTerminal();
   dlmTerm = dlmTree->listTerminal();
-  mhr0    = dlmtreeTDLM_MHR(modTerm, dlmTerm, ctr, ZtR, treevar);
+  dlmtreeTDLM_MHR(modTerm, dlmTerm, ctr, ZtR, treevar, mhr0);
 
   // -- Propose new TDLM tree --
   switch (dlmTerm.size()) {
@@ -355,7 +396,7 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
   if (success) {
     newDlmTerm = dlmTree->listTerminal(1);
     modTree->setUpdateXmat(1);
-    mhr = dlmtreeTDLM_MHR(modTerm, newDlmTerm, ctr, ZtR, treevar);
+    dlmtreeTDLM_MHR(modTerm, newDlmTerm, ctr, ZtR, treevar, mhr);
     
     ratio =
       stepMhr +
@@ -372,7 +413,7 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
     }
 
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       dlmTree->accept();
       dlmTerm = dlmTree->listTerminal();
@@ -397,7 +438,7 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
 
   if (success && (stepMhr == stepMhr)) {
     newModTerm = modTree->listTerminal(1);
-    mhr   = dlmtreeTDLM_MHR(newModTerm, dlmTerm, ctr, ZtR, treevar);
+    dlmtreeTDLM_MHR(newModTerm, dlmTerm, ctr, ZtR, treevar, mhr);
     ratio = stepMhr + mhr.logVThetaChol - mhr0.logVThetaChol -
       (0.5 * (ctr->n + 1.0) *
         (log(0.5 * (RtR - RtZVgZtR - mhr.beta) + ctr->xiInvSigma2) -
@@ -412,7 +453,7 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
     }
     
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       modTree->accept();
       modTerm = modTree->listTerminal();
@@ -434,13 +475,16 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
   ctr->nTerm(t)     = mhr0.nDlmTerm;  
   
   // -- Count modifiers used in tree --
-  Eigen::VectorXd modCount = countMods(modTree, Mod);
+  Eigen::VectorXd oblCount;
+  Eigen::VectorXd modCount = countMods(modTree, Mod, &oblCount);
   ctr->modCount += modCount;
+  if (ctr->record > 0)
+    countModPairs(modTree, ctr);
 
   // -- Record --
   if (ctr->record > 0) {    
     for (int i = 0; i < modCount.size(); ++i) {
-      if (modCount(i) > 0){
+      if (modCount(i) + oblCount(i) > 0){
         ctr->modInf(i) += ctr->tau(t);
       }
     }
@@ -479,16 +523,15 @@ void dlmtreeHDLMGaussian_TreeMCMC(int t, Node* modTree, Node* dlmTree,
 } // end dlmtreeHDLMGaussian_TreeMCMC function
 
 
-treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm, 
-                        std::vector<Node*> dlmTerm,
-                        dlmtreeCtr* ctr, 
-                        Eigen::VectorXd ZtR, 
-                        double treevar)
+void dlmtreeTDLM_MHR(const std::vector<Node*> &modTerm, 
+                     const std::vector<Node*> &dlmTerm,
+                     dlmtreeCtr* ctr, 
+                     const Eigen::VectorXd &ZtR, 
+                     double treevar, treeMHR &out)
 // Calculate part of Metropolis-Hastings ratio and make draws from full
 // conditional. 
 {
   std::size_t s;
-  treeMHR out;
   int pXDlm   = int(dlmTerm.size());
   int pXMod   = int(modTerm.size());
   int pXComb  = pXMod * pXDlm;
@@ -515,7 +558,7 @@ treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
       out.nDlmTerm      = 1.0; 
       out.nModTerm      = 1.0;
 
-      return(out);
+      return;
     } // return single TDLM and single modifier node
 
     X.col(0) = ctr->X1;
@@ -547,7 +590,7 @@ treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
       out.termT2        = (out.draw).dot(out.draw);
       out.nDlmTerm      = double(pXDlm); out.nModTerm = 1.0;
 
-      return(out);
+      return;
     }
   }
 
@@ -576,12 +619,12 @@ treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
         ++j;
       } // end loop over node indices
       
-      n->nodevals->XtX.resize(pXDlm, pXDlm);
-      n->nodevals->XtX        = Xtemp.transpose() * Xtemp;
-      n->nodevals->ZtXmat.resize(ctr->pZ, pXDlm);
-      n->nodevals->ZtXmat     = Ztemp.transpose() * Xtemp;
-      n->nodevals->VgZtXmat.resize(ctr->pZ, pXDlm);
-      n->nodevals->VgZtXmat   = ctr->Vg * n->nodevals->ZtXmat;
+      n->nodevals->XtX().resize(pXDlm, pXDlm);
+      n->nodevals->XtX()        = Xtemp.transpose() * Xtemp;
+      n->nodevals->ZtXmat().resize(ctr->pZ, pXDlm);
+      n->nodevals->ZtXmat()     = Ztemp.transpose() * Xtemp;
+      n->nodevals->VgZtXmat().resize(ctr->pZ, pXDlm);
+      n->nodevals->VgZtXmat()   = ctr->Vg * n->nodevals->ZtXmat();
       n->nodevals->updateXmat = 0;
       
       XtR.segment(start, pXDlm) = Xtemp.transpose() * Rtemp;
@@ -592,9 +635,9 @@ treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
       } // end loop over node indices
       
     } // end update xblock and ztx block
-    XXiblock.block(start, start, pXDlm, pXDlm)  = (n->nodevals->XtX + LInv).inverse();
-    ZtX.block(0, start, ctr->pZ, pXDlm)         = n->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, pXDlm)       = n->nodevals->VgZtXmat;
+    XXiblock.block(start, start, pXDlm, pXDlm)  = (n->nodevals->XtX() + LInv).inverse();
+    ZtX.block(0, start, ctr->pZ, pXDlm)         = n->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, pXDlm)       = n->nodevals->VgZtXmat();
     // }
     
     start += pXDlm;
@@ -627,6 +670,4 @@ treeMHR dlmtreeTDLM_MHR(std::vector<Node*> modTerm,
   out.termT2        = (out.draw).dot(out.draw);
   out.nDlmTerm      = pXDlm * 1.0; 
   out.nModTerm      = pXMod * 1.0;
-  
-  return(out);
 }
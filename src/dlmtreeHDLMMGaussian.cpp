@@ -21,7 +21,7 @@ using namespace Rcpp;
 // MCMC updated
 // 1. Tree pair: Tree1 & Tree 2
 // 2. Exp object is a vector due to mixture setting
-void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS,
+void dlmtreeHDLMMGaussian_TreeMCMC(int t, const std::vector<NodeStruct*> &expNS,
                                    Node* modTree, 
                                    Node* dlmTree1, Node* dlmTree2,
                                    dlmtreeCtr* ctr, dlmtreeLog *dgn,
@@ -30,11 +30,11 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS,
 // MHR updated
 // 1. Tree pair: Tree1 & Tree 2
 // 2. Exposure-variance: m1Var, m2Var, mixVar                      
-treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
-                         std::vector<Node*> dlmTerm1, 
-                         std::vector<Node*> dlmTerm2,
-                         dlmtreeCtr* ctr, Eigen::VectorXd ZtR, 
-                         double treeVar, double m1Var, double m2Var, double mixVar);
+void dlmtreeHDLMM_MHR(const std::vector<Node*> &modTerm,
+                      const std::vector<Node*> &dlmTerm1, 
+                      const std::vector<Node*> &dlmTerm2,
+                      dlmtreeCtr* ctr, const Eigen::VectorXd &ZtR, 
+                      double treeVar, double m1Var, double m2Var, double mixVar, treeMHR &out);
 
 //' dlmtree model with HDLMM approach
 //'
@@ -51,6 +51,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   ctr->burn   = as<int>(model["nBurn"]); 
   ctr->thin   = as<int>(model["nThin"]); 
   ctr->nRec   = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   ctr->nTrees = as<int>(model["nTrees"]);  
 
   // Data setup
@@ -106,6 +107,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   modDat *Mod = new modDat(as<std::vector<int>>(model["modIsNum"]), 
                            as<Rcpp::List>(model["modSplitIdx"]), 
                            as<std::vector<int>>(model["fullIdx"]));
+  Mod->setOblique(model);
 
   NodeStruct *modNS; 
   modNS = new ModStruct(Mod); 
@@ -122,7 +124,9 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
           as<Rcpp::List>(exp_dat[i])["Tcalc"]), ctr->Z, ctr->Vg));
   }
 
-  ctr->pX       = Exp[0]->pX; 
+  ctr->pX       = 0;  // longest lag window, exposures may differ (ragged mixture)
+  for (exposureDat* e : Exp)
+    ctr->pX = std::max(ctr->pX, e->pX);
   ctr->nSplits  = 0;
 
   // *** Mixture / interaction management ***
@@ -136,11 +140,15 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   }
 
   // *** Create trees ***
-  NodeStruct *expNS;
-  expNS = new DLNMStruct(0, ctr->nSplits + 1,
-                         1, int (ctr->pX), 
-                         as<Eigen::VectorXd>(model["splitProb"]),
-                         as<Eigen::VectorXd>(model["timeProb"]));
+  // Root structure of each exposure, over its own lag window
+  std::vector<NodeStruct*> expNS;
+  Rcpp::List timeProb = as<Rcpp::List>(model["timeProb"]);
+  for (int i = 0; i < ctr->nExp; i++) {
+    expNS.push_back(new DLNMStruct(0, ctr->nSplits + 1,
+                                   1, int (Exp[i]->pX), 
+                                   as<Eigen::VectorXd>(model["splitProb"]),
+                                   as<Eigen::VectorXd>(timeProb[i])));
+  }
 
   // Exposure information vectors
   ctr->expProb = as<Eigen::VectorXd>(model["expProb"]);
@@ -170,14 +178,13 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
     ctr->dlmTree2Exp(t) = sampleInt(ctr->expProb);
     dlmTrees1.push_back(new Node(0, 1));        
     dlmTrees2.push_back(new Node(0, 1));        
-    dlmTrees1[t]->nodestruct = expNS->clone();  
-    dlmTrees2[t]->nodestruct = expNS->clone();  
+    dlmTrees1[t]->nodestruct = expNS[ctr->dlmTree1Exp(t)]->clone();  
+    dlmTrees2[t]->nodestruct = expNS[ctr->dlmTree2Exp(t)]->clone();  
     Exp[ctr->dlmTree1Exp(t)]->updateNodeVals(dlmTrees1[t]); 
     Exp[ctr->dlmTree2Exp(t)]->updateNodeVals(dlmTrees2[t]); 
   }
 
   delete modNS;
-  // delete expNS;
 
   // *** Logs ***
   dlmtreeLog *dgn = new dlmtreeLog;
@@ -203,6 +210,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   // Modifier tree log
   (dgn->modProb).resize(ctr->pM, ctr->nRec);            (dgn->modProb).setZero();   
   (dgn->modCount).resize(ctr->pM, ctr->nRec);           (dgn->modCount).setZero();  
+  (dgn->modPairCount).resize(ctr->pM, ctr->pM);   (dgn->modPairCount).setZero();
   (dgn->modInf).resize(ctr->pM, ctr->nRec);             (dgn->modInf).setZero();  
   (dgn->modKappa).resize(ctr->nRec);                    (dgn->modKappa).setZero(); 
   (dgn->termNodesMod).resize(ctr->nTrees, ctr->nRec);   (dgn->termNodesMod).setZero();
@@ -264,6 +272,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   // Modifier trees
   ctr->nTermMod.resize(ctr->nTrees);    (ctr->nTermMod).array() = 1; 
   ctr->modCount.resize(ctr->pM);        (ctr->modCount).setZero();   
+  ctr->modPair.resize(ctr->pM, ctr->pM);  ctr->modPair.setZero();
   ctr->modInf.resize(ctr->pM);          (ctr->modInf).setZero();     
 
   // Partial residual matrix
@@ -274,7 +283,14 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   progressMeter* prog = new progressMeter(ctr);
 
   // Thinning and burn-in process
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
+    Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
     } else {
@@ -306,6 +322,8 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
 
     // Reset modifier tree parameters
     (ctr->modCount).setZero();
+    ctr->modPair.setZero();
+    ctr->modTriple.clear();
     (ctr->modInf).setZero();
 
     // For each dlmTree pair & Modifier tree, perform one MCMC iteration
@@ -431,6 +449,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
       (dgn->termNodesMod).col(ctr->record - 1)  = ctr->nTermMod;
       (dgn->modProb).col(ctr->record - 1)       = Mod->modProb;
       (dgn->modCount).col(ctr->record - 1)      = ctr->modCount;
+      recordModPairs(ctr, dgn);
       (dgn->modInf).col(ctr->record - 1)        = ctr->modInf / ctr->modInf.maxCoeff();
       (dgn->modKappa)(ctr->record - 1)          = ctr->modKappa;
 
@@ -440,6 +459,16 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
     // Progress mark
     prog->printMark();
   } // end MCMC
+
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
   // Rcout << "MCMC complete \n";
 
 
@@ -465,7 +494,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   Eigen::VectorXd nu      = dgn->nu;
   Eigen::MatrixXd tau     = (dgn->tau).transpose();
   Eigen::VectorXd totTerm = dgn->totTerm;
-  Eigen::VectorXd fhat    = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat    = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma   = (dgn->gamma).transpose();
 
   // dlmTree information
@@ -500,6 +529,8 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   Eigen::VectorXd kappa         = dgn->modKappa;
   Eigen::MatrixXd modProb       = (dgn->modProb).transpose();
   Eigen::MatrixXd modCount      = (dgn->modCount).transpose();
+  Eigen::MatrixXd modPairCount  = dgn->modPairCount;
+  Eigen::MatrixXd modTriples    = modTripleMatrix(dgn, ctr->pM);
   Eigen::MatrixXd modInf        = (dgn->modInf).transpose();
 
   Eigen::MatrixXd modAccept((dgn->treeModAccept).size(), 9);
@@ -513,6 +544,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
   delete dgn;
   for (s = 0; s < Exp.size(); s++){       
     delete Exp[s];
+    delete expNS[s];
   }
   delete Mod;
   for (s = 0; s < modTrees.size(); s++) { 
@@ -521,7 +553,7 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
     delete dlmTrees2[s];
   }
 
-  return(Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs), 
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs), 
                             Named("MIX")            = wrap(MIX),
                             Named("termRules")      = wrap(termRule),
                             Named("termRuleMIX")    = wrap(termRuleMIX),
@@ -539,7 +571,13 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
                             Named("muMix")          = wrap(muMix),
                             Named("modCount")       = wrap(modCount),
                             Named("modInf")         = wrap(modInf),
-                            Named("treeDLMAccept")  = wrap(dlmAccept)));
+                            Named("treeDLMAccept")  = wrap(dlmAccept));
+  out["modPairCount"]   = wrap(modPairCount);
+  out["modTripleCount"] = wrap(modTriples);
+  out["mcmcIter"] = mcmcIter;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
                             //Named("fhat") = wrap(fhat),
                             //Named("totTerm") = wrap(totTerm),
                             //Named("expInf") = wrap(expInf),
@@ -550,7 +588,8 @@ Rcpp::List dlmtreeHDLMMGaussian(const Rcpp::List model){
 } // end dlmtreeTDLMMGaussian
 
 
-void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree, 
+void dlmtreeHDLMMGaussian_TreeMCMC(int t, const std::vector<NodeStruct*> &expNS,
+                                   Node* modTree, 
                                    Node* dlmTree1, Node* dlmTree2,
                                    dlmtreeCtr* ctr, dlmtreeLog *dgn,
                                    modDat* Mod, std::vector<exposureDat*> Exp)
@@ -570,7 +609,8 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   std::vector<Node*> newModTerm, newDlmTerm1, newDlmTerm2; 
   Node* newTree   = 0;    
 
-  treeMHR mhr0, mhr;                                  
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // Pre-calculation for MH ratio update
   Eigen::VectorXd ZtR = (ctr->Z).transpose() * (ctr->R);
@@ -597,9 +637,9 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   }
 
   // Current null state MHR
-  mhr0 = dlmtreeHDLMM_MHR(modTerm, dlmTerm1, dlmTerm2, 
-                          ctr, ZtR, treeVar, 
-                          m1Var, m2Var, mixVar);
+  dlmtreeHDLMM_MHR(modTerm, dlmTerm1, dlmTerm2, 
+                   ctr, ZtR, treeVar, 
+                   m1Var, m2Var, mixVar, mhr0);
 
   // // [Tree pair update]
   // // *** Propose a new TDLMM tree 1 ***
@@ -860,7 +900,7 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
 
   // *** Create a new tree for proposal ***
   newTree = new Node(0, 1);               // Start from the root
-  newTree->nodestruct = expNS->clone();   // Construct nodestruct
+  newTree->nodestruct = expNS[newExp]->clone(); // Lag window of the new exposure
   drawTree(newTree, newTree, ctr->treePrior[0], ctr->treePrior[1]); // Grow a tree structure from the root
   newTree->setUpdate(1);                  // Set a flag for updateNodeVals
   newDlmTerm1 = newTree->listTerminal();  // List the number of terminal nodes for the new tree
@@ -872,9 +912,9 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   modTree->setUpdateXmat(1);
 
   // MH ratio with a new terminal and the exposure: newDlmTerm1, newExpVar
-  mhr = dlmtreeHDLMM_MHR(modTerm, 
-                         newDlmTerm1, dlmTerm2, ctr, ZtR, treeVar, 
-                         newExpVar, m2Var, newMixVar);
+  dlmtreeHDLMM_MHR(modTerm, 
+                   newDlmTerm1, dlmTerm2, ctr, ZtR, treeVar, 
+                   newExpVar, m2Var, newMixVar, mhr);
 
   // MH ratio - dlmTree 
   if (RtR < 0) {
@@ -902,7 +942,7 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
 
   // Accept / Reject
   if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-    mhr0    = mhr;
+    std::swap(mhr0, mhr);
     success = 2;
     
     // Update exposures
@@ -945,9 +985,14 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   stepMhr   = 0;
   success   = 1;
 
+  // *** Propose a new dlmtree 2 ***
+  step2     = 0;                          // Always propose
+  newExp    = sampleInt(ctr->expProb);    // Sample an exposure for the new tree
+  newExpVar = ctr->muExp(newExp);         // Find the exposure-specific variance for the new exposure
+
   // *** Create a new tree for proposal ***
   newTree = new Node(0, 1);               // Start from the root
-  newTree->nodestruct = expNS->clone();   // Construct nodestruct
+  newTree->nodestruct = expNS[newExp]->clone(); // Lag window of the new exposure
   drawTree(newTree, newTree, ctr->treePrior[0], ctr->treePrior[1]); // Grow a tree structure from the root
   newTree->setUpdate(1);                  // Update
   newDlmTerm2 = newTree->listTerminal();  // List the number of terminal nodes for the new tree
@@ -955,11 +1000,6 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
     Exp[newExp]->updateNodeVals(nt);      // Update the calculations
   }
 
-  // *** Propose a new dlmtree 1 ***
-  step2     = 0;                          // Always propose
-  newExp    = sampleInt(ctr->expProb);    // Sample an exposure for the new tree
-  newExpVar = ctr->muExp(newExp);         // Find the exposure-specific variance for the new exposure
-
 
   // HDLMMns
   // Update the interaction using the new exposure as well for TDLMMns/all
@@ -977,9 +1017,9 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   modTree->setUpdateXmat(1);
 
   // MH ratio with a new terminal and the exposure: newDlmTerm1, newExpVar
-  mhr = dlmtreeHDLMM_MHR(modTerm, 
-                         dlmTerm1, newDlmTerm2, ctr, ZtR, treeVar, 
-                         m1Var, newExpVar, newMixVar);
+  dlmtreeHDLMM_MHR(modTerm, 
+                   dlmTerm1, newDlmTerm2, ctr, ZtR, treeVar, 
+                   m1Var, newExpVar, newMixVar, mhr);
 
   // MH ratio - dlmTree
   if (RtR < 0) {
@@ -1006,7 +1046,7 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
 
   // Accept / Reject
   if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-    mhr0    = mhr;
+    std::swap(mhr0, mhr);
     success = 2;
     
     // Update exposures
@@ -1054,9 +1094,9 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   if (success && (stepMhr == stepMhr)) {
     newModTerm = modTree->listTerminal(1);
 
-    mhr = dlmtreeHDLMM_MHR(newModTerm, dlmTerm1, dlmTerm2, 
-                            ctr, ZtR, treeVar,
-                            m1Var, m2Var, mixVar);
+    dlmtreeHDLMM_MHR(newModTerm, dlmTerm1, dlmTerm2, 
+                      ctr, ZtR, treeVar,
+                      m1Var, m2Var, mixVar, mhr);
                             
     ratio = stepMhr + mhr.logVThetaChol - mhr0.logVThetaChol -
       (0.5 * (ctr->n + 1.0) *
@@ -1082,7 +1122,7 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
     }
 
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       modTree->accept();
       modTerm = modTree->listTerminal();
@@ -1148,14 +1188,17 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
   
   // Rcout << "TreeMCMC: Modifier count in modTree ... \n";
   // *** Count modifiers used in tree ***
-  Eigen::VectorXd modCount = countMods(modTree, Mod);
+  Eigen::VectorXd oblCount;
+  Eigen::VectorXd modCount = countMods(modTree, Mod, &oblCount);
   ctr->modCount += modCount;
+  if (ctr->record > 0)
+    countModPairs(modTree, ctr);
 
   // *** Record *** 
   // Rcout << "TreeMCMC: Record ... \n";
   if (ctr->record > 0) {    
     for (int i = 0; i < modCount.size(); i++) {
-      if (modCount(i) > 0){
+      if (modCount(i) + oblCount(i) > 0){
         ctr->modInf(i) += (ctr->tau)(t);
       }
     }
@@ -1234,16 +1277,15 @@ void dlmtreeHDLMMGaussian_TreeMCMC(int t, NodeStruct* expNS, Node* modTree,
 } // end dlmtreeHDLMMGaussian_TreeMCMC function
 
 
-treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,  
-                         std::vector<Node*> dlmTerm1,
-                         std::vector<Node*> dlmTerm2,
-                         dlmtreeCtr* ctr, 
-                         Eigen::VectorXd ZtR, 
-                         double treeVar, double m1Var, double m2Var, double mixVar)
+void dlmtreeHDLMM_MHR(const std::vector<Node*> &modTerm,  
+                      const std::vector<Node*> &dlmTerm1,
+                      const std::vector<Node*> &dlmTerm2,
+                      dlmtreeCtr* ctr, 
+                      const Eigen::VectorXd &ZtR, 
+                      double treeVar, double m1Var, double m2Var, double mixVar, treeMHR &out)
 
 {
   std::size_t s; 
-  treeMHR out; 
 
   // exposure variance
   out.m1Var = m1Var;
@@ -1291,7 +1333,7 @@ treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
     ZtX.col(k)  = (dlmTerm2[j]->nodevals)->ZtX;
   }
 
-  // Mixture & interaction
+  // Mixture & interaction: node sums are over each exposure's own lag window
   if(interaction) {
     for (i = 0; i < pXDlm1; i++) {
       for (j = 0; j < pXDlm2; j++) {
@@ -1316,18 +1358,10 @@ treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
     tempV.diagonal().noalias() += diagVar; 
     XtVzInvR = Xd.transpose() * ctr->R - VgZtX.transpose() * ZtR;
 
-    // Calculate Vtheta & Vtheta cholesky
-    Eigen::MatrixXd VTheta(pXDlm, pXDlm); 
-    VTheta.triangularView<Eigen::Lower>() =
-      tempV.selfadjointView<Eigen::Lower>().llt().solve(Eigen::MatrixXd::Identity(pXDlm, pXDlm));
-    const Eigen::MatrixXd VThetaChol = VTheta.selfadjointView<Eigen::Lower>().llt().matrixL();
-
-    // Thetahat mean
-    const Eigen::VectorXd ThetaHat = VTheta.selfadjointView<Eigen::Lower>() * XtVzInvR; 
-
-    // Thetahat variance
-    Eigen::VectorXd ThetaDraw = ThetaHat;
-    ThetaDraw.noalias() += VThetaChol * as<Eigen::VectorXd>(rnorm(pXDlm, 0, sqrt(ctr->sigma2)));
+    // Vtheta, Thetahat mean and draw
+    Eigen::VectorXd ThetaHat, ThetaDraw;
+    const double logVThetaChol =
+      gaussPostDraw(tempV, XtVzInvR, sqrt(ctr->sigma2), ThetaHat, ThetaDraw);
 
     // Full conditional draw
     out.drawAll = ThetaDraw;
@@ -1362,13 +1396,13 @@ treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
     out.fitted = Xd * out.drawAll;  // exposure matrix x delta
 
     out.beta          = ThetaHat.dot(XtVzInvR);  // The big chunk in Eq(8)
-    out.logVThetaChol = VThetaChol.diagonal().array().log().sum(); // |V_theta_a|
+    out.logVThetaChol = logVThetaChol; // |V_theta_a|
     out.termT2        = (out.drawAll).dot(out.drawAll);
     
     out.nDlmTerm = pXDlm * 1.0; 
     out.nModTerm = pXMod * 1.0;    // = 1
 
-    return(out);
+    return;
   } // End of modifier tree with only one node
 
   // *** Multiple Modifier nodes ***
@@ -1396,20 +1430,20 @@ treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
       j++;
     } // end loop over node indices
       
-    n->nodevals->XtX.resize(pXDlm, pXDlm);
-    n->nodevals->XtX        = Xtemp.transpose() * Xtemp;
-    n->nodevals->ZtXmat.resize(ctr->pZ, pXDlm);
-    n->nodevals->ZtXmat     = Ztemp.transpose() * Xtemp;
-    n->nodevals->VgZtXmat.resize(ctr->pZ, pXDlm);
-    n->nodevals->VgZtXmat   = ctr->Vg * n->nodevals->ZtXmat;
+    n->nodevals->XtX().resize(pXDlm, pXDlm);
+    n->nodevals->XtX()        = Xtemp.transpose() * Xtemp;
+    n->nodevals->ZtXmat().resize(ctr->pZ, pXDlm);
+    n->nodevals->ZtXmat()     = Ztemp.transpose() * Xtemp;
+    n->nodevals->VgZtXmat().resize(ctr->pZ, pXDlm);
+    n->nodevals->VgZtXmat()   = ctr->Vg * n->nodevals->ZtXmat();
     n->nodevals->updateXmat = 0;
     
     XtR.segment(start, pXDlm) = Xtemp.transpose() * Rtemp;
       
     // Update blocks
-    XtXblock.block(start, start, pXDlm, pXDlm)  = ((n->nodevals->XtX) + LInv).inverse();
-    ZtX.block(0, start, ctr->pZ, pXDlm)         = n->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, pXDlm)       = n->nodevals->VgZtXmat;
+    XtXblock.block(start, start, pXDlm, pXDlm)  = ((n->nodevals->XtX()) + LInv).inverse();
+    ZtX.block(0, start, ctr->pZ, pXDlm)         = n->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, pXDlm)       = n->nodevals->VgZtXmat();
     
     // Move to the next block
     start += pXDlm;
@@ -1481,6 +1515,4 @@ treeMHR dlmtreeHDLMM_MHR(std::vector<Node*> modTerm,
   out.nTerm2    = double(pXDlm2);
   out.nDlmTerm  = pXDlm * 1.0; 
   out.nModTerm  = pXMod * 1.0;
-
-  return(out);
 }
@@ -12,13 +12,13 @@ void dlmtreeTDLMFixed_Gaussian_TreeMCMC(
   int t, std::vector<Node*> fixedNodes,
   dlmtreeCtr* ctr, dlmtreeLog *dgn, exposureDat* Exp);
 
-treeMHR dlmtreeTDLMFixedMHR(std::vector<Node*> fixedNodes,
-                   dlmtreeCtr* ctr, 
-                   Eigen::VectorXd ZtR,
-                   double treevar,
-                   double updateNested);
+void dlmtreeTDLMFixedMHR(const std::vector<Node*> &fixedNodes,
+                         dlmtreeCtr* ctr, 
+                         const Eigen::VectorXd &ZtR,
+                         double treevar,
+                         double updateNested, treeMHR &out);
 
-double calcLogRatioFixedTDLM(treeMHR mhr0, treeMHR mhr, double RtR, 
+double calcLogRatioFixedTDLM(const treeMHR &mhr0, const treeMHR &mhr, double RtR, 
                              double RtZVgZtR, dlmtreeCtr* ctr, 
                              double stepMhr, double treevar);
 
@@ -38,6 +38,7 @@ Rcpp::List dlmtreeTDLMFixedGaussian(const Rcpp::List model)
   ctr->burn         = as<int>(model["nBurn"]);
   ctr->thin         = as<int>(model["nThin"]);
   ctr->nRec         = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget   = as<double>(model["timeBudget"]);
   ctr->nTrees       = as<int>(model["nTrees"]);
   ctr->verbose      = bool (model["verbose"]);
   ctr->diagnostics  = bool (model["diagnostics"]);
@@ -158,8 +159,14 @@ Rcpp::List dlmtreeTDLMFixedGaussian(const Rcpp::List model)
 
   std::size_t s;
   // ---- MCMC ----
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
     } else {
@@ -218,6 +225,16 @@ Rcpp::List dlmtreeTDLMFixedGaussian(const Rcpp::List model)
     prog->printMark();
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
 
   // -- Prepare outout --  
   Eigen::MatrixXd TreeStructs((dgn->DLMexp).size(), 9);
@@ -228,7 +245,7 @@ Rcpp::List dlmtreeTDLMFixedGaussian(const Rcpp::List model)
   Eigen::VectorXd sigma2  = dgn->sigma2;
   Eigen::VectorXd nu      = dgn->nu;
   Eigen::MatrixXd tau     = (dgn->tau).transpose();
-  Eigen::VectorXd fhat    = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat    = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma   = (dgn->gamma).transpose();
   Eigen::VectorXd phi     = dgn->phi;
 
@@ -241,13 +258,17 @@ Rcpp::List dlmtreeTDLMFixedGaussian(const Rcpp::List model)
     }
   }
 
-  return(Rcpp::List::create(Named("TreeStructs")  = wrap(TreeStructs),
-                            Named("fhat")         = wrap(fhat),
-                            Named("sigma2")       = wrap(sigma2),
-                            Named("nu")           = wrap(nu),
-                            Named("tau")          = wrap(tau),
-                            Named("gamma")        = wrap(gamma),
-                            Named("phi")          = wrap(phi)));
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs")  = wrap(TreeStructs),
+                                      Named("fhat")         = wrap(fhat),
+                                      Named("sigma2")       = wrap(sigma2),
+                                      Named("nu")           = wrap(nu),
+                                      Named("tau")          = wrap(tau),
+                                      Named("gamma")        = wrap(gamma),
+                                      Named("phi")          = wrap(phi));
+  out["mcmcIter"] = mcmcIter;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeHDLMGaussian
 
@@ -267,11 +288,11 @@ void dlmtreeTDLMFixed_Gaussian_TreeMCMC(
   std::vector<Node*> dlmTerm;
 
   Eigen::VectorXd ZtR = (ctr->Z).transpose() * (ctr->R);
-  treeMHR mhr0        = dlmtreeTDLMFixedMHR(fixedNodes, ctr, ZtR, treevar, 0);
+  treeMHR *mhrWork    = mhrPair(ctr, t);
+  treeMHR &mhr0       = mhrWork[0], &mhr = mhrWork[1];
+  dlmtreeTDLMFixedMHR(fixedNodes, ctr, ZtR, treevar, 0, mhr0);
   double RtR          = (ctr->R).dot(ctr->R);
   double RtZVgZtR     = ZtR.dot((ctr->Vg).selfadjointView<Eigen::Lower>() * ZtR);
-
-  treeMHR mhr;
   
   // -- Propose new nested tree at each modifier node --
   for (Node* tn : fixedNodes) {
@@ -284,26 +305,23 @@ void dlmtreeTDLMFixed_Gaussian_TreeMCMC(
     success = tn->nodevals->nestedTree->isProposed();
     
     if (success && (stepMhr == stepMhr)) {
-      Eigen::MatrixXd XtX       = tn->nodevals->XtX;
-      Eigen::MatrixXd ZtXmat    = tn->nodevals->ZtXmat;
-      Eigen::MatrixXd VgZtXmat  = tn->nodevals->VgZtXmat;
+      tn->nodevals->stage();
       tn->nodevals->updateXmat  = 1;
       // if (ctr->nSplits == 0)
       
-      mhr   = dlmtreeTDLMFixedMHR(fixedNodes, ctr, ZtR, treevar, 1);
+      dlmtreeTDLMFixedMHR(fixedNodes, ctr, ZtR, treevar, 1, mhr);
       // else
       //   mhr = dlmtreeTDLNMNested_MHR(modTerm, ctr, ZtR, treevar, 1);
       ratio = calcLogRatioFixedTDLM(mhr0, mhr, RtR, RtZVgZtR, ctr, stepMhr, treevar);
 
       // Rcout << " ratioTT=" << ratio;
       if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-        mhr0    = mhr;
+        std::swap(mhr0, mhr);
         success = 2;
         tn->nodevals->nestedTree->accept();
+        tn->nodevals->commit();
       } else {
-        tn->nodevals->XtX       = XtX;
-        tn->nodevals->ZtXmat    = ZtXmat;
-        tn->nodevals->VgZtXmat  = VgZtXmat;
+        tn->nodevals->discard();
       } // end MHR accept/reject
     } // end nested tree proposal
     if (success < 2){
@@ -359,14 +377,13 @@ void dlmtreeTDLMFixed_Gaussian_TreeMCMC(
 
 
 // function to calculate part of MH ratio
-treeMHR dlmtreeTDLMFixedMHR(std::vector<Node*> fixedNodes,
-                            dlmtreeCtr* ctr, 
-                            Eigen::VectorXd ZtR,
-                            double treevar,
-                            double updateNested)
+void dlmtreeTDLMFixedMHR(const std::vector<Node*> &fixedNodes,
+                         dlmtreeCtr* ctr, 
+                         const Eigen::VectorXd &ZtR,
+                         double treevar,
+                         double updateNested, treeMHR &out)
 {
   std::size_t s, s2;
-  treeMHR out;
   int pXMod   = int(fixedNodes.size());
   int totTerm = 0;
   std::vector<std::vector<Node*> > nestedTerm;
@@ -414,12 +431,12 @@ treeMHR dlmtreeTDLMFixedMHR(std::vector<Node*> fixedNodes,
         ++j;
       }
       
-      fixedNodes[s]->nodevals->XtX.resize(pX, pX);
-      fixedNodes[s]->nodevals->XtX        = Xtemp.transpose() * Xtemp;
-      fixedNodes[s]->nodevals->ZtXmat.resize(ctr->pZ, pX);
-      fixedNodes[s]->nodevals->ZtXmat     = Ztemp.transpose() * Xtemp;
-      fixedNodes[s]->nodevals->VgZtXmat.resize(ctr->pZ, pX);
-      fixedNodes[s]->nodevals->VgZtXmat   = ctr->Vg * fixedNodes[s]->nodevals->ZtXmat;
+      fixedNodes[s]->nodevals->XtX().resize(pX, pX);
+      fixedNodes[s]->nodevals->XtX()        = Xtemp.transpose() * Xtemp;
+      fixedNodes[s]->nodevals->ZtXmat().resize(ctr->pZ, pX);
+      fixedNodes[s]->nodevals->ZtXmat()     = Ztemp.transpose() * Xtemp;
+      fixedNodes[s]->nodevals->VgZtXmat().resize(ctr->pZ, pX);
+      fixedNodes[s]->nodevals->VgZtXmat()   = ctr->Vg * fixedNodes[s]->nodevals->ZtXmat();
       fixedNodes[s]->nodevals->updateXmat = 0;
       XtR.segment(start, pX) = Xtemp.transpose() * Rtemp;
       
@@ -431,9 +448,9 @@ treeMHR dlmtreeTDLMFixedMHR(std::vector<Node*> fixedNodes,
     
     LInv.resize(pX, pX);      LInv.setZero();
     LInv.diagonal().array() += 1.0 / treevar;
-    XXiblock.block(start, start, pX, pX)  = (fixedNodes[s]->nodevals->XtX + LInv).inverse();
-    ZtX.block(0, start, ctr->pZ, pX)      = fixedNodes[s]->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, pX)    = fixedNodes[s]->nodevals->VgZtXmat;
+    XXiblock.block(start, start, pX, pX)  = (fixedNodes[s]->nodevals->XtX() + LInv).inverse();
+    ZtX.block(0, start, ctr->pZ, pX)      = fixedNodes[s]->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, pX)    = fixedNodes[s]->nodevals->VgZtXmat();
     
     start += pX;
   } // end loop over modifier nodes
@@ -471,12 +488,10 @@ treeMHR dlmtreeTDLMFixedMHR(std::vector<Node*> fixedNodes,
   out.termT2        = (out.draw).dot(out.draw);
   out.totTerm       = double(totTerm); 
   out.nModTerm      = double(pXMod);
-
-  return(out);
 } // end dlmtreeMHR function
 
 
-double calcLogRatioFixedTDLM(treeMHR mhr0, treeMHR mhr, double RtR, 
+double calcLogRatioFixedTDLM(const treeMHR &mhr0, const treeMHR &mhr, double RtR, 
                              double RtZVgZtR, dlmtreeCtr* ctr, 
                              double stepMhr, double treevar)
 {
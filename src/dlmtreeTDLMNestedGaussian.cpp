@@ -8,7 +8,7 @@
 using namespace Rcpp;
 
 
-double calcLogRatio(treeMHR mhr0, treeMHR mhr, double RtR, double RtZVgZtR,
+double calcLogRatio(const treeMHR &mhr0, const treeMHR &mhr, double RtR, double RtZVgZtR,
                     dlmtreeCtr* ctr, double stepMhr, double treevar)
 {
   return(stepMhr +
@@ -19,12 +19,11 @@ double calcLogRatio(treeMHR mhr0, treeMHR mhr, double RtR, double RtZVgZtR,
          (log(treevar) * 0.5 * round(mhr.totTerm - mhr0.totTerm)));
 }
 
-treeMHR dlmtreeTDLMNested_MHR(std::vector<Node*> modTerm,
-                              dlmtreeCtr* ctr, Eigen::VectorXd ZtR,
-                              double treevar, bool updateNested)
+void dlmtreeTDLMNested_MHR(const std::vector<Node*> &modTerm,
+                           dlmtreeCtr* ctr, const Eigen::VectorXd &ZtR,
+                           double treevar, bool updateNested, treeMHR &out)
 {
   std::size_t s, s2;
-  treeMHR out;
   int pXMod   = int(modTerm.size());
   int totTerm = 0;
   std::vector<std::vector<Node*> > nestedTerm;
@@ -70,12 +69,12 @@ treeMHR dlmtreeTDLMNested_MHR(std::vector<Node*> modTerm,
         ++j;
       }
       
-      modTerm[s]->nodevals->XtX.resize(pX, pX);
-      modTerm[s]->nodevals->XtX         = Xtemp.transpose() * Xtemp;
-      modTerm[s]->nodevals->ZtXmat.resize(ctr->pZ, pX);
-      modTerm[s]->nodevals->ZtXmat      = Ztemp.transpose() * Xtemp;
-      modTerm[s]->nodevals->VgZtXmat.resize(ctr->pZ, pX);
-      modTerm[s]->nodevals->VgZtXmat    = ctr->Vg * modTerm[s]->nodevals->ZtXmat;
+      modTerm[s]->nodevals->XtX().resize(pX, pX);
+      modTerm[s]->nodevals->XtX()         = Xtemp.transpose() * Xtemp;
+      modTerm[s]->nodevals->ZtXmat().resize(ctr->pZ, pX);
+      modTerm[s]->nodevals->ZtXmat()      = Ztemp.transpose() * Xtemp;
+      modTerm[s]->nodevals->VgZtXmat().resize(ctr->pZ, pX);
+      modTerm[s]->nodevals->VgZtXmat()    = ctr->Vg * modTerm[s]->nodevals->ZtXmat();
       modTerm[s]->nodevals->updateXmat  = 0;
       XtR.segment(start, pX) = Xtemp.transpose() * Rtemp;
       
@@ -87,9 +86,9 @@ treeMHR dlmtreeTDLMNested_MHR(std::vector<Node*> modTerm,
     
     LInv.resize(pX, pX);    LInv.setZero();
     LInv.diagonal().array() += 1.0 / treevar;
-    XXiblock.block(start, start, pX, pX)  = (modTerm[s]->nodevals->XtX + LInv).inverse();
-    ZtX.block(0, start, ctr->pZ, pX)      = modTerm[s]->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, pX)    = modTerm[s]->nodevals->VgZtXmat;
+    XXiblock.block(start, start, pX, pX)  = (modTerm[s]->nodevals->XtX() + LInv).inverse();
+    ZtX.block(0, start, ctr->pZ, pX)      = modTerm[s]->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, pX)    = modTerm[s]->nodevals->VgZtXmat();
     
     start += pX;
   } // end loop over modifier nodes
@@ -126,8 +125,6 @@ treeMHR dlmtreeTDLMNested_MHR(std::vector<Node*> modTerm,
   out.termT2        = (out.draw).dot(out.draw);
   out.totTerm       = double(totTerm); 
   out.nModTerm      = double(pXMod);
-
-  return(out);
 }
 
 void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
@@ -147,7 +144,8 @@ void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   double RtR      = (ctr->R).dot(ctr->R);
   double RtZVgZtR = ZtR.dot((ctr->Vg).selfadjointView<Eigen::Lower>() * ZtR);
 
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // -- List terminal nodes --
   modTerm = modTree->listTerminal();
@@ -160,7 +158,7 @@ void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   }
   stepMhr = modProposeTree(modTree, Mod, ctr, step);
   success = modTree->isProposed();
-  mhr0    = dlmtreeTDLMNested_MHR(modTerm, ctr, ZtR, treevar, 0);
+  dlmtreeTDLMNested_MHR(modTerm, ctr, ZtR, treevar, 0, mhr0);
   
   if (success && (stepMhr == stepMhr)) {
     newModTerm = modTree->listTerminal(1);
@@ -182,11 +180,11 @@ void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
       
     } // end draw nested trees if grow or prune
     
-    mhr   = dlmtreeTDLMNested_MHR(newModTerm, ctr, ZtR, treevar, 0);
+    dlmtreeTDLMNested_MHR(newModTerm, ctr, ZtR, treevar, 0, mhr);
     ratio = calcLogRatio(mhr0, mhr, RtR, RtZVgZtR, ctr, stepMhr, treevar);
     
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       modTree->accept();
       modTerm = modTree->listTerminal();
@@ -207,22 +205,19 @@ void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
     success = tn->nodevals->nestedTree->isProposed();
     
     if (success && (stepMhr == stepMhr)) {
-      Eigen::MatrixXd XtX       = tn->nodevals->XtX;
-      Eigen::MatrixXd ZtXmat    = tn->nodevals->ZtXmat;
-      Eigen::MatrixXd VgZtXmat  = tn->nodevals->VgZtXmat;
+      tn->nodevals->stage();
       tn->nodevals->updateXmat  = 1;
 
-      mhr   = dlmtreeTDLMNested_MHR(modTerm, ctr, ZtR, treevar, 1);
+      dlmtreeTDLMNested_MHR(modTerm, ctr, ZtR, treevar, 1, mhr);
       ratio = calcLogRatio(mhr0, mhr, RtR, RtZVgZtR, ctr, stepMhr, treevar);
       
       if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-        mhr0    = mhr;
+        std::swap(mhr0, mhr);
         success = 2;
         tn->nodevals->nestedTree->accept();
+        tn->nodevals->commit();
       } else {
-        tn->nodevals->XtX       = XtX;
-        tn->nodevals->ZtXmat    = ZtXmat;
-        tn->nodevals->VgZtXmat  = VgZtXmat;
+        tn->nodevals->discard();
       } // end MHR accept/reject
     } // end nested tree proposal
     if (success < 2){
@@ -242,13 +237,16 @@ void dlmtreeTDLMNestedGaussian_TreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   ctr->nTerm(t)     = mhr0.totTerm;  
   
   // -- Count modifiers used in tree --
-  Eigen::VectorXd modCount = countMods(modTree, Mod);
+  Eigen::VectorXd oblCount;
+  Eigen::VectorXd modCount = countMods(modTree, Mod, &oblCount);
   ctr->modCount += modCount;
+  if (ctr->record > 0)
+    countModPairs(modTree, ctr);
 
   // -- Record --
   if (ctr->record > 0) {    
     for (int i = 0; i < modCount.size(); ++i) {
-      if (modCount(i) > 0){
+      if (modCount(i) + oblCount(i) > 0){
         ctr->modInf(i) += ctr->tau(t);
       }
     }
@@ -307,6 +305,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
   ctr->burn       = as<int>(model["nBurn"]);
   ctr->thin       = as<int>(model["nThin"]);
   ctr->nRec       = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   ctr->nTrees     = as<int>(model["nTrees"]);
   ctr->Y          = as<Eigen::VectorXd>(model["Y"]);
   ctr->n          = (ctr->Y).size();
@@ -335,6 +334,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
   modDat *Mod = new modDat(as<std::vector<int> >(model["modIsNum"]),
                            as<Rcpp::List>(model["modSplitIdx"]),
                            as<std::vector<int> >(model["fullIdx"]));
+  Mod->setOblique(model);
   NodeStruct *modNS;
   modNS   = new ModStruct(Mod);
   ctr->pM = Mod->nMods;
@@ -389,6 +389,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
   ctr->nTermMod.resize(ctr->nTrees);      ctr->nTermMod.setOnes();
   ctr->Rmat.resize(ctr->n, ctr->nTrees);  ctr->Rmat.setZero();
   ctr->modCount.resize(ctr->pM);          ctr->modCount.setZero();
+  ctr->modPair.resize(ctr->pM, ctr->pM);  ctr->modPair.setZero();
   ctr->modInf.resize(ctr->pM);            ctr->modInf.setZero();
 
 
@@ -401,6 +402,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
   (dgn->fhat).resize(ctr->n);                           (dgn->fhat).setZero();
   (dgn->modProb).resize(ctr->pM, ctr->nRec);            (dgn->modProb).setZero();
   (dgn->modCount).resize(ctr->pM, ctr->nRec);           (dgn->modCount).setZero();
+  (dgn->modPairCount).resize(ctr->pM, ctr->pM);   (dgn->modPairCount).setZero();
   (dgn->modInf).resize(ctr->pM, ctr->nRec);             (dgn->modInf).setZero();
   (dgn->modKappa).resize(ctr->nRec);                    (dgn->modKappa).setZero();
   (dgn->termNodesMod).resize(ctr->nTrees, ctr->nRec);   (dgn->termNodesMod).setZero();
@@ -440,8 +442,14 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
 
   std::size_t s;
   // * Begin MCMC
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     ctr->record = 0;
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)){
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
@@ -453,6 +461,8 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
     ctr->totTerm    = 0.0; 
     ctr->sumTermT2  = 0.0;
     ctr->modCount.setZero();
+    ctr->modPair.setZero();
+    ctr->modTriple.clear();
     ctr->modInf.setZero();
 
     for (t = 0; t < ctr->nTrees; t++) {
@@ -496,6 +506,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
       (dgn->termNodesMod).col(ctr->record - 1)  = ctr->nTermMod;
       (dgn->modProb).col(ctr->record - 1)       = Mod->modProb;
       (dgn->modCount).col(ctr->record - 1)      = ctr->modCount;
+      recordModPairs(ctr, dgn);
       (dgn->modInf).col(ctr->record - 1)        = ctr->modInf / ctr->modInf.maxCoeff();
       (dgn->modKappa)(ctr->record - 1)          = ctr->modKappa;
       dgn->fhat += ctr->fhat;
@@ -505,6 +516,16 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
     prog->printMark();
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
   // * Prepare outout
   Eigen::MatrixXd TreeStructs;
   TreeStructs.resize((dgn->DLMexp).size(), 9);
@@ -518,13 +539,15 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
   Eigen::VectorXd sigma2  = dgn->sigma2;
   Eigen::VectorXd nu      = dgn->nu;
   Eigen::MatrixXd tau     = (dgn->tau).transpose();
-  Eigen::VectorXd fhat    = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat    = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma   = (dgn->gamma).transpose();
 
   Eigen::MatrixXd termNodesMod  = (dgn->termNodesMod).transpose();
   Eigen::VectorXd kappa         = dgn->modKappa;
   Eigen::MatrixXd modProb       = (dgn->modProb).transpose();
   Eigen::MatrixXd modCount      = (dgn->modCount).transpose();
+  Eigen::MatrixXd modPairCount  = dgn->modPairCount;
+  Eigen::MatrixXd modTriples    = modTripleMatrix(dgn, ctr->pM);
   Eigen::MatrixXd modInf        = (dgn->modInf).transpose();
 
   Eigen::MatrixXd modAccept((dgn->treeModAccept).size(), 5);
@@ -540,7 +563,7 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
     delete modTrees[s];
   }
 
-  return(Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs),
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs),
                             Named("termRules")      = wrap(termRule),
                             Named("termNodesDLM")   = wrap(termNodesDLM),
                             Named("fhat")           = wrap(fhat),
@@ -554,6 +577,12 @@ Rcpp::List dlmtreeTDLMNestedGaussian(const Rcpp::List model)
                             Named("modCount")       = wrap(modCount),
                             Named("modInf")         = wrap(modInf),
                             Named("treeModAccept")  = wrap(modAccept),
-                            Named("treeDLMAccept")  = wrap(dlmAccept)));
+                            Named("treeDLMAccept")  = wrap(dlmAccept));
+  out["modPairCount"]   = wrap(modPairCount);
+  out["modTripleCount"] = wrap(modTriples);
+  out["mcmcIter"] = mcmcIter;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeHDLMGaussian
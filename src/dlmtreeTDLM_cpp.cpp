@@ -10,7 +10,7 @@ using Eigen::VectorXd;
 using Eigen::MatrixXd;
 using Eigen::Lower;
 
-double calcLogRatioTDLM(treeMHR mhr0, treeMHR mhr, double RtR, double RtZVgZtR,
+double calcLogRatioTDLM(const treeMHR &mhr0, const treeMHR &mhr, double RtR, double RtZVgZtR,
                         dlmtreeCtr* ctr, double stepMhr, double treevar)
 {
   // Rcout << stepMhr << " " << mhr.logVThetaChol << " " << mhr0.logVThetaChol <<
@@ -29,14 +29,13 @@ double calcLogRatioTDLM(treeMHR mhr0, treeMHR mhr, double RtR, double RtZVgZtR,
   }
 }
 
-treeMHR dlmtreeNestedMHR(std::vector<Node*> modTerm, 
-                         dlmtreeCtr* ctr, 
-                         VectorXd ZtR, 
-                         double treevar, 
-                         bool updateNested)
+void dlmtreeNestedMHR(const std::vector<Node*> &modTerm, 
+                      dlmtreeCtr* ctr, 
+                      const VectorXd &ZtR, 
+                      double treevar, 
+                      bool updateNested, treeMHR &out)
 {
   std::size_t s, s2;
-  treeMHR out;
   int pXMod   = int(modTerm.size());
   int totTerm = 0;
   std::vector<std::vector<Node*> > nestedTerm;
@@ -83,19 +82,15 @@ treeMHR dlmtreeNestedMHR(std::vector<Node*> modTerm,
     
     XtVzInvR.noalias()        -= VgZtX.transpose() * ZtR;
     tempV.diagonal().array()  += 1.0 / treevar;
-    const MatrixXd VTheta     = tempV.inverse();
-    const MatrixXd VThetaChol = VTheta.llt().matrixL();
-    const VectorXd ThetaHat   = VTheta * XtVzInvR;
-    
-    out.draw            = ThetaHat;
-    out.draw.noalias() += VThetaChol * as<VectorXd>(rnorm(totTerm, 0, sqrt(ctr->sigma2)));
+    VectorXd ThetaHat;
+    out.logVThetaChol   = gaussPostDraw(tempV, XtVzInvR, sqrt(ctr->sigma2),
+                                        ThetaHat, out.draw);
     out.beta            = ThetaHat.dot(XtVzInvR);
-    out.logVThetaChol   = VThetaChol.diagonal().array().log().sum();
 
     out.termT2    = (out.draw).dot(out.draw);
     out.totTerm   = double(totTerm);
     out.nModTerm  = 1.0;
-    return(out);
+    return;
     
   } // end if no modification
 
@@ -135,14 +130,14 @@ treeMHR dlmtreeNestedMHR(std::vector<Node*> modTerm,
       
       if (ctr->binomial) {
         MatrixXd Xwtemp = (Xtemp.array().colwise() * Otemp.array()).matrix();
-        modTerm[s]->nodevals->XtX       = Xtemp.transpose() * Xwtemp;
-        modTerm[s]->nodevals->ZtXmat    = Ztemp.transpose() * Xtemp;
-        modTerm[s]->nodevals->VgZtXmat  = ctr->Vg * modTerm[s]->nodevals->ZtXmat;
+        modTerm[s]->nodevals->XtX()       = Xtemp.transpose() * Xwtemp;
+        modTerm[s]->nodevals->ZtXmat()    = Ztemp.transpose() * Xtemp;
+        modTerm[s]->nodevals->VgZtXmat()  = ctr->Vg * modTerm[s]->nodevals->ZtXmat();
         XtR.segment(start, pX)          = Xwtemp.transpose() * Rtemp;
       } else {
-        modTerm[s]->nodevals->XtX       = Xtemp.transpose() * Xtemp;
-        modTerm[s]->nodevals->ZtXmat    = Ztemp.transpose() * Xtemp;
-        modTerm[s]->nodevals->VgZtXmat  = ctr->Vg * modTerm[s]->nodevals->ZtXmat;
+        modTerm[s]->nodevals->XtX()       = Xtemp.transpose() * Xtemp;
+        modTerm[s]->nodevals->ZtXmat()    = Ztemp.transpose() * Xtemp;
+        modTerm[s]->nodevals->VgZtXmat()  = ctr->Vg * modTerm[s]->nodevals->ZtXmat();
         XtR.segment(start, pX)          = Xtemp.transpose() * Rtemp;
         modTerm[s]->nodevals->updateXmat = 0;
       }
@@ -156,13 +151,13 @@ treeMHR dlmtreeNestedMHR(std::vector<Node*> modTerm,
     LInv.resize(pX, pX);      LInv.setZero();
     LInv.diagonal().array() += 1.0 / treevar;
     if ((ctr->pZ < totTerm) || ctr->binomial) {
-      XXiblock.block(start, start, pX, pX) = (modTerm[s]->nodevals->XtX + LInv).inverse();
+      XXiblock.block(start, start, pX, pX) = (modTerm[s]->nodevals->XtX() + LInv).inverse();
     } else {
-      XXiblock.block(start, start, pX, pX) = modTerm[s]->nodevals->XtX + LInv;
+      XXiblock.block(start, start, pX, pX) = modTerm[s]->nodevals->XtX() + LInv;
     }
 
-    ZtX.block(0, start, ctr->pZ, pX)    = modTerm[s]->nodevals->ZtXmat;
-    VgZtX.block(0, start, ctr->pZ, pX)  = modTerm[s]->nodevals->VgZtXmat;
+    ZtX.block(0, start, ctr->pZ, pX)    = modTerm[s]->nodevals->ZtXmat();
+    VgZtX.block(0, start, ctr->pZ, pX)  = modTerm[s]->nodevals->VgZtXmat();
     
     start += pX;
   } // end loop over modifier nodes
@@ -191,7 +186,6 @@ treeMHR dlmtreeNestedMHR(std::vector<Node*> modTerm,
   out.totTerm       = double(totTerm); 
   out.nModTerm      = double(pXMod);
   // Rcout << ".\n";
-  return(out);
 }
 
 
@@ -217,7 +211,8 @@ void dlmtreeTDLMTreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   }
   std::size_t s;
   std::vector<Node*> modTerm, dlmTerm, newDlmTerm, newModTerm;
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // -- List terminal nodes --
   modTerm = modTree->listTerminal();
@@ -230,7 +225,7 @@ void dlmtreeTDLMTreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   }
   stepMhr = modProposeTree(modTree, Mod, ctr, step);
   success = modTree->isProposed();
-  mhr0    = dlmtreeNestedMHR(modTerm, ctr, ZtR, treevar, 0);
+  dlmtreeNestedMHR(modTerm, ctr, ZtR, treevar, 0, mhr0);
 
   if (success) {
     newModTerm = modTree->listTerminal(1);
@@ -250,11 +245,11 @@ void dlmtreeTDLMTreeMCMC(int t, Node* modTree, NodeStruct* expNS,
       } // end loop over nested trees      
     } // end draw nested trees if grow or prune
     // Rcout << "2!";
-    mhr   = dlmtreeNestedMHR(newModTerm, ctr, ZtR, treevar, 1);
+    dlmtreeNestedMHR(newModTerm, ctr, ZtR, treevar, 1, mhr);
     ratio = calcLogRatioTDLM(mhr0, mhr, RtR, RtZVgZtR, ctr, stepMhr, treevar);
     
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       modTree->accept();
       modTerm = modTree->listTerminal();
@@ -275,23 +270,20 @@ void dlmtreeTDLMTreeMCMC(int t, Node* modTree, NodeStruct* expNS,
     success = tn->nodevals->nestedTree->isProposed();
     
     if (success) {
-      MatrixXd XtX              = tn->nodevals->XtX;
-      MatrixXd ZtXmat           = tn->nodevals->ZtXmat;
-      MatrixXd VgZtXmat         = tn->nodevals->VgZtXmat;
+      tn->nodevals->stage();
       tn->nodevals->updateXmat  = 1;
 
-      mhr   = dlmtreeNestedMHR(modTerm, ctr, ZtR, treevar, 1);
+      dlmtreeNestedMHR(modTerm, ctr, ZtR, treevar, 1, mhr);
       ratio = calcLogRatioTDLM(mhr0, mhr, RtR, RtZVgZtR, ctr, stepMhr, treevar);
       
       if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-        mhr0    = mhr;
+        std::swap(mhr0, mhr);
         success = 2;
         tn->nodevals->nestedTree->accept();
+        tn->nodevals->commit();
         
       } else {
-        tn->nodevals->XtX       = XtX;
-        tn->nodevals->ZtXmat    = ZtXmat;
-        tn->nodevals->VgZtXmat  = VgZtXmat;
+        tn->nodevals->discard();
       } // end MHR accept/reject
     } // end nested tree proposal
     
@@ -311,13 +303,16 @@ void dlmtreeTDLMTreeMCMC(int t, Node* modTree, NodeStruct* expNS,
   ctr->nTerm(t)     = mhr0.totTerm;  
   
   // -- Count modifiers used in tree --
-  VectorXd modCount = countMods(modTree, Mod);
+  VectorXd oblCount;
+  VectorXd modCount = countMods(modTree, Mod, &oblCount);
   ctr->modCount     += modCount;
+  if (ctr->record > 0)
+    countModPairs(modTree, ctr);
 
   // -- Record --
   if (ctr->record > 0) {    
     for (int i = 0; i < modCount.size(); ++i) {
-      if (modCount(i) > 0){
+      if (modCount(i) + oblCount(i) > 0){
         ctr->modInf(i) += ctr->tau(t);
       }
     }
@@ -375,6 +370,7 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   ctr->burn         = as<int>(model["nBurn"]);
   ctr->thin         = as<int>(model["nThin"]);
   ctr->nRec         = floor(ctr->iter / ctr->thin);
+  ctr->timeBudget   = as<double>(model["timeBudget"]);
   ctr->nTrees       = as<int>(model["nTrees"]);
   ctr->verbose      = as<bool>(model["verbose"]);
   ctr->diagnostics  = as<bool>(model["diagnostics"]);
@@ -413,6 +409,7 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   modDat *Mod = new modDat(as<std::vector<int> >(model["modIsNum"]),
                            as<Rcpp::List>(model["modSplitIdx"]),
                            as<std::vector<int> >(model["fullIdx"]));
+  Mod->setOblique(model);
   NodeStruct *modNS;
   modNS   = new ModStruct(Mod);
   ctr->pM = Mod->nMods;
@@ -476,11 +473,13 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   ctr->nTermMod.resize(ctr->nTrees);      ctr->nTermMod.setOnes();
   ctr->Rmat.resize(ctr->n, ctr->nTrees);  ctr->Rmat.setZero();
   ctr->modCount.resize(ctr->pM);          ctr->modCount.setZero();
+  ctr->modPair.resize(ctr->pM, ctr->pM);  ctr->modPair.setZero();
   ctr->modInf.resize(ctr->pM);            ctr->modInf.setZero();
 
 
   // * Setup model logs
   dlmtreeLog *dgn = new dlmtreeLog;
+  topoInit(&(dgn->topo), ctr->nTrees, as<int>(model["topologyK"]));
   (dgn->gamma).resize(ctr->pZ, ctr->nRec);                (dgn->gamma).setZero();
   (dgn->sigma2).resize(ctr->nRec);                        (dgn->sigma2).setZero();
   (dgn->nu).resize(ctr->nRec);                            (dgn->nu).setZero();
@@ -488,6 +487,7 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   (dgn->fhat).resize(ctr->n);                             (dgn->fhat).setZero();
   (dgn->modProb).resize(ctr->pM, ctr->nRec);              (dgn->modProb).setZero();
   (dgn->modCount).resize(ctr->pM, ctr->nRec);             (dgn->modCount).setZero();
+  (dgn->modPairCount).resize(ctr->pM, ctr->pM);   (dgn->modPairCount).setZero();
   (dgn->modInf).resize(ctr->pM, ctr->nRec);               (dgn->modInf).setZero();
   (dgn->modKappa).resize(ctr->nRec);                      (dgn->modKappa).setZero();
   (dgn->termNodesMod).resize(ctr->nTrees, ctr->nRec);     (dgn->termNodesMod).setZero();
@@ -530,8 +530,14 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   std::size_t s;
   
   // * Begin MCMC
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
     ctr->record = 0;
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)){
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
@@ -543,6 +549,8 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
     ctr->totTerm    = 0.0; 
     ctr->sumTermT2  = 0.0;
     ctr->modCount.setZero();
+    ctr->modPair.setZero();
+    ctr->modTriple.clear();
     ctr->modInf.setZero();
     
     for (t = 0; t < ctr->nTrees; t++) {
@@ -584,6 +592,9 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
       (dgn->termNodesMod).col(ctr->record - 1)  = ctr->nTermMod;
       (dgn->modProb).col(ctr->record - 1)       = Mod->modProb;
       (dgn->modCount).col(ctr->record - 1)      = ctr->modCount;
+      recordModPairs(ctr, dgn);
+      for (t = 0; t < ctr->nTrees; t++)
+        topoRecord(&(dgn->topo), t, modTrees[t], Mod);
       (dgn->modInf).col(ctr->record - 1)        = ctr->modInf / ctr->modInf.maxCoeff();
       (dgn->modKappa)(ctr->record - 1)          = ctr->modKappa;
       dgn->fhat += ctr->fhat;
@@ -593,6 +604,16 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
     prog->printMark();
   } // end MCMC
 
+  // -- Shortened by the time budget: keep completed records only --
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    dlmtreeLogTruncate(dgn, ctr->nRec);
+  }
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+
 
   // * Prepare outout
   MatrixXd TreeStructs;
@@ -608,18 +629,24 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   VectorXd sigma2 = dgn->sigma2;
   VectorXd nu     = dgn->nu;
   MatrixXd tau    = (dgn->tau).transpose();
-  VectorXd fhat   = (dgn->fhat).array() / ctr->nRec;
+  VectorXd fhat   = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   MatrixXd gamma  = (dgn->gamma).transpose();
 
   MatrixXd termNodesMod = (dgn->termNodesMod).transpose();
   VectorXd kappa        = dgn->modKappa;
   MatrixXd modProb      = (dgn->modProb).transpose();
   MatrixXd modCount     = (dgn->modCount).transpose();
+  MatrixXd modPairCount  = dgn->modPairCount;
+  MatrixXd modTriples    = modTripleMatrix(dgn, ctr->pM);
   MatrixXd modInf       = (dgn->modInf).transpose();
 
   MatrixXd modAccept((dgn->treeModAccept).size(), 5);
   MatrixXd dlmAccept((dgn->treeDLMAccept).size(), 5);
 
+  Rcpp::List topology;
+  if (dgn->topo.topK > 0)
+    topology = topoSummary(&(dgn->topo));
+
   delete prog;
   delete ctr;
   delete dgn;
@@ -631,7 +658,7 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
   }
 
 
-  return(Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs),
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs")    = wrap(TreeStructs),
                             Named("termRules")      = wrap(termRule),
                             Named("termNodesDLM")   = wrap(termNodesDLM),
                             Named("fhat")           = wrap(fhat),
@@ -645,6 +672,14 @@ Rcpp::List dlmtreeTDLM_cpp(const Rcpp::List model)
                             Named("modCount")       = wrap(modCount),
                             Named("modInf")         = wrap(modInf),
                             Named("treeModAccept")  = wrap(modAccept),
-                            Named("treeDLMAccept")  = wrap(dlmAccept)));
+                            Named("treeDLMAccept")  = wrap(dlmAccept));
+  out["modPairCount"]   = wrap(modPairCount);
+  out["modTripleCount"] = wrap(modTriples);
+  out["mcmcIter"] = mcmcIter;
+  if (topology.size() > 0)
+    out["topology"] = topology;
+  if (budget.size() > 0)
+    out["budget"] = budget;
+  return(out);
 
 } // end dlmtreeTDLMGaussian
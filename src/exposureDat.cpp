@@ -162,8 +162,112 @@ exposureDat::exposureDat(MatrixXd X_in,  // Gaussian DLNM
   }
 }
 
+/**
+ * @brief prefix sums over the days of stacked location series
+ *
+ * @param series stacked location series
+ * @param Xsplits exposure splitting values (none for a DLM)
+ * @param se exposure smoothing sd, 0 for stepwise counts
+ * @return (days + 1) x max(1, splits) matrix; row k sums days 0, ..., k - 1
+ * of the series (DLM) or of the counts below each split (DLNM)
+ */
+static MatrixXd windowPrefix(const VectorXd &series, const VectorXd &Xsplits,
+                             double se)
+{
+  const int N = series.size();
+  const int nS = Xsplits.size();
+  MatrixXd P(N + 1, std::max(nS, 1)); P.row(0).setZero();
+  for (int k = 0; k < N; ++k) {
+    if (nS == 0) {
+      P(k + 1, 0) = P(k, 0) + series(k);
+      continue;
+    }
+    for (int s = 0; s < nS; ++s) {
+      double below;
+      if (se > 0)
+        below = R::pnorm((Xsplits(s) - series(k)) / se, 0.0, 1.0, 1, 0);
+      else
+        below = (series(k) < Xsplits(s)) ? 1.0 : 0.0;
+      P(k + 1, s) = P(k, s) + below;
+    }
+  }
+  return(P);
+}
+
+exposureDat::exposureDat(VectorXd series_in, // Binomial window
+                         VectorXi winPos_in,
+                         int pX_in,
+                         VectorXd Xsplits_in,
+                         double se_in)
+{
+  n       = winPos_in.size();
+  pX      = pX_in;
+  pZ      = 0;
+  Xsplits = Xsplits_in;
+  nSplits = Xsplits.size();
+  se      = (se_in > 0);
+  lowmem  = 1;
+  preset  = 0;
+
+  window    = 1;
+  winPos    = winPos_in;
+  winPrefix = windowPrefix(series_in, Xsplits, se_in);
+}
+
+exposureDat::exposureDat(VectorXd series_in, // Gaussian window
+                         VectorXi winPos_in,
+                         int pX_in,
+                         VectorXd Xsplits_in,
+                         double se_in,
+                         MatrixXd Z_in,
+                         MatrixXd Vg_in)
+{
+  n       = winPos_in.size();
+  pX      = pX_in;
+  Z       = Z_in;
+  Vg      = Vg_in;
+  pZ      = Z.cols();
+  Xsplits = Xsplits_in;
+  nSplits = Xsplits.size();
+  se      = (se_in > 0);
+  lowmem  = 1;
+  preset  = 1;
+
+  window    = 1;
+  winPos    = winPos_in;
+  winPrefix = windowPrefix(series_in, Xsplits, se_in);
+}
+
 exposureDat::~exposureDat(){}
 
+/**
+ * @brief exposure values of a node read through the sliding windows, i.e.
+ * the sum of exposures (DLM) or count of exposures in [xmin, xmax) (DLNM)
+ * over lags tmin, ..., tmax of each observation
+ *
+ * @param xmin lower split index (0: no lower limit)
+ * @param xmax upper split index (nSplits + 1: no upper limit)
+ * @param tmin first lag
+ * @param tmax last lag
+ * @return node exposure values
+ */
+VectorXd exposureDat::windowVals(int xmin, int xmax, int tmin, int tmax){
+  VectorXd Xvec(n);
+  for (int i = 0; i < n; ++i) {
+    const int lo = winPos(i) + tmin - 1;
+    const int hi = winPos(i) + tmax;
+    if (nSplits == 0) {
+      Xvec(i) = winPrefix(hi, 0) - winPrefix(lo, 0);
+      continue;
+    }
+    Xvec(i) = (xmax == nSplits + 1) ? double(tmax - tmin + 1) :
+      winPrefix(hi, xmax - 1) - winPrefix(lo, xmax - 1);
+    if (xmin > 0)
+      Xvec(i) -= winPrefix(hi, xmin - 1) - winPrefix(lo, xmin - 1);
+  }
+  return(Xvec);
+}
+
 
 void exposureDat::updateNodeVals(Node *n){
   // stop if no update needed
@@ -199,7 +303,15 @@ void exposureDat::updateNodeVals(Node *n){
     }
   }
 
-  if (nSplits == 0) { // time splits only
+  if (window) { // sliding windows over location series
+    n->nodevals->X = windowVals(n->nodestruct->get(1), n->nodestruct->get(2),
+                                n->nodestruct->get(3), n->nodestruct->get(4));
+    if (preset) {
+      n->nodevals->ZtX    = Z.transpose() * n->nodevals->X;
+      n->nodevals->VgZtX  = Vg * n->nodevals->ZtX;
+    }
+
+  } else if (nSplits == 0) { // time splits only
     int tmin = n->nodestruct->get(3);
     int tmax = n->nodestruct->get(4);
     
@@ -316,3 +428,59 @@ void exposureDat::updateNodeVals(Node *n){
   n->update = 0;
   return;
 }
+
+/**
+ * @brief column means of the exposure counts used by nodeMean
+ *
+ * With lowmem the counts below each split are built one lag at a time and
+ * only their means are kept.
+ */
+void exposureDat::setColMeans(){
+  TcalcMean = Tcalc.colwise().mean().transpose();
+  XsaveMean.clear();
+  for (int i = 0; i < nSplits; ++i) {
+    if (!lowmem) {
+      XsaveMean.push_back(Xsave[i].colwise().mean().transpose());
+    } else {
+      VectorXd cnt(n); cnt.setZero();
+      VectorXd m(pX);
+      for (int t = 0; t < pX; ++t) {
+        cnt += nodeCount(this, R_NegInf, Xsplits(i), t + 1, t + 1);
+        m(t) = cnt.mean();
+      }
+      XsaveMean.push_back(m);
+    }
+  }
+  XsaveMean.push_back(TcalcMean);
+}
+
+/**
+ * @brief mean over observations of a node's exposure values, i.e. the mean of
+ * the X column updateNodeVals would assign, by the same bin arithmetic on
+ * column means. Requires setColMeans.
+ *
+ * @param ns node structure (xmin, xmax, tmin, tmax)
+ * @return mean exposure value of the node
+ */
+double exposureDat::nodeMean(NodeStruct *ns){
+  int xmin = ns->get(1);
+  int xmax = ns->get(2);
+  int tmin = ns->get(3);
+  int tmax = ns->get(4);
+
+  if (nSplits == 0) // time splits only
+    return(TcalcMean(tmax - 1) - ((tmin > 1) ? TcalcMean(tmin - 2) : 0.0));
+
+  if ((xmin == 0) && (xmax == nSplits + 1)) // only splits in time
+    return(TcalcMean(tmax - tmin));
+
+  double m = XsaveMean[xmax - 1](tmax - 1);
+  if (xmin > 0)
+    m -= XsaveMean[xmin - 1](tmax - 1);
+  if (tmin > 1) {
+    m -= XsaveMean[xmax - 1](tmin - 2);
+    if (xmin > 0)
+      m += XsaveMean[xmin - 1](tmin - 2);
+  }
+  return(m);
+}
@@ -1,7 +1,9 @@
 #include <RcppEigen.h>
 using Eigen::VectorXd;
 using Eigen::MatrixXd;
+using Eigen::VectorXi;
 class Node;
+class NodeStruct;
 
 class exposureDat {
 public:
@@ -16,6 +18,11 @@ public:
   exposureDat(MatrixXd X_in, MatrixXd SE_in, VectorXd Xsplits_in,
               MatrixXd Xcalc_in, MatrixXd Tcalc_in, MatrixXd Z_in,
               MatrixXd Vg_in, bool lowmem_in = 0); // Gaussian DLNM
+  exposureDat(VectorXd series_in, VectorXi winPos_in, int pX_in,
+              VectorXd Xsplits_in, double se_in); // Binomial window
+  exposureDat(VectorXd series_in, VectorXi winPos_in, int pX_in,
+              VectorXd Xsplits_in, double se_in, MatrixXd Z_in,
+              MatrixXd Vg_in); // Gaussian window
   ~exposureDat();
 
   MatrixXd X;
@@ -36,5 +43,22 @@ public:
   std::vector<MatrixXd> ZtXsave;
   std::vector<MatrixXd> VgZtXsave;
 
+  // Column means of Tcalc and of the counts below each split (last: Tcalc)
+  VectorXd TcalcMean;
+  std::vector<VectorXd> XsaveMean;
+
+  // Sliding windows over stacked location series: lag t of observation i
+  // is day winPos(i) + t - 1. Prefix sums of the series (DLM) or of the
+  // counts below each split (DLNM) give any node in O(n).
+  bool window = false;
+  VectorXi winPos;
+  MatrixXd winPrefix;
+  VectorXd windowVals(int xmin, int xmax, int tmin, int tmax);
+
   void updateNodeVals(Node*);
+  void setColMeans();
+  double nodeMean(NodeStruct*);
 };
+
+VectorXd nodeCount(exposureDat* Exp, double xmin, double xmax,
+                   int tmin, int tmax);
@@ -0,0 +1,435 @@
+/**
+ * @file exposureImpute.cpp
+ * @brief Data-augmentation imputation of missing exposures for TDLM and TDLNM
+ * @version 1.0
+ *
+ * Missing exposure cells are latent. After the trees and fixed effects are
+ * updated, each cell is drawn from its full conditional: a lag-AR(1) prior
+ * given the neighbouring lags of the same row, times the working Gaussian
+ * likelihood of the row (Ystar, with precision 1 / sigma2 or the Polya-Gamma
+ * weight). The exposure enters the likelihood through the current lag
+ * effects: beta_t * x for the DLM and the effect of the exposure bin of x for
+ * the DLNM, so the DLNM conditional is a mixture of truncated normals over
+ * the bins. Only the rows with missing cells are touched: the cached counts
+ * of exposureDat (Tcalc, Xcalc, Xsave and their Z^t / Vg Z^t products), the
+ * node values of every tree, the partial fits and the cached tempV of each
+ * tree are patched in place.
+ */
+#include <RcppEigen.h>
+#include "modelCtr.h"
+#include "exposureDat.h"
+#include "Node.h"
+#include "NodeStruct.h"
+using namespace Rcpp;
+
+/**
+ * @brief exposure bin of x: the number of splits at or below x
+ */
+static int imputeBin(exposureDat *Exp, double x)
+{
+  int b = 0;
+  while ((b < Exp->nSplits) && (x >= Exp->Xsplits(b)))
+    ++b;
+  return(b);
+}
+
+/**
+ * @brief change in a node's exposure value when cell lag j of a row moves
+ * from xOld to xNew
+ */
+static double imputeNodeDelta(exposureDat *Exp, NodeStruct *ns, int j,
+                              double xOld, double xNew)
+{
+  if ((j + 1 < ns->get(3)) || (j + 1 > ns->get(4)))
+    return(0.0);
+  if (Exp->nSplits == 0)
+    return(xNew - xOld);
+  int xmin = ns->get(1), xmax = ns->get(2);
+  int bOld = imputeBin(Exp, xOld), bNew = imputeBin(Exp, xNew);
+  return(double((bNew >= xmin) && (bNew < xmax)) -
+         double((bOld >= xmin) && (bOld < xmax)));
+}
+
+/**
+ * @brief move cell (i, j) of the cached exposure counts from xOld to xNew
+ *
+ * @param Exp exposure data
+ * @param ctr model control data (single-node tree design X1)
+ * @param i observation
+ * @param j lag (0-based)
+ * @param xOld current value
+ * @param xNew new value
+ */
+static void imputeSetCell(exposureDat *Exp, modelCtr *ctr, int i, int j,
+                          double xOld, double xNew)
+{
+  const int pX = Exp->pX;
+  VectorXd z, vgz;
+  if (Exp->preset) {
+    z   = Exp->Z.row(i).transpose();
+    vgz = Exp->Vg.selfadjointView<Lower>() * z;
+  }
+
+  Exp->X(i, j) = xNew;
+  if (Exp->nSplits == 0) { // cumulative exposures
+    double d = xNew - xOld;
+    Exp->Tcalc.row(i).tail(pX - j).array() += d;
+    if (Exp->preset) {
+      Exp->ZtTcalc.rightCols(pX - j).colwise()   += z * d;
+      Exp->VgZtTcalc.rightCols(pX - j).colwise() += vgz * d;
+    }
+    if (Exp->TcalcMean.size() > 0)
+      Exp->TcalcMean.tail(pX - j).array() += d / Exp->n;
+    ctr->X1(i)     += d;
+    ctr->ZtX1      += ctr->Z.row(i).transpose() * d;
+    ctr->VgZtX1    += (ctr->Vg).selfadjointView<Lower>() * (ctr->Z.row(i).transpose() * d);
+    return;
+  }
+
+  // counts below each split
+  for (int k = 0; k < Exp->nSplits; ++k) {
+    double d = double(xNew < Exp->Xsplits(k)) - double(xOld < Exp->Xsplits(k));
+    if (d == 0.0)
+      continue;
+    Exp->Xcalc(i, k) += d;
+    if (Exp->preset) {
+      Exp->ZtXcalc.col(k)   += z * d;
+      Exp->VgZtXcalc.col(k) += vgz * d;
+    }
+    if (!(Exp->lowmem)) {
+      Exp->Xsave[k].row(i).tail(pX - j).array() += d;
+      if (Exp->preset) {
+        Exp->ZtXsave[k].rightCols(pX - j).colwise()   += z * d;
+        Exp->VgZtXsave[k].rightCols(pX - j).colwise() += vgz * d;
+      }
+    }
+    if (Exp->XsaveMean.size() > 0)
+      Exp->XsaveMean[k].tail(pX - j).array() += d / Exp->n;
+  }
+}
+
+/**
+ * @brief set up imputation of the missing exposure cells
+ *
+ * @param imp imputation log
+ * @param Exp exposure data
+ * @param ctr model control data
+ * @param model model settings: X (scaled, missing cells filled) and Xmissing
+ * (0-based row and lag of each missing cell)
+ */
+void imputeInit(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                const Rcpp::List &model)
+{
+  const IntegerMatrix miss = as<IntegerMatrix>(model["Xmissing"]);
+  imp->active = (miss.nrow() > 0);
+  if (!imp->active)
+    return;
+  if (ctr->zinb)
+    stop("missing exposures cannot be imputed for the zinb family");
+  if ((Exp->nSplits > 0) && Exp->se)
+    stop("missing exposures cannot be imputed with exposure smoothing (tdlnm.exposure.se)");
+
+  const MatrixXd X = as<MatrixXd>(model["X"]);
+  const int pX = X.cols();
+  MatrixXi obs = MatrixXi::Ones(X.rows(), pX);
+  std::map<int, std::vector<int> > cells;
+  for (int k = 0; k < miss.nrow(); ++k) {
+    int i = (int) miss(k, 0), j = (int) miss(k, 1);
+    obs(i, j) = 0;
+    cells[i].push_back(j);
+  }
+
+  // lag-AR(1) prior from the observed cells
+  double sum = 0.0, sum2 = 0.0, cross = 0.0, nObs = 0.0, nPair = 0.0;
+  for (int i = 0; i < X.rows(); ++i) {
+    for (int j = 0; j < pX; ++j) {
+      if (!obs(i, j))
+        continue;
+      sum  += X(i, j);
+      sum2 += X(i, j) * X(i, j);
+      nObs += 1.0;
+    }
+  }
+  imp->mean = sum / nObs;
+  double var = std::max(sum2 / nObs - imp->mean * imp->mean, 1e-12);
+  for (int i = 0; i < X.rows(); ++i) {
+    for (int j = 0; j + 1 < pX; ++j) {
+      if (obs(i, j) && obs(i, j + 1)) {
+        cross += (X(i, j) - imp->mean) * (X(i, j + 1) - imp->mean);
+        nPair += 1.0;
+      }
+    }
+  }
+  imp->sd  = sqrt(var);
+  imp->rho = (nPair > 0) ? std::min(0.99, std::max(-0.99, cross / (nPair * var))) : 0.0;
+
+  // the DLM holds cumulative exposures only: keep the exposures as well, so
+  // both branches of imputeSetCell update Exp->X
+  if (Exp->X.rows() == 0)
+    Exp->X = X;
+
+  int nCell = 0;
+  imp->X.resize(cells.size(), pX);
+  for (const auto &c : cells) {
+    imp->X.row(imp->rows.size()) = X.row(c.first);
+    imp->rows.push_back(c.first);
+    imp->lags.push_back(c.second);
+    nCell += c.second.size();
+  }
+  imp->theta.assign(ctr->nTrees, VectorXd());
+  imp->nRec = 0;
+  imp->cellSum    = VectorXd::Zero(nCell);
+  imp->cellSum2   = VectorXd::Zero(nCell);
+  imp->effSum     = VectorXd::Zero(imp->rows.size());
+  imp->effSum2    = VectorXd::Zero(imp->rows.size());
+  imp->effCondVar = VectorXd::Zero(imp->rows.size());
+}
+
+/**
+ * @brief draw the missing exposures from their full conditionals and patch
+ * the exposure counts, node values, partial fits and residuals of their rows
+ *
+ * @param imp imputation log, with the terminal node effects of each tree
+ * @param Exp exposure data
+ * @param ctr model control data
+ * @param trees current trees
+ */
+void imputeUpdate(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                  std::vector<Node*> &trees)
+{
+  if (!imp->active)
+    return;
+  const int pX = Exp->pX, nBin = Exp->nSplits + 1;
+  const double s2 = imp->sd * imp->sd, rho = imp->rho;
+
+  // lag effect of each exposure bin (one bin for the DLM)
+  std::vector<std::vector<Node*> > term(trees.size());
+  MatrixXd G = MatrixXd::Zero(nBin, pX);
+  for (std::size_t t = 0; t < trees.size(); ++t) {
+    term[t] = trees[t]->listTerminal();
+    for (std::size_t s = 0; s < term[t].size(); ++s) {
+      NodeStruct *ns = term[t][s]->nodestruct;
+      int x0 = 0, x1 = 1;
+      if (Exp->nSplits > 0) {
+        x0 = ns->get(1);
+        x1 = ns->get(2);
+      }
+      G.block(x0, ns->get(3) - 1, x1 - x0, ns->get(4) - ns->get(3) + 1).array() +=
+        imp->theta[t](s);
+    }
+  }
+
+  VectorXd eta = ctr->Z * ctr->gamma;
+  std::vector<double> logW(nBin);
+  int cell = 0;
+  for (std::size_t r = 0; r < imp->rows.size(); ++r) {
+    const int i = imp->rows[r];
+    const double w = ((ctr->binomial || ctr->scaleMix) ? ctr->Omega(i) : 1.0) / ctr->sigma2;
+    double res = ctr->Ystar(i) - ctr->fhat(i) - eta(i);
+    double eff = 0.0, condVar = 0.0;
+    std::vector<int> lag;
+    std::vector<double> xOld, xNew;
+
+    for (int j : imp->lags[r]) {
+      // lag-AR(1) prior given the neighbouring lags
+      double pm = imp->mean, pv = s2;
+      if ((j > 0) && (j + 1 < pX)) {
+        pm += rho / (1.0 + rho * rho) *
+          (imp->X(r, j - 1) + imp->X(r, j + 1) - 2.0 * imp->mean);
+        pv *= (1.0 - rho * rho) / (1.0 + rho * rho);
+      } else if (pX > 1) {
+        pm += rho * (imp->X(r, (j > 0) ? j - 1 : j + 1) - imp->mean);
+        pv *= 1.0 - rho * rho;
+      }
+      const double x = imp->X(r, j), psd = sqrt(pv);
+      double x2, g;
+
+      if (Exp->nSplits == 0) { // Gaussian conditional
+        const double beta = G(0, j);
+        const double r0 = res + beta * x;
+        const double prec = 1.0 / pv + w * beta * beta;
+        x2 = (pm / pv + w * beta * r0) / prec + R::rnorm(0, 1) / sqrt(prec);
+        g = beta * x2;
+        res = r0 - g;
+        condVar += beta * beta / prec;
+
+      } else { // mixture over exposure bins of truncated normals
+        const double r0 = res + G(imputeBin(Exp, x), j);
+        double maxW = R_NegInf;
+        for (int b = 0; b < nBin; ++b) {
+          double lo = (b > 0) ? R::pnorm(Exp->Xsplits(b - 1), pm, psd, 1, 0) : 0.0;
+          double hi = (b < nBin - 1) ? R::pnorm(Exp->Xsplits(b), pm, psd, 1, 0) : 1.0;
+          double d = r0 - G(b, j);
+          logW[b] = log(std::max(hi - lo, 1e-300)) - 0.5 * w * d * d;
+          maxW = std::max(maxW, logW[b]);
+        }
+        double tot = 0.0, m1 = 0.0, m2 = 0.0;
+        for (int b = 0; b < nBin; ++b) {
+          logW[b] = exp(logW[b] - maxW);
+          tot += logW[b];
+        }
+        for (int b = 0; b < nBin; ++b) {
+          m1 += logW[b] * G(b, j) / tot;
+          m2 += logW[b] * G(b, j) * G(b, j) / tot;
+        }
+        double u = R::runif(0, tot);
+        int bin = 0;
+        while ((bin < nBin - 1) && ((u -= logW[bin]) > 0.0))
+          ++bin;
+        double lo = (bin > 0) ? R::pnorm(Exp->Xsplits(bin - 1), pm, psd, 1, 0) : 0.0;
+        double hi = (bin < nBin - 1) ? R::pnorm(Exp->Xsplits(bin), pm, psd, 1, 0) : 1.0;
+        x2 = R::qnorm(lo + R::runif(0, 1) * (hi - lo), pm, psd, 1, 0);
+        if (bin > 0)
+          x2 = std::max(x2, Exp->Xsplits(bin - 1));
+        if (bin < nBin - 1)
+          x2 = std::min(x2, std::nextafter(Exp->Xsplits(bin), R_NegInf));
+        g = G(bin, j);
+        res = r0 - g;
+        condVar += m2 - m1 * m1;
+      }
+
+      imp->X(r, j) = x2;
+      eff += g;
+      lag.push_back(j);
+      xOld.push_back(x);
+      xNew.push_back(x2);
+      imputeSetCell(Exp, ctr, i, j, x, x2);
+      if (ctr->record > 0) {
+        imp->cellSum(cell)  += x2;
+        imp->cellSum2(cell) += x2 * x2;
+      }
+      ++cell;
+    }
+
+    // patch node values, tempV and partial fits of each tree for row i
+    VectorXd z, vgz;
+    double zVgz = 0.0;
+    if (Exp->preset) {
+      z    = Exp->Z.row(i).transpose();
+      vgz  = Exp->Vg.selfadjointView<Lower>() * z;
+      zVgz = z.dot(vgz);
+    }
+    double dFit = 0.0;
+    for (std::size_t t = 0; t < trees.size(); ++t) {
+      const int k = term[t].size();
+      VectorXd a(k), d(k), u(k);
+      for (int s = 0; s < k; ++s) {
+        NodeStruct *ns = term[t][s]->nodestruct;
+        d(s) = 0.0;
+        for (std::size_t c = 0; c < lag.size(); ++c)
+          d(s) += imputeNodeDelta(Exp, ns, lag[c], xOld[c], xNew[c]);
+        a(s) = term[t][s]->nodevals->X(i);
+        u(s) = Exp->preset ? term[t][s]->nodevals->VgZtX.dot(z) : 0.0;
+      }
+
+      for (Node *nd : CombineNodeLists(term[t], trees[t]->listInternal())) {
+        if ((nd->nodevals == 0) || nd->update)
+          continue;
+        double dn = 0.0;
+        for (std::size_t c = 0; c < lag.size(); ++c)
+          dn += imputeNodeDelta(Exp, nd->nodestruct, lag[c], xOld[c], xNew[c]);
+        if (dn == 0.0)
+          continue;
+        nd->nodevals->X(i) += dn;
+        if (Exp->preset) {
+          nd->nodevals->ZtX   += z * dn;
+          nd->nodevals->VgZtX += vgz * dn;
+        }
+      }
+
+      // tempV = X^t X - ZtX^t Vg ZtX after ZtX += z d^t
+      MatrixXd &tempV = trees[t]->nodevals->tempV;
+      if (Exp->preset && (k > 1) && (tempV.rows() == k) && (d.squaredNorm() > 0)) {
+        VectorXd b = a + d;
+        tempV.noalias() += b * b.transpose() - a * a.transpose();
+        tempV.noalias() -= u * d.transpose() + d * u.transpose() +
+                           zVgz * d * d.transpose();
+      }
+
+      double df = d.dot(imp->theta[t]);
+      if (ctr->floatRmat)
+        ctr->RmatF(i, t) += (float) df;
+      else
+        ctr->Rmat(i, t) += df;
+      dFit += df;
+    }
+    ctr->fhat(i) += dFit;
+    ctr->R(i)    -= dFit;
+
+    if (ctr->record > 0) {
+      imp->effSum(r)     += eff;
+      imp->effSum2(r)    += eff * eff;
+      imp->effCondVar(r) += condVar;
+    }
+  }
+
+  if (Exp->nSplits == 0)
+    ctr->VTheta1Inv = (ctr->X1).dot(ctr->X1) - (ctr->ZtX1).dot(ctr->VgZtX1);
+  if (ctr->record > 0)
+    ++(imp->nRec);
+}
+
+/**
+ * @brief bring the cached exposure counts from the values Xfrom back in line
+ * with the current imputed values, e.g. after a rollback restored the log
+ *
+ * @param imp imputation log
+ * @param Exp exposure data
+ * @param ctr model control data
+ * @param Xfrom exposures of the imputed rows the caches currently hold
+ */
+void imputeSync(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                const MatrixXd &Xfrom)
+{
+  if (!imp->active)
+    return;
+  for (std::size_t r = 0; r < imp->rows.size(); ++r)
+    for (int j : imp->lags[r])
+      if (Xfrom(r, j) != imp->X(r, j))
+        imputeSetCell(Exp, ctr, imp->rows[r], j, Xfrom(r, j), imp->X(r, j));
+  if (Exp->nSplits == 0)
+    ctr->VTheta1Inv = (ctr->X1).dot(ctr->X1) - (ctr->ZtX1).dot(ctr->VgZtX1);
+}
+
+/**
+ * @brief summarize the imputation for R
+ *
+ * @param imp imputation log
+ * @return list of the prior (mean, sd, rho), the posterior mean and sd of each
+ * imputed cell (row, lag, 1-based) and, for each row, the posterior mean and
+ * sd of the effect of its imputed cells with the share of that variance due to
+ * the imputation (mean conditional variance given the other parameters over
+ * the total variance)
+ */
+Rcpp::List imputeSummary(imputeLog *imp)
+{
+  const double nRec = std::max(imp->nRec, 1);
+  std::vector<int> cellRow, cellLag;
+  for (std::size_t r = 0; r < imp->rows.size(); ++r) {
+    for (int j : imp->lags[r]) {
+      cellRow.push_back(imp->rows[r] + 1);
+      cellLag.push_back(j + 1);
+    }
+  }
+  VectorXd cellMean = imp->cellSum / nRec;
+  VectorXd cellSD = (imp->cellSum2 / nRec - cellMean.cwiseAbs2()).cwiseMax(0.0).cwiseSqrt();
+  VectorXd effMean = imp->effSum / nRec;
+  VectorXd effVar = (imp->effSum2 / nRec - effMean.cwiseAbs2()).cwiseMax(0.0);
+  VectorXd effShare(effVar.size());
+  for (int r = 0; r < effVar.size(); ++r)
+    effShare(r) = (effVar(r) > 0) ?
+      std::min(1.0, imp->effCondVar(r) / nRec / effVar(r)) : NA_REAL;
+  std::vector<int> rows;
+  for (int i : imp->rows)
+    rows.push_back(i + 1);
+
+  return(Rcpp::List::create(Named("prior")     = NumericVector::create(imp->mean, imp->sd, imp->rho),
+                            Named("cellRow")   = wrap(cellRow),
+                            Named("cellLag")   = wrap(cellLag),
+                            Named("cellMean")  = wrap(cellMean),
+                            Named("cellSD")    = wrap(cellSD),
+                            Named("row")       = wrap(rows),
+                            Named("effMean")   = wrap(effMean),
+                            Named("effSD")     = wrap(effVar.cwiseSqrt()),
+                            Named("effShare")  = wrap(effShare)));
+}
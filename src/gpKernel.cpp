@@ -0,0 +1,245 @@
+/**
+ * @file gpKernel.cpp
+ * @brief Gaussian process kernels for the lag effects of GP-DLMs
+ * @version 1.0
+ *
+ * Kernels are Matern 1/2 (exponential, the original exp(phi * DistMat)),
+ * Matern 3/2, Matern 5/2, squared exponential and periodic, all with range
+ * parameter phi. Matern 1/2 on evenly spaced lags is a stationary AR(1), so
+ * its precision is tridiagonal and is written down directly. The other
+ * kernels take one Cholesky factorization of the correlation, with a small
+ * nugget, in place of an inverse followed by a second factorization.
+ */
+#include <RcppEigen.h>
+#include <memory>
+#include "gpKernel.h"
+using namespace Rcpp;
+
+#define GP_NUGGET 0.000001
+
+gpKernel::gpKernel(const MatrixXd &dist_in, std::string name_in)
+{
+  dist  = dist_in.cwiseAbs();
+  p     = dist.rows();
+  name  = name_in;
+}
+
+/**
+ * @brief precision of the lag effects and log determinant of their
+ * correlation, from a Cholesky factorization of the correlation
+ *
+ * @param phi range parameter
+ * @param prec precision (output)
+ * @param logDet log determinant of the correlation (output)
+ */
+void gpKernel::precision(double phi, MatrixXd &prec, double &logDet)
+{
+  MatrixXd K(p, p);
+  for (int j = 0; j < p; ++j)
+    for (int i = j; i < p; ++i)
+      K(i, j) = K(j, i) = corr(dist(i, j), phi);
+  K.diagonal().array() += GP_NUGGET;
+
+  Eigen::LLT<MatrixXd> llt(K);
+  if (llt.info() != Eigen::Success)
+    stop("GP kernel '" + name + "' correlation is not positive definite");
+  prec    = llt.solve(MatrixXd::Identity(p, p));
+  logDet  = 2.0 * llt.matrixLLT().diagonal().array().log().sum();
+}
+
+gpMatern12::gpMatern12(const MatrixXd &dist_in) : gpKernel(dist_in, "matern12")
+{
+  step    = (p > 1) ? dist(1, 0) : 1.0;
+  regular = (step > 0);
+  for (int j = 0; j < p && regular; ++j)
+    for (int i = j; i < p; ++i)
+      if (fabs(dist(i, j) - (i - j) * step) > 1e-8 * (1.0 + step * p))
+        regular = false;
+}
+
+double gpMatern12::corr(double d, double phi)
+{
+  return(exp(-phi * d));
+}
+
+/**
+ * @brief Matern 1/2 precision: closed-form AR(1) tridiagonal precision on
+ * regular lags, otherwise through the Cholesky factor
+ */
+void gpMatern12::precision(double phi, MatrixXd &prec, double &logDet)
+{
+  if (!regular) {
+    gpKernel::precision(phi, prec, logDet);
+    return;
+  }
+  prec.resize(p, p); prec.setZero();
+  if (p == 1) {
+    prec(0, 0) = 1.0;
+    logDet     = 0.0;
+    return;
+  }
+  const double a  = exp(-phi * step);
+  const double s  = 1.0 - a * a;
+  for (int i = 0; i < p; ++i) {
+    prec(i, i) = ((i == 0) || (i == p - 1)) ? 1.0 / s : (1.0 + a * a) / s;
+    if (i > 0)
+      prec(i, i - 1) = prec(i - 1, i) = -a / s;
+  }
+  logDet = (p - 1) * log(s);
+}
+
+double gpMatern32::corr(double d, double phi)
+{
+  const double r = sqrt(3.0) * phi * d;
+  return((1.0 + r) * exp(-r));
+}
+
+double gpMatern52::corr(double d, double phi)
+{
+  const double r = sqrt(5.0) * phi * d;
+  return((1.0 + r + r * r / 3.0) * exp(-r));
+}
+
+double gpSqExp::corr(double d, double phi)
+{
+  return(exp(-0.5 * phi * phi * d * d));
+}
+
+gpPeriodic::gpPeriodic(const MatrixXd &dist_in, double period_in) :
+  gpKernel(dist_in, "periodic")
+{
+  if (period_in <= 0)
+    stop("the periodic GP kernel requires a positive period (gpPeriod)");
+  period = period_in;
+}
+
+double gpPeriodic::corr(double d, double phi)
+{
+  const double s = sin(M_PI * d / period);
+  return(exp(-2.0 * phi * phi * s * s));
+}
+
+/**
+ * @brief create a GP kernel by name
+ *
+ * @param type one of matern12, matern32, matern52, sqexp, periodic
+ * @param DistMat lag distances (signed, as in exp(phi * DistMat))
+ * @param period period in lags of the periodic kernel
+ * @return kernel, to be deleted by the caller
+ */
+gpKernel* gpKernelCreate(const std::string &type, const MatrixXd &DistMat,
+                         double period)
+{
+  if (type == "matern12")
+    return(new gpMatern12(DistMat));
+  if (type == "matern32")
+    return(new gpMatern32(DistMat));
+  if (type == "matern52")
+    return(new gpMatern52(DistMat));
+  if (type == "sqexp")
+    return(new gpSqExp(DistMat));
+  if (type == "periodic")
+    return(new gpPeriodic(DistMat, period));
+  stop("unknown GP kernel '" + type +
+       "', must be one of matern12, matern32, matern52, sqexp, periodic");
+  return(0);
+}
+
+/**
+ * @brief create the GP kernel of a model: gpKernel (default matern12),
+ * gpPeriod and DistMat
+ */
+gpKernel* gpKernelCreate(const Rcpp::List &model)
+{
+  std::string type = "matern12";
+  double period    = 0;
+  if (model.containsElementNamed("gpKernel"))
+    type = as<std::string>(model["gpKernel"]);
+  if (model.containsElementNamed("gpPeriod"))
+    period = as<double>(model["gpPeriod"]);
+  return(gpKernelCreate(type, as<MatrixXd>(model["DistMat"]), period));
+}
+
+
+//' Marginal likelihood comparison of GP kernels for the lag effects
+//'
+//' @param model A list with Y, Z, X, DistMat and optionally gpPeriod, as for
+//' dlmtreeGPGaussian
+//' @param kernels names of the kernels to compare: matern12, matern32,
+//' matern52, sqexp, periodic
+//' @returns A list with, for each kernel, the log marginal likelihood of the
+//' Gaussian DLM Y = Z gamma + X theta + e, theta ~ N(0, sigma2 nu Lambda(phi)),
+//' with gamma, theta and sigma2 (prior 1 / sigma2) integrated out and phi, nu
+//' averaged over a grid (phi with the Gamma(0.5, 2) prior of the GP-DLM on
+//' its range, log nu uniform), and the grid values of phi and nu with the
+//' largest marginal likelihood
+//' @export
+// [[Rcpp::export]]
+Rcpp::List gpKernelCompare_Cpp(const Rcpp::List model,
+                               const Rcpp::CharacterVector kernels)
+{
+  const VectorXd Y        = as<VectorXd>(model["Y"]);
+  const MatrixXd Z        = as<MatrixXd>(model["Z"]);
+  const MatrixXd X        = as<MatrixXd>(model["X"]);
+  const MatrixXd DistMat  = as<MatrixXd>(model["DistMat"]);
+  const double period     = model.containsElementNamed("gpPeriod") ?
+                              as<double>(model["gpPeriod"]) : 0.0;
+  const int n = Y.size(), pZ = Z.cols(), pX = X.cols();
+
+  // Cross products of W = [Z X], shared by all kernels and grid points
+  MatrixXd W(n, pZ + pX);
+  W << Z, X;
+  const MatrixXd WtW  = W.transpose() * W;
+  const VectorXd WtY  = W.transpose() * Y;
+  const double YtY    = Y.squaredNorm();
+
+  const int nGrid = 25;
+  const double logphiLow = log(-log(.95)), logphiHigh = log(-log(.05));
+  VectorXd phiGrid(nGrid), logPhiPrior(nGrid), nuGrid(nGrid);
+  for (int g = 0; g < nGrid; ++g) {
+    phiGrid(g)      = exp(logphiLow + (logphiHigh - logphiLow) * g / (nGrid - 1));
+    logPhiPrior(g)  = R::dgamma(phiGrid(g), 0.5, 2.0, 1) + log(phiGrid(g));
+    nuGrid(g)       = exp(log(1e-4) + (log(1e4) - log(1e-4)) * g / (nGrid - 1));
+  }
+  logPhiPrior.array() -= log(logPhiPrior.array().exp().sum());
+
+  const int nK = kernels.size();
+  VectorXd logML(nK), phiHat(nK), nuHat(nK);
+  for (int k = 0; k < nK; ++k) {
+    // owned by unique_ptr: kernel->precision can stop() with an R error
+    std::unique_ptr<gpKernel> kernel(
+      gpKernelCreate(as<std::string>(kernels[k]), DistMat, period));
+    MatrixXd prec;
+    double logDet;
+    VectorXd ll(nGrid * nGrid);
+    double best = R_NegInf;
+    for (int a = 0; a < nGrid; ++a) {
+      kernel->precision(phiGrid(a), prec, logDet);
+      for (int b = 0; b < nGrid; ++b) {
+        // P = prior precision of (gamma, theta), in units of sigma2
+        MatrixXd A = WtW;
+        A.diagonal().head(pZ).array() += 1.0 / 100000.0;
+        A.bottomRightCorner(pX, pX) += prec / nuGrid(b);
+        Eigen::LLT<MatrixXd> llt(A);
+        const double logDetA  = 2.0 * llt.matrixLLT().diagonal().array().log().sum();
+        const double logDetP  = -pZ * log(100000.0) - logDet - pX * log(nuGrid(b));
+        const double quad     = YtY - WtY.dot(llt.solve(WtY));
+        const double l        = -0.5 * (logDetA - logDetP) - 0.5 * n * log(quad);
+        ll(a * nGrid + b)     = l + logPhiPrior(a) - log((double) nGrid);
+        if (l > best) {
+          best      = l;
+          phiHat(k) = phiGrid(a);
+          nuHat(k)  = nuGrid(b);
+        }
+      }
+    }
+    const double m = ll.maxCoeff();
+    logML(k) = m + log((ll.array() - m).exp().sum()) +
+      R::lgammafn(0.5 * n) - 0.5 * n * log(M_PI);
+  }
+
+  return(Rcpp::List::create(Named("kernel") = kernels,
+                            Named("logML")  = wrap(logML),
+                            Named("phi")    = wrap(phiHat),
+                            Named("nu")     = wrap(nuHat)));
+}
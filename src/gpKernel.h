@@ -0,0 +1,64 @@
+#include <RcppEigen.h>
+#include <string>
+using Eigen::VectorXd;
+using Eigen::MatrixXd;
+
+/**
+ * @brief Gaussian process kernel over lags, used as the prior correlation of
+ * the lag effects of GP-DLMs. Each kernel gives the precision of the lag
+ * effects and the log determinant of their correlation for a range parameter
+ * phi (an inverse length scale), without a dense inverse where a closed form
+ * exists.
+ */
+class gpKernel {
+public:
+  gpKernel(const MatrixXd &dist_in, std::string name_in);
+  virtual ~gpKernel() {}
+
+  std::string name;
+  MatrixXd dist;  // absolute distances between lags
+  int p;
+
+  virtual double corr(double d, double phi) = 0;
+  virtual void precision(double phi, MatrixXd &prec, double &logDet);
+};
+
+class gpMatern12 : public gpKernel {
+public:
+  gpMatern12(const MatrixXd &dist_in);
+  double corr(double d, double phi);
+  void precision(double phi, MatrixXd &prec, double &logDet);
+
+  bool regular;   // evenly spaced lags
+  double step;    // spacing of regular lags
+};
+
+class gpMatern32 : public gpKernel {
+public:
+  gpMatern32(const MatrixXd &dist_in) : gpKernel(dist_in, "matern32") {}
+  double corr(double d, double phi);
+};
+
+class gpMatern52 : public gpKernel {
+public:
+  gpMatern52(const MatrixXd &dist_in) : gpKernel(dist_in, "matern52") {}
+  double corr(double d, double phi);
+};
+
+class gpSqExp : public gpKernel {
+public:
+  gpSqExp(const MatrixXd &dist_in) : gpKernel(dist_in, "sqexp") {}
+  double corr(double d, double phi);
+};
+
+class gpPeriodic : public gpKernel {
+public:
+  gpPeriodic(const MatrixXd &dist_in, double period_in);
+  double corr(double d, double phi);
+
+  double period;
+};
+
+gpKernel* gpKernelCreate(const std::string &type, const MatrixXd &DistMat,
+                         double period = 0);
+gpKernel* gpKernelCreate(const Rcpp::List &model);
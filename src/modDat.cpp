@@ -29,10 +29,32 @@ modDat::modDat(std::vector<int> isnum,
   }
   modProb.resize(nMods); modProb.setOnes();
   modProb /= nMods;
+  oblProb = 0;
 }
 
 modDat::~modDat() {}
 
+/**
+ * @brief enable oblique splits from the model settings: modOblique
+ * (proposal probability), modObliqueIdx (eligible modifiers, 0-based),
+ * modObliqueCut (thresholds) and modStd (standardized modifiers)
+ */
+void modDat::setOblique(const Rcpp::List &model)
+{
+  if (!model.containsElementNamed("modOblique"))
+    return;
+  oblProb = as<double>(model["modOblique"]);
+  if (oblProb <= 0) {
+    oblProb = 0;
+    return;
+  }
+  oblMods = as<std::vector<int> >(model["modObliqueIdx"]);
+  oblCut  = as<Eigen::VectorXd>(model["modObliqueCut"]);
+  modStd  = as<Eigen::MatrixXd>(model["modStd"]);
+  if ((oblMods.size() < 2) || (oblCut.size() == 0) || (modStd.rows() != n))
+    stop("oblique modifier splits require at least two continuous modifiers");
+}
+
 double modDat::totalProb(std::vector<std::vector<int> > am){
   double tp = 0;
   for (int i = 0; i < nMods; ++i) {
@@ -50,7 +72,7 @@ std::vector<std::vector<int> >
   std::vector<std::vector<int> > newAvailMod = am;
   std::size_t i;
 
-  if (splitVar == -1){
+  if ((splitVar == -1) || (splitVar == OBLIQUE_SPLIT)){
     return(newAvailMod);
   }
 
@@ -133,7 +155,21 @@ void modDat::updateNodeVals(Node *n)
   
   // Find intersection and difference of parent and rule indices
   std::pair<std::vector<int>, std::vector<int> > iD;
-  if (varIsNum[splitVar]) {
+  if (splitVar == OBLIQUE_SPLIT) {
+    // project the parent's observations onto the split direction
+    const std::vector<int> vars = (parent->nodestruct)->get2(1);
+    const Eigen::VectorXd coef  = (parent->nodestruct)->get4(1);
+    const double cut = oblCut((parent->nodestruct)->get(2));
+    for (int i : (parent->nodevals)->idx) {
+      double score = 0;
+      for (std::size_t j = 0; j < vars.size(); ++j)
+        score += coef(j) * modStd(i, vars[j]);
+      if (score < cut)
+        iD.first.push_back(i);
+      else
+        iD.second.push_back(i);
+    }
+  } else if (varIsNum[splitVar]) {
     int splitVal  = (parent->nodestruct)->get(2);
     iD            = intersectAndDiff((parent->nodevals)->idx, splitIdx[splitVar][splitVal]);
   } else {
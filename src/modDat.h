@@ -19,6 +19,13 @@ public:
   std::vector<std::vector<std::vector<int> > > splitIdx;
       // vectors of split indices (1.modifier, 2.split, 3.index of observations)
   std::vector<int> fullIdx;
+  // oblique splits: projections of 2-3 continuous modifiers
+  double oblProb;             // probability of proposing an oblique split
+  std::vector<int> oblMods;   // continuous modifiers eligible for oblique splits
+  Eigen::VectorXd oblCut;     // thresholds of the projected scores
+  Eigen::Matrix<double, Eigen::Dynamic, Eigen::Dynamic, Eigen::RowMajor> modStd;
+      // standardized modifiers, one row per observation
+  void setOblique(const Rcpp::List &model);
   double totalProb(std::vector<std::vector<int> >);
       // total probability of available modifiers
   std::vector<std::vector<int> > getAvailMods(int, int, std::vector<int>,
@@ -1,9 +1,37 @@
 #include <RcppEigen.h>
+#include <map>
+#include <set>
+#include <unordered_map>
 using namespace Rcpp;
 using Eigen::MatrixXd;
 using Eigen::VectorXd;
 using namespace Eigen;
 
+// At-risk indicators per word of the bit-packed ZINB log: bit 31 is left
+// unused so that no word equals INT_MIN, which R reads as NA_integer_
+#define W_BITS 31
+
+/**
+ * @brief Metropolis-Hastings terms and node draws of a tree. Each tree keeps
+ * a persistent pair (current, proposed) in modelCtr::mhrWork, so the MHR
+ * functions fill buffers already sized by earlier iterations and acceptance
+ * swaps the pair instead of copying it.
+ */
+struct treeMHR {
+public:
+  VectorXd draw;
+  VectorXd draw1, draw2, drawMix, drawAll;
+  VectorXd fitted;
+  MatrixXd tempV;
+  MatrixXd Xd, Dtrans;
+  double logVThetaChol, beta, termT2, cdf;
+  double nNodes, nModTerm, nDlmTerm, nDlmTerm1, nDlmTerm2, totTerm, nTerm;
+  double term1T2, term2T2, mixT2, nTerm1, nTerm2;
+  double pXd;
+  double m1Var, m2Var;
+  double nTermMix;
+};
+
 /**
  * @brief Data container for model control variables. Passed as pointer throughout model functions.
  * 
@@ -32,6 +60,25 @@ public:
   VectorXd fhat;
   VectorXd tau;
 
+  // NaN recovery
+  bool nanRecover = false;     // flag non-finite values instead of stopping
+  bool nanFlag = false;        // non-finite value detected during current iteration
+  int nanRetries = 0;          // rollbacks allowed before the run is cut short
+  int nanSnapshot = 1;         // iterations between last-good snapshots
+  double nanJitter = 0.0;      // ridge added to precision matrices while retrying
+
+  // Partial fit storage
+  bool floatRmat = false;      // store Rmat in single precision (RmatF)
+  int resyncEvery = 0;         // trees between exact recalculations of R, 0: once per iteration
+  double residDrift = 0.0;     // largest deviation of R from its exact value
+  Eigen::MatrixXf RmatF;       // single precision partial fits
+  VectorXd Rcomp, fhatComp;    // compensation terms for Kahan sums of R and fhat
+
+  // Wall-clock budget
+  double timeBudget = 0.0;     // seconds available for the run, 0: no budget
+  double timeStart = 0.0;      // clock at start of MCMC
+  int budgetProjected = -1;    // records projected to fit the budget, set after burn-in
+
   // Monotone
   VectorXd zirtGamma0;      // confounding coefficients
   VectorXd zirtGamma;
@@ -54,6 +101,33 @@ public:
   VectorXd binomialSize; // n from Binomial (n, p)
   VectorXd Lambda;       
 
+  // Scale-mixture Gaussian: Student-t errors and group variances ---------
+  // Run on the weighted (binomial) path with relative row precisions
+  // Omega = w lambda / sigma2Grp; sigma2 keeps its conjugate update and scales the priors
+  bool scaleMix = false;
+  double tDf = 0;      // Student-t degrees of freedom, 0 for Gaussian errors
+  VectorXd lambda;     // latent precision of each observation
+  VectorXi varGroup;   // variance group of each observation (0-based)
+  VectorXd sigma2Grp;  // variance of each group relative to sigma2 (group 0: 1)
+  VectorXd xiGrp;      // half-Cauchy auxiliary of each group variance
+  VectorXd caseWeight; // case weight of each observation, scales its precision
+  VectorXi arLags;     // lags of the autoregressive errors (rows in time order), empty for none
+  VectorXd arPhi;      // autoregressive coefficients
+
+  // Offsets: known term of the linear predictor -------------------------
+  bool hasOffset = false;
+  VectorXd offset;
+
+  // Grouped random effects: intercepts and slopes, removed from Ystar ----
+  bool hasRE = false;
+  VectorXi reGroup;    // group of each observation (0-based)
+  std::vector<std::vector<int> > reIdx; // observations of each group
+  MatrixXd reZ;        // random-effect design (n x q)
+  MatrixXd reCoef;     // random effects (groups x q)
+  VectorXd reVar;      // variance of each random-effect column
+  VectorXd reXi;       // half-Cauchy auxiliary of each variance
+  VectorXd reFit;      // reZ row-wise times the random effects of its group
+
   // ZINB & NB --------------------------------------------------
   bool zinb; // Indicator boolean for ZINB
 
@@ -86,6 +160,7 @@ public:
 
   // Updating at-risk component
   VectorXd w;          // At-risk latent variable
+  int wStore;                 // At-risk log: 0 = dense, 1 = bit-packed, 2 = posterior mean
   std::vector<int> NBidx;     // Vector containing non-zero y indices
   
   VectorXd Ytemp;      // Fixed response
@@ -94,6 +169,8 @@ public:
   MatrixXd Rmat_temp;  // Each column is partial residual
   
   VectorXd ones;       // Vector of ones
+
+  std::vector<treeMHR> mhrWork; // MHR workspaces, (current, proposed) per tree
 };
 
 struct tdlmCtr : modelCtr { // tdlmCtr: Child class of modelCtr
@@ -119,6 +196,63 @@ public:
   MatrixXd muMix;          // Same with mixture
 };
 
+/**
+ * @brief A frequent tree topology: count, serialization and terminal regions
+ * 
+ */
+struct topoEntry {
+  int count;
+  std::string key;
+  std::vector<std::string> partition;
+};
+
+/**
+ * @brief Posterior topology counts per tree slot with the k most frequent
+ * 
+ */
+struct topoLog {
+public:
+  int topK = 0;
+  std::vector<std::unordered_map<unsigned long long, int> > counts;
+  std::vector<std::map<unsigned long long, topoEntry> > top;
+};
+
+/**
+ * @brief Posterior predictive check: discrepancy statistics of outcomes
+ * replicated at each record
+ * 
+ */
+struct ppcLog {
+public:
+  bool active = false;
+  std::vector<std::string> stats;   // statistic names, quantiles and groups expanded
+  std::vector<int> type;            // statistic code of each output
+  std::vector<double> param;        // quantile probability or group of each output
+  VectorXi group;                   // group of each observation (0-based)
+  int nGroup = 0;
+  double shift = 0.0, scale = 1.0;  // outcome scale: y = shift + scale * y_model
+  VectorXd obs;                     // statistics of the observed outcome
+  MatrixXd rep;                     // statistics of the replicates (statistic x record)
+  VectorXd nGreater;                // replicates with statistic >= observed
+};
+
+/**
+ * @brief Missing exposures treated as latent and imputed at each iteration
+ * 
+ */
+struct imputeLog {
+public:
+  bool active = false;
+  double mean = 0.0, sd = 1.0, rho = 0.0;   // lag-AR(1) prior of the exposure
+  std::vector<int> rows;                    // rows with missing exposures
+  std::vector<std::vector<int> > lags;      // missing lags (0-based) of each row
+  MatrixXd X;                               // current exposures of those rows
+  std::vector<VectorXd> theta;              // terminal node effects of each tree
+  int nRec = 0;
+  VectorXd cellSum, cellSum2;               // imputed values, by row then lag
+  VectorXd effSum, effSum2, effCondVar;     // effect of imputed cells, by row
+};
+
 struct tdlmLog {
 public:
   std::vector<VectorXd> DLMexp;
@@ -129,10 +263,12 @@ public:
   MatrixXd tau;
   VectorXd fhat;
   VectorXd fhat2;
+  VectorXd probMean;   // binomial: running sum of success probabilities
   MatrixXd termNodes;
 
   // Monotone
   MatrixXd timeProbs;
+  VectorXd Yhat;
   MatrixXd zirtSplitCounts;
   MatrixXd zirtGamma;
 
@@ -154,7 +290,33 @@ public:
   MatrixXd b1;
   MatrixXd b2;
   VectorXd r;
-  MatrixXd wMat;
+  MatrixXd wMat;               // dense at-risk log (n x nRec)
+  std::vector<int> wBits;      // bit-packed at-risk log (W_BITS obs. per word, one block per record)
+  VectorXd wMean;              // running sum of at-risk indicators
+
+  // Tree topologies
+  topoLog topo;
+
+  // Posterior predictive checks
+  ppcLog ppc;
+
+  // Counterfactual exposure scenarios: mean contrast vs. observed exposure
+  MatrixXd scenario;
+
+  // Missing exposure imputation
+  imputeLog imp;
+
+  // Scale-mixture Gaussian
+  MatrixXd sigma2Grp;          // group variances (group x nRec)
+  VectorXd lambdaMean;         // running sum of the latent precisions
+  MatrixXd arPhi;              // autoregressive coefficients (lag x nRec)
+
+  // Grouped random effects
+  MatrixXd reVar;              // variance components (q x nRec)
+  MatrixXd reCoefMean;         // running sum of the random effects (groups x q)
+
+  // NaN recovery events: iteration, rolled back to, retry, jitter
+  std::vector<VectorXd> nanEvents;
 };
 
 struct dlmtreeCtr : modelCtr {
@@ -169,6 +331,8 @@ public:
   VectorXd nTermMod;
   MatrixXd exDLM;
   VectorXd modCount;
+  MatrixXd modPair;             // modifier pairs on a root-to-leaf path this iteration
+  std::set<long> modTriple;     // modifier triples on a root-to-leaf path this iteration
   VectorXd modInf;
   VectorXd kappa;
   
@@ -221,7 +385,10 @@ public:
   VectorXd modKappa;
   MatrixXd modProb;
   MatrixXd modCount;
+  MatrixXd modPairCount;            // iterations with each modifier pair
+  std::map<long, int> modTripleCount; // iterations with each modifier triple
   MatrixXd modInf;
+  topoLog topo;                     // modifier tree topologies
     
   // DLM tree logs
   std::vector<VectorXd> treeDLMAccept;
@@ -284,7 +451,89 @@ class Node;
 class exposureDat;
 class modDat;
 class NodeStruct;
+
+/**
+ * @brief Last-good copy of the tdlm/tdlnm/tdlmm sampler state, restored when
+ * non-finite values appear during an iteration. Only parameters, tree
+ * structures and terminal node effects are kept: node values, partial fits
+ * (Rmat), R and the weighted design Zw are rebuilt from them on restore.
+ */
+struct tdlmSnapshot {
+public:
+  int b, r, nStar;
+  double sigma2, xiInvSigma2, nu, modKappa;
+  VectorXd tau, gamma, Ystar, Omega, nTerm, nTerm2;
+  MatrixXd Vg, VgChol;
+
+  // ZINB
+  VectorXd b1, b2, w, rVec, omega2, z2;
+  std::vector<int> NBidx;
+
+  // Mixtures
+  VectorXd muExp, expProb, tree1Exp, tree2Exp;
+  MatrixXd muMix;
+
+  // Tree structures (no node values), effects and running log sums
+  std::vector<Node*> trees1, trees2;
+  std::vector<VectorXd> draws;
+  std::size_t nDLMexp, nMIXexp, nTreeAccept;
+  VectorXd fhat, Yhat, wMean, probMean, ppcGreater;
+  topoLog topo;
+  imputeLog imp;
+  VectorXd lambda, sigma2Grp, xiGrp, lambdaMean, arPhi;
+  MatrixXd reCoef, reCoefMean;
+  VectorXd reVar, reXi, reFit;
+
+  ~tdlmSnapshot();
+};
+
 void tdlmModelEst(modelCtr *ctr);
+void rmatInit(modelCtr *ctr);
+void rmatSet(modelCtr *ctr, int t, const VectorXd &fit);
+VectorXd rmatCol(modelCtr *ctr, int t);
+void backfitStart(modelCtr *ctr);
+void backfitNext(modelCtr *ctr, int t);
+void backfitEnd(modelCtr *ctr);
+void backfitReset(modelCtr *ctr);
+void tdlmSnapshotSave(tdlmCtr *ctr, tdlmLog *dgn, tdlmSnapshot *snap,
+                      std::vector<Node*> &trees1,
+                      std::vector<Node*> *trees2 = 0);
+void tdlmSnapshotRestore(tdlmCtr *ctr, tdlmLog *dgn, tdlmSnapshot *snap,
+                         std::vector<Node*> &trees1,
+                         std::vector<Node*> *trees2 = 0);
+void tdlmLogTruncate(tdlmLog *dgn, int nRec, int n);
+void dlmtreeLogTruncate(dlmtreeLog *dgn, int nRec);
+void budgetStart(modelCtr *ctr);
+bool budgetContinue(modelCtr *ctr);
+int budgetRecords(modelCtr *ctr);
+Rcpp::List budgetSummary(modelCtr *ctr, int nRecPlanned);
+void zinbWLogInit(modelCtr *ctr, tdlmLog *dgn);
+void zinbWLogRecord(modelCtr *ctr, tdlmLog *dgn);
+void scaleMixInit(modelCtr *ctr, tdlmLog *dgn, const Rcpp::List &model);
+void scaleMixUpdate(modelCtr *ctr);
+void scaleMixRecord(modelCtr *ctr, tdlmLog *dgn);
+MatrixXd arWhiten(const modelCtr *ctr, const MatrixXd &M);
+MatrixXd weightRows(const modelCtr *ctr, const MatrixXd &M);
+void offsetInit(modelCtr *ctr, const Rcpp::List &model);
+void reInit(modelCtr *ctr, tdlmLog *dgn, const Rcpp::List &model);
+void reUpdate(modelCtr *ctr);
+void reRecord(modelCtr *ctr, tdlmLog *dgn);
+/**
+ * @brief restores the number of Eigen threads in use when constructed, so a
+ * thread count chosen by autotuneThreads lasts only for one model run
+ */
+class eigenThreadGuard {
+public:
+  eigenThreadGuard() : prevThreads(Eigen::nbThreads()) {}
+  ~eigenThreadGuard() { Eigen::setNbThreads(prevThreads); }
+private:
+  int prevThreads;
+};
+int autotuneThreads(const MatrixXd &Tcalc,
+                    std::map<std::string, double> &timings);
+bool autotuneLowmem(const Rcpp::List &model, modelCtr *ctr, double memBudget,
+                    std::map<std::string, double> &timings);
+Rcpp::NumericVector autotuneTimings(const std::map<std::string, double> &timings);
 double samplepg_na(double b, double c);
 VectorXd rcpp_pgdraw(VectorXd b, VectorXd c);
 double tdlmProposeTree(Node* tree, exposureDat* Exp = 0, 
@@ -292,7 +541,24 @@ double tdlmProposeTree(Node* tree, exposureDat* Exp = 0,
                        double depth = 0.0);
 double modProposeTree(Node* tree, modDat* Mod, dlmtreeCtr* ctr, int step);
 std::string modRuleStr(Node* n, modDat* Mod);
-VectorXd countMods(Node* tree, modDat* Mod);
+VectorXd countMods(Node* tree, modDat* Mod, VectorXd *oblCount = 0);
+void countModPairs(Node* tree, dlmtreeCtr* ctr);
+void recordModPairs(dlmtreeCtr* ctr, dlmtreeLog* dgn);
+MatrixXd modTripleMatrix(dlmtreeLog* dgn, int pM);
+void topoInit(topoLog *topo, int nSlots, int topK);
+void topoRecord(topoLog *topo, int slot, Node *tree, modDat *Mod = 0,
+                const std::string &prefix = "", Node *tree2 = 0);
+Rcpp::List topoSummary(topoLog *topo);
+void ppcInit(ppcLog *ppc, modelCtr *ctr, const Rcpp::List &model);
+void ppcRecord(ppcLog *ppc, modelCtr *ctr);
+Rcpp::List ppcSummary(ppcLog *ppc, int nRec);
+void imputeInit(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                const Rcpp::List &model);
+void imputeUpdate(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                  std::vector<Node*> &trees);
+void imputeSync(imputeLog *imp, exposureDat *Exp, modelCtr *ctr,
+                const MatrixXd &Xfrom);
+Rcpp::List imputeSummary(imputeLog *imp);
 VectorXd countTimeSplits(Node* tree, modelCtr* ctr);
 void drawTree(Node* tree, Node* n, double alpha, double beta, 
               double depth = 0.0);
@@ -300,6 +566,8 @@ void drawZirt(Node* eta, tdlmCtr* ctr, NodeStruct* nsX);
 double zeroInflatedTreeMHR(VectorXd timeProbs, std::vector<Node*> trees,
                            int t, double newProb);
 void updateGPMats(Node* n, dlmtreeCtr* ctr);
+treeMHR* mhrPair(modelCtr* ctr, int t);
+bool dlmSwitchWindow(Node* tree, NodeStruct* expNS, double &logPrior);
 // void dlmtreeRecDLM(dlmtreeCtr* ctr, dlmtreeLog* dlmtreeLog);
 void updateTimeSplitProbs(std::vector<Node*> trees, modelCtr* ctr);
 int updateZirtSigma(std::vector<Node*> trees, modelCtr* ctr, 
@@ -308,21 +576,6 @@ int updateZirtSigma(std::vector<Node*> trees, modelCtr* ctr,
  void updateZirtGamma(std::vector<Node*> trees, modelCtr* ctr);
 
 
-struct treeMHR {
-public:
-  VectorXd draw;
-  VectorXd draw1, draw2, drawMix, drawAll;
-  VectorXd fitted;
-  MatrixXd tempV;
-  MatrixXd Xd, Dtrans;
-  double logVThetaChol, beta, termT2, cdf;
-  double nNodes, nModTerm, nDlmTerm, nDlmTerm1, nDlmTerm2, totTerm, nTerm;
-  double term1T2, term2T2, mixT2, nTerm1, nTerm2;
-  double pXd;
-  double m1Var, m2Var;
-  double nTermMix;
-};
-
 
 class progressMeter {
 public:
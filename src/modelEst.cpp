@@ -16,8 +16,10 @@
 #include "Node.h"
 #include "NodeStruct.h"
 #include <random>
+#include <chrono>
 #include <iostream>
 #include <algorithm>
+#include <cstdio>
 using namespace Rcpp;
 using Eigen::VectorXd;
 using Eigen::MatrixXd;
@@ -35,14 +37,24 @@ void tdlmModelEst(modelCtr *ctr){
     ctr->gamma        = ctr->Vg * ZR; 
     // * Update sigma^2 and xi_sigma2
     if (!(ctr->binomial)) {
-      rHalfCauchyFC(&(ctr->sigma2), (double)ctr->n + (double)ctr->totTerm, 
-                    ctr->R.dot(ctr->R) - ZR.dot(ctr->gamma) + ctr->sumTermT2 / ctr->nu, &(ctr->xiInvSigma2));
+      double nObs = (double) ctr->n;
+      double RtR  = ctr->R.dot(ctr->R);
+      if (ctr->scaleMix) { // relative row precisions: weighted (whitened) SS
+        nObs = ctr->caseWeight.sum();
+        RtR  = ctr->R.dot(weightRows(ctr, ctr->R).col(0));
+      }
+      rHalfCauchyFC(&(ctr->sigma2), nObs + (double)ctr->totTerm, 
+                    RtR - ZR.dot(ctr->gamma) + ctr->sumTermT2 / ctr->nu, &(ctr->xiInvSigma2));
       // Rcout << ctr->sigma2 << "\n";
       
-      if ((ctr->sigma2 != ctr->sigma2)) {// ! stop if infinite or nan variance
+      if (!std::isfinite(ctr->sigma2)) {// ! stop if infinite or nan variance
         // Rcout << ctr->sigma2 << " " << ctr->totTerm << " " << 
         //   ctr->R.dot(ctr->R) << " " << ZR.dot(ctr->gamma) << " " << ctr->R << " " <<
         //   " " << ctr->Z << " " << ZR << " " << (ctr->gamma) << " " << ctr->sumTermT2 / ctr->nu << " " << ctr->xiInvSigma2;
+        if (ctr->nanRecover) { // let the caller roll back to the last good state
+          ctr->nanFlag = true;
+          return;
+        }
         stop("\nNaN values (sigma) occured during model run, rerun model.\n");
       }
     }
@@ -50,9 +62,21 @@ void tdlmModelEst(modelCtr *ctr){
     // * Draw fixed effect coefficients' variance
     ctr->gamma.noalias() += ctr->VgChol * as<VectorXd>(rnorm(ctr->pZ, 0, sqrt(ctr->sigma2))); 
 
+    // * Update latent precisions and group variances
+    if (ctr->scaleMix)
+      scaleMixUpdate(ctr);
+
+    // * Update grouped random effects and their variances
+    if (ctr->hasRE)
+      reUpdate(ctr);
+
     // * Update polya gamma vars
     if (ctr->binomial) {
       VectorXd psi  = ctr->fhat + ctr->Z * ctr->gamma;
+      if (ctr->hasOffset)
+        psi += ctr->offset;
+      if (ctr->hasRE)
+        psi += ctr->reFit;
       
       // Latent variable, Omega
       ctr->Omega    = rcpp_pgdraw(ctr->binomialSize, psi); 
@@ -61,7 +85,7 @@ void tdlmModelEst(modelCtr *ctr){
       // Constructing V_gamma Inverse 
       Eigen::MatrixXd VgInv(ctr->pZ, ctr->pZ); 
       VgInv.triangularView<Eigen::Lower>() = ctr->Z.transpose() * ctr->Zw;
-      VgInv.diagonal().array() += 1 / 100000.0; 
+      VgInv.diagonal().array() += 1 / 100000.0 + ctr->nanJitter; 
       VgInv.triangularView<Eigen::Upper>() = VgInv.transpose().eval(); 
 
       // Constructing V_gamma = Inverse of V_gamma Inverse
@@ -70,7 +94,13 @@ void tdlmModelEst(modelCtr *ctr){
       
       // Update the V_gamma cholesky using LLT Decomposition, Lower triangular part of matrix L
       ctr->VgChol = ctr->Vg.llt().matrixL();
-      ctr->Ystar      = ctr->kappa.array() / ctr->Omega.array();  // recalculate 'pseudo-Y' = kappa / omega, kappa = (y - n_b)/2
+      // recalculate 'pseudo-Y' = kappa / omega, kappa = (y - n_b)/2; observations
+      // of size 0 (e.g. later sticks of a multinomial) have omega = 0 and drop out
+      ctr->Ystar      = (ctr->Omega.array() > 0).select(ctr->kappa.array() / ctr->Omega.array(), 0.0);
+      if (ctr->hasOffset)
+        ctr->Ystar -= ctr->offset;
+      if (ctr->hasRE)
+        ctr->Ystar -= ctr->reFit;
       ctr->R      = ctr->Ystar - ctr->fhat; // Recalc R using new Y
     }
 
@@ -106,6 +136,8 @@ void tdlmModelEst(modelCtr *ctr){
     // 2-1: Calculate eta1 & logit1 (ZI), eta2 & logit2 (NB)
     eta1                    = (ctr->Z1 * ctr->b1);
     Eigen::VectorXd eta2    = (ctr->Z * ctr->b2) + (ctr->fhat);
+    if (ctr->hasOffset)
+      eta2 += ctr->offset;
     Eigen::VectorXd logit1  = 1 / (1 + exp(-(eta1).array()));
     Eigen::VectorXd logit2  = 1 / (1 + exp(-(eta2).array()));
     
@@ -170,7 +202,7 @@ void tdlmModelEst(modelCtr *ctr){
     Eigen::MatrixXd VgInv(ctr->pZ, ctr->pZ); 
     VgInv.setZero(); 
     VgInv.triangularView<Eigen::Lower>()    = ctr->Zstar.transpose() * (ctr->Zw); 
-    VgInv.diagonal().array() += 1 / 100.0; 
+    VgInv.diagonal().array() += 1 / 100.0 + ctr->nanJitter; 
     VgInv.triangularView<Eigen::Upper>()    = VgInv.transpose().eval(); 
     ctr->Vg.triangularView<Eigen::Lower>()  = VgInv.inverse();
     ctr->Vg.triangularView<Eigen::Upper>()  = ctr->Vg.transpose().eval();   
@@ -179,6 +211,8 @@ void tdlmModelEst(modelCtr *ctr){
     // z2 (= Ystar)
     ctr->z2     = (ctr->Y0 - ctr->rVec).array() / (2*(ctr->omega2).array()).array();
     ctr->Ystar  = (ctr->z2).array() * (1 - ctr->w.array());
+    if (ctr->hasOffset)
+      ctr->Ystar.array() -= ctr->offset.array() * (1 - ctr->w.array());
 
     // R (partial residual)
     Eigen::VectorXd fhatStar = ctr->fhat.array() * (1 - ctr->w.array()); 
@@ -188,9 +222,887 @@ void tdlmModelEst(modelCtr *ctr){
     const Eigen::VectorXd ZR = ctr->Zw.transpose() * (ctr->R);
     ctr->b2 = ctr->Vg * ZR;
     ctr->b2.noalias() += ctr->VgChol * as<Eigen::VectorXd>(rnorm(ctr->pZ, 0, sqrt(ctr->sigma2)));
+
+    if (ctr->nanRecover && (!(ctr->b1.allFinite()) || !(ctr->b2.allFinite())))
+      ctr->nanFlag = true;
   } // End ZINB
 } // end tdlmModelEst function
 
+tdlmSnapshot::~tdlmSnapshot()
+{
+  for (Node* t : trees1)
+    delete t;
+  for (Node* t : trees2)
+    delete t;
+}
+
+/**
+ * @brief add x to sum with Kahan compensation
+ *
+ * @param sum running sum
+ * @param comp running compensation, zero when the sum is (re)started
+ * @param x value to add
+ */
+static void kahanAdd(VectorXd &sum, VectorXd &comp, const VectorXd &x)
+{
+  VectorXd y    = x - comp;
+  VectorXd tmp  = sum + y;
+  comp          = (tmp - sum) - y;
+  sum           = tmp;
+}
+
+/**
+ * @brief allocate partial fits in double (Rmat) or single (RmatF) precision
+ * 
+ * @param ctr model control data
+ */
+void rmatInit(modelCtr *ctr)
+{
+  if (ctr->floatRmat) {
+    ctr->Rmat.resize(0, 0);
+    ctr->RmatF.resize(ctr->n, ctr->nTrees);   ctr->RmatF.setZero();
+  } else {
+    ctr->Rmat.resize(ctr->n, ctr->nTrees);    ctr->Rmat.setZero();
+  }
+  ctr->Rcomp.resize(ctr->n);                  ctr->Rcomp.setZero();
+  ctr->fhatComp.resize(ctr->n);               ctr->fhatComp.setZero();
+  ctr->residDrift = 0.0;
+}
+
+/**
+ * @brief store the partial fit of tree t
+ * 
+ * @param ctr model control data
+ * @param t tree index
+ * @param fit fitted values of tree t
+ */
+void rmatSet(modelCtr *ctr, int t, const VectorXd &fit)
+{
+  if (ctr->floatRmat)
+    ctr->RmatF.col(t) = fit.cast<float>();
+  else
+    ctr->Rmat.col(t) = fit;
+}
+
+/**
+ * @brief partial fit of tree t in double precision
+ * 
+ * @param ctr model control data
+ * @param t tree index
+ */
+VectorXd rmatCol(modelCtr *ctr, int t)
+{
+  if (ctr->floatRmat)
+    return(ctr->RmatF.col(t).cast<double>());
+  return(ctr->Rmat.col(t));
+}
+
+/**
+ * @brief start a backfitting sweep: remove the first tree from R and reset fhat
+ * 
+ * @param ctr model control data
+ */
+void backfitStart(modelCtr *ctr)
+{
+  ctr->Rcomp.setZero();
+  ctr->fhatComp.setZero();
+  kahanAdd(ctr->R, ctr->Rcomp, rmatCol(ctr, 0));
+  ctr->fhat.setZero();
+}
+
+/**
+ * @brief add tree t to fhat and swap tree t + 1 for tree t in R. Every
+ * ctr->resyncEvery trees, R is recalculated exactly from Ystar and the
+ * partial fits instead.
+ * 
+ * @param ctr model control data
+ * @param t tree just updated
+ */
+void backfitNext(modelCtr *ctr, int t)
+{
+  VectorXd fitT = rmatCol(ctr, t);
+  kahanAdd(ctr->fhat, ctr->fhatComp, fitT);
+  if (t >= ctr->nTrees - 1)
+    return;
+
+  if ((ctr->resyncEvery > 0) && (((t + 1) % ctr->resyncEvery) == 0)) {
+    VectorXd Rexact = ctr->Ystar - ctr->fhat;
+    for (int s = t + 2; s < ctr->nTrees; ++s)
+      Rexact -= rmatCol(ctr, s);
+    ctr->R = Rexact;
+    ctr->Rcomp.setZero();
+  } else {
+    kahanAdd(ctr->R, ctr->Rcomp, rmatCol(ctr, t + 1) - fitT);
+  }
+}
+
+/**
+ * @brief end a backfitting sweep: record the drift of R from its exact value
+ * before recalculating R = Ystar - fhat
+ * 
+ * @param ctr model control data
+ */
+void backfitEnd(modelCtr *ctr)
+{
+  VectorXd Rexact = ctr->Ystar - ctr->fhat + rmatCol(ctr, ctr->nTrees - 1);
+  ctr->residDrift = std::max(ctr->residDrift, (ctr->R - Rexact).cwiseAbs().maxCoeff());
+  ctr->R = ctr->Ystar - ctr->fhat;
+}
+
+/**
+ * @brief recalculate fhat and R exactly from the partial fits, e.g. after a
+ * rollback rebuilt them
+ * 
+ * @param ctr model control data
+ */
+void backfitReset(modelCtr *ctr)
+{
+  ctr->fhat.setZero();
+  for (int t = 0; t < ctr->nTrees; ++t)
+    ctr->fhat += rmatCol(ctr, t);
+  ctr->Rcomp.setZero();
+  ctr->fhatComp.setZero();
+  if (ctr->zinb) // at-risk observations only, as in tdlmModelEst
+    ctr->R = ctr->Ystar - (ctr->fhat.array() * (1 - ctr->w.array())).matrix();
+  else
+    ctr->R = ctr->Ystar - ctr->fhat;
+}
+
+/**
+ * @brief copy the structure of a tree without its node values
+ *
+ * @param n top of the tree
+ * @return new tree, to be deleted by the caller
+ */
+static Node* snapshotTree(const Node *n)
+{
+  Node *out = new Node(n->depth, 1);
+  out->nodestruct = (n->nodestruct)->clone();
+  if (n->c1 != 0) {
+    out->c1 = snapshotTree(n->c1);
+    out->c2 = snapshotTree(n->c2);
+    out->c1->parent = out;
+    out->c2->parent = out;
+  }
+  return(out);
+}
+
+/**
+ * @brief copy the current sampler state and log positions into a snapshot
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ * @param snap snapshot to overwrite
+ * @param trees1 trees (first tree of each pair for mixtures)
+ * @param trees2 second tree of each pair for mixtures, 0 otherwise
+ */
+void tdlmSnapshotSave(tdlmCtr *ctr, tdlmLog *dgn, tdlmSnapshot *snap,
+                      std::vector<Node*> &trees1,
+                      std::vector<Node*> *trees2)
+{
+  snap->b           = ctr->b;
+  snap->sigma2      = ctr->sigma2;
+  snap->xiInvSigma2 = ctr->xiInvSigma2;
+  snap->nu          = ctr->nu;
+  snap->modKappa    = ctr->modKappa;
+  snap->tau         = ctr->tau;
+  snap->gamma       = ctr->gamma;
+  snap->Ystar       = ctr->Ystar;
+  snap->nTerm       = ctr->nTerm;
+  snap->nTerm2      = ctr->nTerm2;
+  if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
+    snap->Omega     = ctr->Omega;
+    snap->Vg        = ctr->Vg;
+    snap->VgChol    = ctr->VgChol;
+  }
+  if (ctr->scaleMix) {
+    snap->lambda    = ctr->lambda;
+    snap->sigma2Grp = ctr->sigma2Grp;
+    snap->xiGrp     = ctr->xiGrp;
+    snap->lambdaMean = dgn->lambdaMean;
+    snap->arPhi     = ctr->arPhi;
+  }
+  if (ctr->hasRE) {
+    snap->reCoef    = ctr->reCoef;
+    snap->reVar     = ctr->reVar;
+    snap->reXi      = ctr->reXi;
+    snap->reFit     = ctr->reFit;
+    snap->reCoefMean = dgn->reCoefMean;
+  }
+  if (ctr->zinb) {
+    snap->r         = ctr->r;
+    snap->rVec      = ctr->rVec;
+    snap->nStar     = ctr->nStar;
+    snap->NBidx     = ctr->NBidx;
+    snap->b1        = ctr->b1;
+    snap->b2        = ctr->b2;
+    snap->w         = ctr->w;
+    snap->omega2    = ctr->omega2;
+    snap->z2        = ctr->z2;
+  }
+  snap->muExp       = ctr->muExp;
+  snap->muMix       = ctr->muMix;
+  snap->expProb     = ctr->expProb;
+  snap->tree1Exp    = ctr->tree1Exp;
+  snap->tree2Exp    = ctr->tree2Exp;
+
+  // tree structures and current terminal node effects
+  for (Node* t : snap->trees1)
+    delete t;
+  for (Node* t : snap->trees2)
+    delete t;
+  (snap->trees1).clear();
+  (snap->trees2).clear();
+  (snap->draws).resize(trees1.size());
+  for (std::size_t t = 0; t < trees1.size(); ++t) {
+    (snap->trees1).push_back(snapshotTree(trees1[t]));
+    treeMHR &mhr0 = mhrPair(ctr, t)[0];
+    snap->draws[t] = (trees2 != 0) ? mhr0.drawAll : mhr0.draw;
+  }
+  if (trees2 != 0) {
+    for (Node* t : *trees2)
+      (snap->trees2).push_back(snapshotTree(t));
+  }
+
+  // log positions and running sums
+  snap->nDLMexp     = (dgn->DLMexp).size();
+  snap->nMIXexp     = (dgn->MIXexp).size();
+  snap->nTreeAccept = (dgn->TreeAccept).size();
+  snap->fhat        = dgn->fhat;
+  snap->Yhat        = dgn->Yhat;
+  snap->wMean       = dgn->wMean;
+  snap->probMean    = dgn->probMean;
+  snap->topo        = dgn->topo;
+  snap->ppcGreater  = dgn->ppc.nGreater;
+  snap->imp         = dgn->imp;
+} // end tdlmSnapshotSave function
+
+/**
+ * @brief roll the sampler state and logs back to a snapshot
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ * @param snap snapshot to restore
+ * @param trees1 trees (first tree of each pair for mixtures)
+ * @param trees2 second tree of each pair for mixtures, 0 otherwise
+ */
+void tdlmSnapshotRestore(tdlmCtr *ctr, tdlmLog *dgn, tdlmSnapshot *snap,
+                         std::vector<Node*> &trees1,
+                         std::vector<Node*> *trees2)
+{
+  ctr->b            = snap->b;
+  ctr->sigma2       = snap->sigma2;
+  ctr->xiInvSigma2  = snap->xiInvSigma2;
+  ctr->nu           = snap->nu;
+  ctr->modKappa     = snap->modKappa;
+  ctr->tau          = snap->tau;
+  ctr->gamma        = snap->gamma;
+  ctr->Ystar        = snap->Ystar;
+  ctr->nTerm        = snap->nTerm;
+  ctr->nTerm2       = snap->nTerm2;
+  if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
+    ctr->Omega      = snap->Omega;
+    ctr->Vg         = snap->Vg;
+    ctr->VgChol     = snap->VgChol;
+  }
+  if (ctr->scaleMix) {
+    ctr->lambda     = snap->lambda;
+    ctr->sigma2Grp  = snap->sigma2Grp;
+    ctr->xiGrp      = snap->xiGrp;
+    dgn->lambdaMean = snap->lambdaMean;
+    ctr->arPhi      = snap->arPhi;
+  }
+  if (ctr->hasRE) {
+    ctr->reCoef     = snap->reCoef;
+    ctr->reVar      = snap->reVar;
+    ctr->reXi       = snap->reXi;
+    ctr->reFit      = snap->reFit;
+    dgn->reCoefMean = snap->reCoefMean;
+  }
+  if (ctr->zinb) {
+    ctr->r          = snap->r;
+    ctr->rVec       = snap->rVec;
+    ctr->nStar      = snap->nStar;
+    ctr->NBidx      = snap->NBidx;
+    ctr->b1         = snap->b1;
+    ctr->b2         = snap->b2;
+    ctr->w          = snap->w;
+    ctr->omega2     = snap->omega2;
+    ctr->z2         = snap->z2;
+  }
+  ctr->muExp        = snap->muExp;
+  ctr->muMix        = snap->muMix;
+  ctr->expProb      = snap->expProb;
+  ctr->tree1Exp     = snap->tree1Exp;
+  ctr->tree2Exp     = snap->tree2Exp;
+  ctr->nanFlag      = false;
+
+  // weighted fixed-effect design, as last set from the restored weights
+  if (ctr->zinb) {
+    ctr->Zstar      = (ctr->Z).array().colwise() * (1 - ctr->w.array());
+    ctr->Zw         = (ctr->omega2).asDiagonal() * ctr->Zstar;
+  } else if (ctr->scaleMix) {
+    ctr->Zw         = weightRows(ctr, ctr->Z);
+  } else if (ctr->binomial) {
+    ctr->Zw         = ctr->Omega.asDiagonal() * ctr->Z;
+  }
+
+  // tree structures and effects: the caller rebuilds node values and the
+  // partial fits, then calls backfitReset
+  for (std::size_t t = 0; t < trees1.size(); ++t) {
+    delete trees1[t];
+    trees1[t] = snapshotTree(snap->trees1[t]);
+    treeMHR &mhr0 = mhrPair(ctr, t)[0];
+    if (trees2 != 0)
+      mhr0.drawAll = snap->draws[t];
+    else
+      mhr0.draw = snap->draws[t];
+  }
+  if (trees2 != 0) {
+    for (std::size_t t = 0; t < trees2->size(); ++t) {
+      delete (*trees2)[t];
+      (*trees2)[t] = snapshotTree(snap->trees2[t]);
+    }
+  }
+  if (ctr->floatRmat)
+    ctr->RmatF.setZero();
+  else
+    ctr->Rmat.setZero();
+
+  // logs
+  (dgn->DLMexp).resize(snap->nDLMexp);
+  (dgn->MIXexp).resize(snap->nMIXexp);
+  (dgn->TreeAccept).resize(snap->nTreeAccept);
+  dgn->fhat         = snap->fhat;
+  dgn->Yhat         = snap->Yhat;
+  dgn->wMean        = snap->wMean;
+  dgn->probMean     = snap->probMean;
+  dgn->topo         = snap->topo;
+  dgn->ppc.nGreater = snap->ppcGreater;
+  dgn->imp          = snap->imp;
+} // end tdlmSnapshotRestore function
+
+/**
+ * @brief shrink per-record logs to the first nRec records, used when a run
+ * is cut short after repeated non-finite values
+ *
+ * @param dgn model log
+ * @param nRec number of completed records
+ * @param n number of observations
+ */
+void tdlmLogTruncate(tdlmLog *dgn, int nRec, int n)
+{
+  for (MatrixXd* m : {&(dgn->gamma), &(dgn->tau), &(dgn->termNodes),
+                      &(dgn->timeProbs), &(dgn->termNodes2), &(dgn->expCount),
+                      &(dgn->mixCount), &(dgn->expProb), &(dgn->expInf),
+                      &(dgn->mixInf), &(dgn->tree1Exp), &(dgn->tree2Exp),
+                      &(dgn->muExp), &(dgn->muMix), &(dgn->b1), &(dgn->b2),
+                      &(dgn->wMat), &(dgn->scenario), &(dgn->sigma2Grp),
+                      &(dgn->reVar), &(dgn->arPhi)}) {
+    if (m->cols() > nRec)
+      m->conservativeResize(m->rows(), nRec);
+  }
+  for (VectorXd* v : {&(dgn->sigma2), &(dgn->nu), &(dgn->kappa), &(dgn->r)}) {
+    if (v->size() > nRec)
+      v->conservativeResize(nRec);
+  }
+  if (!(dgn->wBits).empty())
+    (dgn->wBits).resize(((n + W_BITS - 1) / W_BITS) * nRec);
+} // end tdlmLogTruncate function
+
+/**
+ * @brief shrink per-record logs of the dlmtree engines to the first nRec records
+ *
+ * @param dgn model log
+ * @param nRec number of completed records
+ */
+void dlmtreeLogTruncate(dlmtreeLog *dgn, int nRec)
+{
+  for (MatrixXd* m : {&(dgn->gamma), &(dgn->tau), &(dgn->termNodesMod),
+                      &(dgn->modProb), &(dgn->modCount), &(dgn->modInf),
+                      &(dgn->termNodesDLM), &(dgn->termNodesDLM1), &(dgn->termNodesDLM2),
+                      &(dgn->termNodes1), &(dgn->termNodes2), &(dgn->expCount),
+                      &(dgn->mixCount), &(dgn->expProb), &(dgn->expInf),
+                      &(dgn->mixInf), &(dgn->dlmTree1Exp), &(dgn->dlmTree2Exp),
+                      &(dgn->muExp), &(dgn->muMix), &(dgn->b1), &(dgn->b2),
+                      &(dgn->wMat)}) {
+    if (m->cols() > nRec)
+      m->conservativeResize(m->rows(), nRec);
+  }
+  for (VectorXd* v : {&(dgn->sigma2), &(dgn->nu), &(dgn->totTerm), &(dgn->modKappa),
+                      &(dgn->kappa), &(dgn->mixKappa), &(dgn->phi), &(dgn->r)}) {
+    if (v->size() > nRec)
+      v->conservativeResize(nRec);
+  }
+} // end dlmtreeLogTruncate function
+
+/**
+ * @brief wall-clock seconds since an arbitrary fixed point
+ */
+static double budgetClock()
+{
+  return(std::chrono::duration<double>(
+    std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * @brief start the wall-clock budget of an MCMC run
+ *
+ * @param ctr model control data
+ */
+void budgetStart(modelCtr *ctr)
+{
+  ctr->timeStart = budgetClock();
+  ctr->budgetProjected = -1;
+}
+
+/**
+ * @brief check the wall-clock budget before MCMC iteration ctr->b. Burn-in
+ * is cut short once it has used half the budget. At the first iteration
+ * after burn-in the time per iteration is used to choose thinning (no more
+ * than requested) and the number of iterations so that the records fit in
+ * the remaining time.
+ *
+ * @param ctr model control data, burn, iter and thin may be changed
+ * @return false if the deadline has passed and the run should stop
+ */
+bool budgetContinue(modelCtr *ctr)
+{
+  if (ctr->timeBudget <= 0)
+    return(true);
+  double used = budgetClock() - ctr->timeStart;
+  if (used >= ctr->timeBudget)
+    return(false);
+
+  if ((ctr->b > 1) && (ctr->b <= ctr->burn) && (used > 0.5 * ctr->timeBudget))
+    ctr->burn = ctr->b - 1;
+
+  // plan once the time per iteration is known
+  if ((ctr->budgetProjected < 0) && (ctr->b > 1) && (ctr->b > ctr->burn)) {
+    double rate = used / (ctr->b - 1);
+    int done    = ctr->b - 1 - ctr->burn; // post burn-in iterations already run
+    int avail   = done + (int) floor(0.95 * (ctr->timeBudget - used) / rate);
+    if (done == 0)
+      ctr->thin = std::max(1, std::min(ctr->thin, avail / std::max(1, ctr->nRec)));
+    int rec = std::min(ctr->nRec, avail / ctr->thin);
+    ctr->iter = std::max(rec * ctr->thin, done);
+    ctr->budgetProjected = rec;
+  }
+  return(true);
+} // end budgetContinue function
+
+/**
+ * @brief number of records completed when the MCMC loop ends, for a run
+ * that finished, stopped at its deadline or was cut short. ctr->b must hold
+ * the number of completed iterations if the loop was left early.
+ *
+ * @param ctr model control data
+ */
+int budgetRecords(modelCtr *ctr)
+{
+  int done = std::min(ctr->b, ctr->iter + ctr->burn);
+  return((done > ctr->burn) ? (done - ctr->burn) / ctr->thin : 0);
+}
+
+/**
+ * @brief projected and achieved records of a budgeted run
+ *
+ * @param ctr model control data
+ * @param nRecPlanned records requested before the run
+ */
+Rcpp::List budgetSummary(modelCtr *ctr, int nRecPlanned)
+{
+  return(Rcpp::List::create(Named("budget")    = wrap(ctr->timeBudget),
+                            Named("elapsed")   = wrap(budgetClock() - ctr->timeStart),
+                            Named("requested") = wrap(nRecPlanned),
+                            Named("projected") = wrap(ctr->budgetProjected),
+                            Named("achieved")  = wrap(ctr->nRec),
+                            Named("burn")      = wrap(ctr->burn),
+                            Named("thin")      = wrap(ctr->thin)));
+}
+
+/**
+ * @brief allocate the ZINB at-risk indicator log according to ctr->wStore
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ */
+void zinbWLogInit(modelCtr *ctr, tdlmLog *dgn){
+  (dgn->wMat).resize(0, 0);
+  (dgn->wBits).clear();
+  (dgn->wMean).resize(0);
+  if (!(ctr->zinb))
+    return;
+
+  if (ctr->wStore == 1) {         // 1 bit per observation per record
+    std::size_t nWords = (ctr->n + W_BITS - 1) / W_BITS;
+    (dgn->wBits).assign(nWords * ctr->nRec, 0);
+  } else if (ctr->wStore == 2) {  // online posterior mean
+    (dgn->wMean).resize(ctr->n);                     (dgn->wMean).setZero();
+  } else {                        // dense n x nRec
+    (dgn->wMat).resize(ctr->n, ctr->nRec);           (dgn->wMat).setZero();
+  }
+} // end zinbWLogInit function
+
+/**
+ * @brief record the current at-risk indicators w in the ZINB log
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ */
+void zinbWLogRecord(modelCtr *ctr, tdlmLog *dgn){
+  if (!(ctr->zinb) || (ctr->record <= 0))
+    return;
+
+  if (ctr->wStore == 1) {
+    std::size_t nWords = (ctr->n + W_BITS - 1) / W_BITS;
+    std::size_t offset = nWords * (ctr->record - 1);
+    int word = 0;
+    for (int i = 0; i < ctr->n; ++i) {
+      const int bit = i % W_BITS;
+      if ((ctr->w)[i] > 0.5)
+        word |= (1 << bit);
+      if ((bit == W_BITS - 1) || (i == ctr->n - 1)) {
+        (dgn->wBits)[offset + i / W_BITS] = word;
+        word = 0;
+      }
+    }
+  } else if (ctr->wStore == 2) {
+    dgn->wMean += ctr->w;
+  } else {
+    (dgn->wMat).col(ctr->record - 1) = ctr->w;
+  }
+} // end zinbWLogRecord function
+
+/**
+ * @brief weighted fixed-effect design Zw = W Z and its posterior covariance
+ * Vg = (Z^T W Z)^-1 for the current row precisions
+ *
+ * @param ctr model control data
+ */
+static void scaleMixDesign(modelCtr *ctr){
+  ctr->Zw = weightRows(ctr, ctr->Z);
+
+  Eigen::MatrixXd VgInv(ctr->pZ, ctr->pZ);
+  VgInv.triangularView<Eigen::Lower>() = ctr->Z.transpose() * ctr->Zw;
+  VgInv.diagonal().array() += 1 / 100000.0 + ctr->nanJitter;
+  VgInv.triangularView<Eigen::Upper>() = VgInv.transpose().eval();
+  ctr->Vg.triangularView<Eigen::Lower>() = VgInv.inverse();
+  ctr->Vg.triangularView<Eigen::Upper>() = ctr->Vg.transpose().eval();
+  ctr->VgChol = ctr->Vg.llt().matrixL();
+} // end scaleMixDesign function
+
+/**
+ * @brief set up Student-t errors and group variances: latent precisions
+ * lambda, group variances and the weighted fixed-effect design
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ * @param model model settings: tDf, varGroup and weights
+ */
+void scaleMixInit(modelCtr *ctr, tdlmLog *dgn, const Rcpp::List &model){
+  if (!(ctr->scaleMix))
+    return;
+  const IntegerVector grp = model["varGroup"];
+  ctr->tDf = as<double>(model["tDf"]);
+  ctr->varGroup = VectorXi::Zero(ctr->n);
+  int nGrp = 1;
+  if (grp.size() == ctr->n) {
+    for (int i = 0; i < ctr->n; ++i) {
+      ctr->varGroup(i) = (int) grp[i];
+      nGrp = std::max(nGrp, (int) grp[i] + 1);
+    }
+  }
+  const NumericVector wt = model["weights"];
+  ctr->caseWeight.resize(ctr->n);     ctr->caseWeight.setOnes();
+  if (wt.size() == ctr->n)
+    ctr->caseWeight = as<VectorXd>(wt);
+  ctr->lambda.resize(ctr->n);         ctr->lambda.setOnes();
+  ctr->sigma2Grp.resize(nGrp);        ctr->sigma2Grp.setOnes();
+  ctr->xiGrp.resize(nGrp);            ctr->xiGrp.setOnes();
+  ctr->Omega = ctr->caseWeight;
+  const IntegerVector lags = model["arLags"];
+  ctr->arLags = as<VectorXi>(lags);
+  ctr->arPhi.resize(lags.size());     ctr->arPhi.setZero();
+
+  (dgn->sigma2Grp).resize(nGrp, ctr->nRec);   (dgn->sigma2Grp).setZero();
+  (dgn->lambdaMean).resize(ctr->n);           (dgn->lambdaMean).setZero();
+  (dgn->arPhi).resize(lags.size(), ctr->nRec); (dgn->arPhi).setZero();
+  scaleMixDesign(ctr);
+} // end scaleMixInit function
+
+/**
+ * @brief prewhiten the rows of M under autoregressive errors:
+ * (Phi M)_t = M_t - sum_k phi_k M_{t - l_k}, with rows before the start of
+ * the series taken as zero. Phi is banded, so this is O(n) per column.
+ *
+ * @param ctr model control data
+ * @param M matrix with rows in time order
+ * @return Phi M
+ */
+MatrixXd arWhiten(const modelCtr *ctr, const MatrixXd &M){
+  MatrixXd out = M;
+  const int n = M.rows();
+  for (int k = 0; k < ctr->arLags.size(); ++k) {
+    const int l = ctr->arLags(k);
+    if (l < n)
+      out.bottomRows(n - l).noalias() -= ctr->arPhi(k) * M.topRows(n - l);
+  }
+  return(out);
+} // end arWhiten function
+
+/**
+ * @brief weight the rows of M by the error precision on the weighted path:
+ * Omega M, or Phi^T Omega Phi M under autoregressive errors, where Omega is
+ * the precision of each innovation. Node designs are weighted when they are
+ * used, so no whitened copy of the exposure data is kept.
+ *
+ * @param ctr model control data
+ * @param M matrix with rows in time order
+ * @return W M
+ */
+MatrixXd weightRows(const modelCtr *ctr, const MatrixXd &M){
+  if (ctr->arLags.size() == 0)
+    return(ctr->Omega.asDiagonal() * M);
+
+  const MatrixXd V = ctr->Omega.asDiagonal() * arWhiten(ctr, M);
+  MatrixXd out = V;
+  const int n = M.rows();
+  for (int k = 0; k < ctr->arLags.size(); ++k) {
+    const int l = ctr->arLags(k);
+    if (l < n)
+      out.topRows(n - l).noalias() -= ctr->arPhi(k) * V.bottomRows(n - l);
+  }
+  return(out);
+} // end weightRows function
+
+/**
+ * @brief draw the autoregressive coefficients given the errors e and the
+ * innovation precisions Omega / sigma2, with N(0, 1) priors; draws outside
+ * the stationary region are rejected and the coefficients kept
+ *
+ * @param ctr model control data
+ * @param e errors in time order
+ */
+static void arUpdate(modelCtr *ctr, const VectorXd &e){
+  const int p = ctr->arLags.size();
+  const int n = ctr->n;
+  MatrixXd E = MatrixXd::Zero(n, p); // lagged errors
+  for (int k = 0; k < p; ++k) {
+    const int l = ctr->arLags(k);
+    if (l < n)
+      E.col(k).tail(n - l) = e.head(n - l);
+  }
+  const MatrixXd Ew = (ctr->Omega / ctr->sigma2).asDiagonal() * E;
+  MatrixXd A = Ew.transpose() * E;
+  A.diagonal().array() += 1.0;
+  Eigen::LLT<MatrixXd> llt(A);
+  const VectorXd z = as<VectorXd>(rnorm(p, 0, 1));
+  const VectorXd phi = llt.solve(Ew.transpose() * e) + llt.matrixU().solve(z);
+
+  // stationary if the companion matrix has all eigenvalues inside the unit circle
+  const int m = ctr->arLags.maxCoeff();
+  MatrixXd C = MatrixXd::Zero(m, m);
+  for (int k = 0; k < p; ++k)
+    C(0, ctr->arLags(k) - 1) = phi(k);
+  if (m > 1)
+    C.bottomLeftCorner(m - 1, m - 1).setIdentity();
+  Eigen::EigenSolver<MatrixXd> es(C, false);
+  if (phi.allFinite() && es.eigenvalues().cwiseAbs().maxCoeff() < 1.0)
+    ctr->arPhi = phi;
+} // end arUpdate function
+
+/**
+ * @brief draw the latent precisions lambda (Student-t errors) and the relative
+ * group variances from their full conditionals given the residuals
+ * e = Y - fhat - Z gamma and sigma2, then reweight the relative row precisions
+ * Omega = w lambda / sigma2Grp of group and the fixed-effect design Zw, Vg.
+ * sigma2 itself keeps its conjugate update in tdlmModelEst, so it still scales
+ * the tree, DLM and fixed-effect priors. Group 0 is the reference group with
+ * relative variance 1. Under autoregressive errors the coefficients are drawn
+ * first and the innovations Phi e take the place of e.
+ *
+ * @param ctr model control data
+ */
+void scaleMixUpdate(modelCtr *ctr){
+  VectorXd e = ctr->Ystar - ctr->fhat - ctr->Z * ctr->gamma;
+  if (ctr->arLags.size() > 0) {
+    arUpdate(ctr, e);
+    e = arWhiten(ctr, e);
+  }
+  const int nGrp = ctr->sigma2Grp.size();
+
+  // lambda_i ~ Gamma((df + w_i) / 2, rate (df + w_i e_i^2 / (sigma2 s_g)) / 2),
+  // a case of weight w_i counting as w_i observations
+  if (ctr->tDf > 0) {
+    for (int i = 0; i < ctr->n; ++i) {
+      const double w  = ctr->caseWeight(i);
+      const double e2 = w * e(i) * e(i) / (ctr->sigma2 * ctr->sigma2Grp(ctr->varGroup(i)));
+      ctr->lambda(i) = R::rgamma(0.5 * (ctr->tDf + w), 2.0 / (ctr->tDf + e2));
+    }
+  }
+
+  // relative variance s_g of groups 1, 2, ... with half-Cauchy prior on sqrt(s_g)
+  if (nGrp > 1) {
+    VectorXd nG = VectorXd::Zero(nGrp), ssG = VectorXd::Zero(nGrp);
+    for (int i = 0; i < ctr->n; ++i) {
+      nG(ctr->varGroup(i))  += ctr->caseWeight(i);
+      ssG(ctr->varGroup(i)) += ctr->caseWeight(i) * ctr->lambda(i) * e(i) * e(i);
+    }
+    for (int g = 1; g < nGrp; ++g)
+      rHalfCauchyFC(&(ctr->sigma2Grp(g)), nG(g), ssG(g) / ctr->sigma2, &(ctr->xiGrp(g)));
+  }
+  if (!(ctr->sigma2Grp.allFinite()) || !(ctr->lambda.allFinite())) {
+    if (ctr->nanRecover) {
+      ctr->nanFlag = true;
+      return;
+    }
+    stop("\nNaN values (sigma) occured during model run, rerun model.\n");
+  }
+
+  for (int i = 0; i < ctr->n; ++i)
+    ctr->Omega(i) = ctr->caseWeight(i) * ctr->lambda(i) / ctr->sigma2Grp(ctr->varGroup(i));
+  scaleMixDesign(ctr);
+} // end scaleMixUpdate function
+
+/**
+ * @brief record group variances sigma2 * s_g and latent precisions; the sigma2
+ * log holds the mean of the group variances (Student-t: squared scales) over
+ * observations
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ */
+void scaleMixRecord(modelCtr *ctr, tdlmLog *dgn){
+  if (!(ctr->scaleMix) || (ctr->record <= 0))
+    return;
+  double s2 = 0.0;
+  for (int i = 0; i < ctr->n; ++i)
+    s2 += ctr->sigma2Grp(ctr->varGroup(i));
+  (dgn->sigma2)(ctr->record - 1) = ctr->sigma2 * s2 / ctr->n;
+  (dgn->sigma2Grp).col(ctr->record - 1) = ctr->sigma2 * ctr->sigma2Grp;
+  dgn->lambdaMean += ctr->lambda;
+  if (ctr->arLags.size() > 0)
+    (dgn->arPhi).col(ctr->record - 1) = ctr->arPhi;
+} // end scaleMixRecord function
+
+/**
+ * @brief set up offsets, a known term of the linear predictor (Gaussian mean,
+ * binomial logit or negative binomial logit), and remove them from the
+ * working response Ystar. Call after Ystar is set for the family.
+ *
+ * @param ctr model control data
+ * @param model model settings: offset (empty for none)
+ */
+void offsetInit(modelCtr *ctr, const Rcpp::List &model){
+  const NumericVector off = model["offset"];
+  ctr->hasOffset = (off.size() == ctr->n);
+  if (!(ctr->hasOffset))
+    return;
+  ctr->offset = as<VectorXd>(off);
+  ctr->Ystar -= ctr->offset;
+} // end offsetInit function
+
+/**
+ * @brief set up grouped random effects: random intercepts and slopes with
+ * a half-Cauchy prior on the standard deviation of each column
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ * @param model model settings: reGroup (empty for none) and reZ
+ */
+void reInit(modelCtr *ctr, tdlmLog *dgn, const Rcpp::List &model){
+  const IntegerVector grp = model["reGroup"];
+  ctr->hasRE = (grp.size() == ctr->n);
+  if (!(ctr->hasRE))
+    return;
+  if (ctr->zinb)
+    stop("random effects are unavailable for zinb models");
+
+  ctr->reZ = as<MatrixXd>(model["reZ"]);
+  const int q = ctr->reZ.cols();
+  int nGrp = 0;
+  ctr->reGroup.resize(ctr->n);
+  for (int i = 0; i < ctr->n; ++i) {
+    ctr->reGroup(i) = (int) grp[i];
+    nGrp = std::max(nGrp, (int) grp[i] + 1);
+  }
+  ctr->reIdx.assign(nGrp, std::vector<int>());
+  for (int i = 0; i < ctr->n; ++i)
+    ctr->reIdx[ctr->reGroup(i)].push_back(i);
+
+  ctr->reCoef.resize(nGrp, q);        ctr->reCoef.setZero();
+  ctr->reVar.resize(q);               ctr->reVar.setOnes();
+  ctr->reXi.resize(q);                ctr->reXi.setOnes();
+  ctr->reFit.resize(ctr->n);          ctr->reFit.setZero();
+
+  (dgn->reVar).resize(q, ctr->nRec);        (dgn->reVar).setZero();
+  (dgn->reCoefMean).resize(nGrp, q);        (dgn->reCoefMean).setZero();
+} // end reInit function
+
+/**
+ * @brief draw the random effects of each group and their variances from
+ * their full conditionals, then replace the random-effect fit in Ystar and R.
+ * The design is block diagonal by group, so each group is a q x q update with
+ * precision sum_i w_i z_i z_i^T + diag(1 / reVar), w_i = Omega_i / sigma2;
+ * no matrix over all groups is formed.
+ *
+ * @param ctr model control data
+ */
+void reUpdate(modelCtr *ctr){
+  const int q = ctr->reZ.cols();
+  const int nGrp = ctr->reCoef.rows();
+  // response net of all terms but the random effects
+  const VectorXd e = ctr->Ystar + ctr->reFit - ctr->fhat - ctr->Z * ctr->gamma;
+
+  MatrixXd P(q, q);
+  VectorXd b(q);
+  for (int g = 0; g < nGrp; ++g) {
+    P.setZero();
+    b.setZero();
+    for (int i : ctr->reIdx[g]) {
+      const double w = ctr->Omega(i) / ctr->sigma2;
+      P.selfadjointView<Lower>().rankUpdate(ctr->reZ.row(i).transpose(), w);
+      b.noalias() += (w * e(i)) * ctr->reZ.row(i).transpose();
+    }
+    P.diagonal().array() += ctr->reVar.array().inverse();
+    Eigen::LLT<MatrixXd> llt(P);
+    const VectorXd z = as<VectorXd>(rnorm(q, 0, 1));
+    ctr->reCoef.row(g) = (llt.solve(b) + llt.matrixU().solve(z)).transpose();
+  }
+
+  for (int k = 0; k < q; ++k)
+    rHalfCauchyFC(&(ctr->reVar(k)), (double) nGrp, ctr->reCoef.col(k).squaredNorm(),
+                  &(ctr->reXi(k)));
+  if (!(ctr->reVar.allFinite()) || !(ctr->reCoef.allFinite())) {
+    if (ctr->nanRecover) {
+      ctr->nanFlag = true;
+      return;
+    }
+    stop("\nNaN values (random effects) occured during model run, rerun model.\n");
+  }
+
+  VectorXd reFit(ctr->n);
+  for (int i = 0; i < ctr->n; ++i)
+    reFit(i) = ctr->reZ.row(i).dot(ctr->reCoef.row(ctr->reGroup(i)));
+  ctr->Ystar += ctr->reFit - reFit;
+  ctr->reFit = reFit;
+  ctr->R = ctr->Ystar - ctr->fhat;
+} // end reUpdate function
+
+/**
+ * @brief record the random-effect variances and sum the random effects
+ *
+ * @param ctr model control data
+ * @param dgn model log
+ */
+void reRecord(modelCtr *ctr, tdlmLog *dgn){
+  if (!(ctr->hasRE) || (ctr->record <= 0))
+    return;
+  (dgn->reVar).col(ctr->record - 1) = ctr->reVar;
+  dgn->reCoefMean += ctr->reCoef;
+} // end reRecord function
+
 /**
  * @brief Construct a new progress Meter::progress Meter object
  * 
@@ -502,14 +1414,28 @@ std::string modRuleStr(Node* n, modDat* Mod){
   int splitVal = parent->nodestruct->get(2);  // What value of the parent?
   std::vector<int> splitVec = parent->nodestruct->get2(1); // Return split vector
   
-  rule += std::to_string(splitVar);       // Convert to a string and concatenate
-  if (Mod->varIsNum[splitVar]) {          // [If continuous], 
+  if (splitVar == OBLIQUE_SPLIT) {        // [If oblique], "o<vars>:<coefs>"
+    Eigen::VectorXd splitCoef = parent->nodestruct->get4(1);
+    char buf[32];
+    rule += "o";
+    for (std::size_t i = 0; i < splitVec.size(); ++i)
+      rule += (i ? "," : "") + std::to_string(splitVec[i]);
+    rule += ":";
+    for (int i = 0; i < splitCoef.size(); ++i) {
+      snprintf(buf, sizeof(buf), "%s%.17g", (i ? "," : ""), splitCoef(i));
+      rule += buf;
+    }
+    rule += (parent->c1 == n) ? "<" : ">=";
+    rule += std::to_string(splitVal);     // index of the threshold
+  } else if (Mod->varIsNum[splitVar]) {   // [If continuous], 
+    rule += std::to_string(splitVar);     // Convert to a string and concatenate
     if (parent->c1 == n)                  // If the first child node is the same as the node, (c1 = child node 1)
       rule += "<";                        // Add a rule
     else                                  
       rule += ">=";                       // Add a rule
     rule += std::to_string(splitVal);     // Add the splitting value
   } else {
+    rule += std::to_string(splitVar);
     if (parent->c1 == n)                  // [If categorical],
       rule += "[]";                       // Add a subsetting rule
     else
@@ -531,15 +1457,27 @@ std::string modRuleStr(Node* n, modDat* Mod){
  * 
  * @param tree pointer to tree
  * @param Mod pointer to modDat
- * @returns VectorXd 
+ * @param oblCount if not 0, set to the count of each modifier in oblique
+ * splits. Oblique splits pick their modifiers uniformly, not from modProb,
+ * so they are left out of the returned counts that update modProb.
+ * @returns VectorXd count of each modifier in axis-aligned splits
  */
-VectorXd countMods(Node* tree, modDat* Mod){
+VectorXd countMods(Node* tree, modDat* Mod, VectorXd *oblCount){
   VectorXd modCount(Mod->nMods);      modCount.setZero();
   VectorXd unavailProb(Mod->nMods);   unavailProb.setZero();
   std::vector<int> unavail;  
+  if (oblCount != 0) {
+    oblCount->resize(Mod->nMods);     oblCount->setZero();
+  }
 
   for (Node* tn : tree->listInternal()) {
-    modCount(tn->nodestruct->get(1)) += 1.0;
+    if (tn->nodestruct->get(1) == OBLIQUE_SPLIT) {
+      if (oblCount != 0)
+        for (int m : tn->nodestruct->get2(1))
+          (*oblCount)(m) += 1.0;
+    } else {
+      modCount(tn->nodestruct->get(1)) += 1.0;
+    }
     unavail.clear();
     unavailProb.setZero();
 
@@ -589,6 +1527,82 @@ VectorXd countMods(Node* tree, modDat* Mod){
 
 
 
+/**
+ * @brief mark modifier pairs and triples that appear together on a
+ * root-to-leaf path of the current tree
+ * 
+ * @param tree pointer to modifier tree
+ * @param ctr pointer to model control
+ */
+void countModPairs(Node* tree, dlmtreeCtr* ctr){
+  std::vector<int> path;
+  const long pM = ctr->pM;
+  for (Node* tn : tree->listTerminal()) {
+    path.clear();
+    for (Node* n = tn->parent; n != 0; n = n->parent) {
+      if (n->nodestruct->get(1) == OBLIQUE_SPLIT) {
+        for (int m : n->nodestruct->get2(1))
+          path.push_back(m);
+      } else {
+        path.push_back(n->nodestruct->get(1));
+      }
+    }
+    // a modifier split on more than once along a path is one modifier
+    std::sort(path.begin(), path.end());
+    path.erase(std::unique(path.begin(), path.end()), path.end());
+
+    int k = path.size();
+    for (int i = 0; i < k - 1; ++i) {
+      for (int j = i + 1; j < k; ++j) {
+        ctr->modPair(path[i], path[j]) = 1.0;
+        ctr->modPair(path[j], path[i]) = 1.0;
+        for (int l = j + 1; l < k; ++l)
+          ctr->modTriple.insert((path[i] * pM + path[j]) * pM + path[l]);
+      }
+    }
+  }
+} // end countModPairs function
+
+
+
+/**
+ * @brief add the modifier pairs and triples of the current iteration to
+ * the log
+ * 
+ * @param ctr pointer to model control
+ * @param dgn pointer to model log
+ */
+void recordModPairs(dlmtreeCtr* ctr, dlmtreeLog* dgn){
+  dgn->modPairCount += ctr->modPair;
+  for (long key : ctr->modTriple)
+    ++(dgn->modTripleCount[key]);
+} // end recordModPairs function
+
+
+
+/**
+ * @brief logged modifier triples as a matrix with columns
+ * (mod1, mod2, mod3, count), modifiers 0-based and sorted within row
+ * 
+ * @param dgn pointer to model log
+ * @param pM number of modifiers
+ * @returns MatrixXd 
+ */
+MatrixXd modTripleMatrix(dlmtreeLog* dgn, int pM){
+  MatrixXd out(dgn->modTripleCount.size(), 4);
+  int row = 0;
+  for (const auto& tc : dgn->modTripleCount) {
+    out(row, 0) = tc.first / ((long) pM * pM);
+    out(row, 1) = (tc.first / pM) % pM;
+    out(row, 2) = tc.first % pM;
+    out(row, 3) = tc.second;
+    ++row;
+  }
+  return(out);
+} // end modTripleMatrix function
+
+
+
 
 void updateZirtGamma(std::vector<Node*> trees, modelCtr* ctr) {
   ctr->zirtSplitCounts.setZero();
@@ -789,6 +1803,72 @@ double zeroInflatedTreeMHR(VectorXd timeProbs, std::vector<Node*> trees, int t,
   return (mhr);
 } // end zeroInflatedTreeMHR function
 
+/**
+ * @brief MHR workspaces of a tree, created on first use and kept across
+ * iterations so that their buffers are only reallocated when the number of
+ * terminal nodes changes
+ * 
+ * @param ctr pointer to model control
+ * @param t tree number
+ * @returns pointer to the pair (current, proposed) of tree t
+ */
+treeMHR* mhrPair(modelCtr* ctr, int t){
+  if (ctr->mhrWork.size() < 2 * (std::size_t) (t + 1))
+    ctr->mhrWork.resize(2 * (t + 1));
+  return(&(ctr->mhrWork[2 * t]));
+} // end mhrPair function
+
+/**
+ * @brief log prior probability of the time split rules of a DLM tree
+ * 
+ * @param inner internal nodes of the tree
+ * @returns sum over time splits of log(Tp(tsplit) / sum of Tp in node window)
+ */
+static double dlmTimeRulePrior(const std::vector<Node*> &inner){
+  double logPrior = 0.0;
+  for (Node* n : inner) {
+    const int ts = n->nodestruct->get(6);
+    if (ts == 0)
+      continue;
+    const int tmin = n->nodestruct->get(3);
+    const int tmax = n->nodestruct->get(4);
+    const VectorXd Tp = n->nodestruct->getTimeProbs();
+    logPrior += log(Tp(ts - 1)) - log(Tp.segment(tmin - 1, tmax - tmin).sum());
+  }
+  return(logPrior);
+} // end dlmTimeRulePrior function
+
+/**
+ * @brief move a DLM tree onto the lag window of another exposure (ragged
+ * mixtures): the root takes the window and time split probabilities of the
+ * exposure's root structure, which are then passed down the tree
+ * 
+ * @param tree DLM tree
+ * @param expNS root structure of the new exposure
+ * @param logPrior log prior ratio of the time split rules, new to old (output)
+ * @returns 0 if a time split of the tree lies outside the new window
+ */
+bool dlmSwitchWindow(Node* tree, NodeStruct* expNS, double &logPrior){
+  logPrior = 0.0;
+  const int tmax      = expNS->get(4);
+  const VectorXd Tp   = expNS->getTimeProbs();
+  const VectorXd Tp0  = tree->nodestruct->getTimeProbs();
+  if ((tree->nodestruct->get(4) == tmax) && (Tp0.size() == Tp.size()) && (Tp0 == Tp))
+    return(1);
+
+  std::vector<Node*> inner = tree->listInternal();
+  for (Node* n : inner)
+    if (n->nodestruct->get(6) >= tmax)
+      return(0);
+
+  logPrior -= dlmTimeRulePrior(inner);
+  tree->nodestruct->setTimeRange(1, tmax);
+  tree->nodestruct->setTimeProbs(Tp);
+  tree->updateStruct();
+  logPrior += dlmTimeRulePrior(inner);
+  return(1);
+} // end dlmSwitchWindow function
+
 /**
  * @brief update design matrices for subgroup Gaussian process DLM
  * 
@@ -799,9 +1879,9 @@ void updateGPMats(Node* n, dlmtreeCtr* ctr){
   if (n->nodevals->updateXmat == 0)
     return;
   if (n->depth == 0) {
-    n->nodevals->XtX        = ctr->XtXall;
-    n->nodevals->ZtXmat     = ctr->ZtXall;
-    n->nodevals->VgZtXmat   = ctr->VgZtXall;
+    n->nodevals->XtX()        = ctr->XtXall;
+    n->nodevals->ZtXmat()     = ctr->ZtXall;
+    n->nodevals->VgZtXmat()   = ctr->VgZtXall;
     n->nodevals->updateXmat = 0;
     return;
   }
@@ -826,19 +1906,19 @@ void updateGPMats(Node* n, dlmtreeCtr* ctr){
   }
   
   if (n->nodevals->idx.size() <= sib->nodevals->idx.size()) {
-    n->nodevals->XtX        = Xtemp.transpose() * Xtemp;
-    n->nodevals->ZtXmat     = Ztemp.transpose() * Xtemp;
-    n->nodevals->VgZtXmat   = ctr->Vg * n->nodevals->ZtXmat;
-    sib->nodevals->XtX      = par->nodevals->XtX - n->nodevals->XtX;
-    sib->nodevals->ZtXmat   = par->nodevals->ZtXmat - n->nodevals->ZtXmat;
-    sib->nodevals->VgZtXmat = par->nodevals->VgZtXmat - n->nodevals->VgZtXmat;
+    n->nodevals->XtX()        = Xtemp.transpose() * Xtemp;
+    n->nodevals->ZtXmat()     = Ztemp.transpose() * Xtemp;
+    n->nodevals->VgZtXmat()   = ctr->Vg * n->nodevals->ZtXmat();
+    sib->nodevals->XtX()      = par->nodevals->XtX() - n->nodevals->XtX();
+    sib->nodevals->ZtXmat()   = par->nodevals->ZtXmat() - n->nodevals->ZtXmat();
+    sib->nodevals->VgZtXmat() = par->nodevals->VgZtXmat() - n->nodevals->VgZtXmat();
   } else {
-    sib->nodevals->XtX      = Xtemp.transpose() * Xtemp;
-    sib->nodevals->ZtXmat   = Ztemp.transpose() * Xtemp;
-    sib->nodevals->VgZtXmat = ctr->Vg * sib->nodevals->ZtXmat;
-    n->nodevals->XtX        = par->nodevals->XtX - sib->nodevals->XtX;
-    n->nodevals->ZtXmat     = par->nodevals->ZtXmat - sib->nodevals->ZtXmat;
-    n->nodevals->VgZtXmat   = par->nodevals->VgZtXmat - sib->nodevals->VgZtXmat;
+    sib->nodevals->XtX()      = Xtemp.transpose() * Xtemp;
+    sib->nodevals->ZtXmat()   = Ztemp.transpose() * Xtemp;
+    sib->nodevals->VgZtXmat() = ctr->Vg * sib->nodevals->ZtXmat();
+    n->nodevals->XtX()        = par->nodevals->XtX() - sib->nodevals->XtX();
+    n->nodevals->ZtXmat()     = par->nodevals->ZtXmat() - sib->nodevals->ZtXmat();
+    n->nodevals->VgZtXmat()   = par->nodevals->VgZtXmat() - sib->nodevals->VgZtXmat();
   }
   n->nodevals->updateXmat   = 0;
   sib->nodevals->updateXmat = 0;
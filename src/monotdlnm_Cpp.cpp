@@ -27,9 +27,8 @@ using Eigen::MatrixXd;
 using Eigen::Lower;
 
 
-treeMHR monoDlnmMHR(std::vector<Node*> dlnmTerm, tdlmCtr* ctr, VectorXd ZtR, double treevar, Node* tree, bool updateNested)
+void monoDlnmMHR(const std::vector<Node*> &dlnmTerm, tdlmCtr* ctr, const VectorXd &ZtR, double treevar, Node* tree, bool updateNested, treeMHR &out)
 {
-  treeMHR out;
   int totTerm = 0;
   std::vector<std::vector<std::pair<int, Node*> > > nestedTerm;
   for (Node* eta : dlnmTerm) {
@@ -54,7 +53,7 @@ treeMHR monoDlnmMHR(std::vector<Node*> dlnmTerm, tdlmCtr* ctr, VectorXd ZtR, dou
     out.termT2        = 0.0;
     out.totTerm       = 0.0;
 
-    return(out);
+    return;
   }
   
   out.Xd.resize(ctr->n, totTerm);     out.Xd.setZero();
@@ -134,8 +133,6 @@ treeMHR monoDlnmMHR(std::vector<Node*> dlnmTerm, tdlmCtr* ctr, VectorXd ZtR, dou
   out.logVThetaChol = VThetaChol.diagonal().array().log().sum();
   out.termT2        = out.draw.dot(out.draw);
   out.totTerm       = (double) totTerm;
-
-  return(out);
 }
 
 
@@ -160,7 +157,8 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
   double treevar  = ctr->nu * ctr->tau(t);
   std::vector<Node*> dlnmTerm, newDlnmTerm, nestedTerm;
   Node* nestedTree;
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
   
   // List current tree terminal nodes
   dlnmTerm = tree->listTerminal();
@@ -178,9 +176,9 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
   }
   
   if (tree->nodevals->tempV.rows() > 0)
-    mhr0 = monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 0);
+    monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 0, mhr0);
   else
-    mhr0 = monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 1);
+    monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 1, mhr0);
     
   if (success && (stepMhr == stepMhr)) {
     newDlnmTerm = tree->listTerminal(1);
@@ -221,7 +219,7 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
       } // end loop over terminal nodes
     } // end if change proposal
     
-    mhr = monoDlnmMHR(newDlnmTerm, ctr, ZtR, treevar, tree, 1);
+    monoDlnmMHR(newDlnmTerm, ctr, ZtR, treevar, tree, 1, mhr);
     
     // combine mhr parts into log-MH ratio
     ratio = stepMhr + (mhr.logVThetaChol - mhr0.logVThetaChol) +
@@ -232,7 +230,7 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
       Rcout << " ratio = " << ratio;
     
     if (log(R::runif(0, 1)) < ratio) {
-      mhr0 = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       tree->accept();
       dlnmTerm = tree->listTerminal();
@@ -271,7 +269,7 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
     }
       
     // calculate MHR
-    mhr   = monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 1);
+    monoDlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 1, mhr);
     ratio = (mhr.logVThetaChol - mhr0.logVThetaChol) +
       (0.5 * (mhr.beta - mhr0.beta) * (1 / ctr->sigma2)) -
       (log(4 * ctr->sigma2 * treevar) * 0.5 * (mhr.totTerm - mhr0.totTerm)) +
@@ -282,7 +280,7 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
     }
     
     if ((log(R::runif(0, 1)) < ratio) && (ratio == ratio)) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       tree->accept();
       tree->nodevals->nestedTree->accept();
@@ -309,7 +307,7 @@ void monoTDLNMTreeUpdate(int t, Node* tree, tdlmCtr* ctr, tdlmLog* dgn, exposure
   ctr->nTerm(t)     = mhr0.totTerm;
   ctr->totTerm      += mhr0.totTerm;
   ctr->sumTermT2    += mhr0.termT2 / ctr->tau(t);
-  ctr->Rmat.col(t)  = mhr0.Xd * mhr0.draw;
+  rmatSet(ctr, t, mhr0.Xd * mhr0.draw);
   mhr0.draw         = mhr0.Dtrans * mhr0.draw;
   
   if (ctr->debug)
@@ -376,6 +374,8 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
   ctr->shrinkage    = as<int>(model["shrinkage"]);
   ctr->verbose      = as<bool>(model["verbose"]);
   ctr->diagnostics  = as<bool>(model["diagnostics"]);
+  ctr->floatRmat    = as<bool>(model["floatRmat"]);
+  ctr->resyncEvery  = as<int>(model["resyncEvery"]);
   
   // * Set up model data
   ctr->Y0         = as<VectorXd>(model["Y"]);
@@ -494,7 +494,7 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
   }
   delete nsT;
   ctr->nTerm.resize(ctr->nTrees);                   ctr->nTerm.setOnes();
-  ctr->Rmat.resize(ctr->n, ctr->nTrees);            ctr->Rmat.setZero();
+  rmatInit(ctr);
   
   // * Setup model logs
   tdlmLog *dgn = new tdlmLog;
@@ -509,6 +509,7 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
   dgn->kappa.resize(ctr->nRec);                     dgn->kappa.setZero();
   dgn->timeProbs.resize(ctr->pX - 1, ctr->nRec);    dgn->timeProbs.setZero();
   dgn->zirtSplitCounts.resize(ctr->pX, ctr->nRec);  dgn->zirtSplitCounts.setZero();
+  ppcInit(&(dgn->ppc), ctr, model);
   VectorXd Yhat(ctr->n); Yhat.setZero();
   
   // * Initial values and draws
@@ -557,22 +558,18 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
     }
     
     // * Update trees
-    ctr->R += ctr->Rmat.col(0);
+    backfitStart(ctr);
     ctr->totTerm    = 0.0; 
     ctr->sumTermT2  = 0.0;
-    ctr->fhat.setZero();
     for (t = 0; t < ctr->nTrees; t++) {
       if (ctr->debug)
         Rcout << "\n" << t << ":";
       monoTDLNMTreeUpdate(t, trees[t], ctr, dgn, Exp, nsX);
-      ctr->fhat += ctr->Rmat.col(t);
-      if (t < ctr->nTrees - 1){
-        ctr->R += ctr->Rmat.col(t + 1) - ctr->Rmat.col(t);
-      }
+      backfitNext(ctr, t);
     } // end update trees
 
     // * Update model
-    ctr->R = ctr->Ystar - ctr->fhat;
+    backfitEnd(ctr);
     tdlmModelEst(ctr);
 
     rHalfCauchyFC(&(ctr->nu), ctr->totTerm, ctr->sumTermT2 / ctr->sigma2);
@@ -615,6 +612,7 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
       dgn->timeProbs.col(ctr->record -1)        = trees[0]->nodestruct->getTimeProbs();
       dgn->zirtSplitCounts.col(ctr->record - 1) = ctr->zirtSplitCounts;
       Yhat += ctr->fhat + ctr->Z * ctr->gamma;
+      ppcRecord(&(dgn->ppc), ctr);
     }
     
     // * Update progress
@@ -636,6 +634,9 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
   MatrixXd timeProbs = (dgn->timeProbs).transpose();
   MatrixXd zirtSplitCounts = (dgn->zirtSplitCounts).transpose();
   VectorXd YhatOut = Yhat / ctr->nRec;
+  Rcpp::List ppc;
+  if (dgn->ppc.active)
+    ppc = ppcSummary(&(dgn->ppc), ctr->nRec);
   delete prog;
   delete dgn;
   delete Exp;
@@ -644,7 +645,7 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
 
   // delete ctr; // Cannot delete this for some reason?
 
-  return(Rcpp::List::create(
+  Rcpp::List out = Rcpp::List::create(
     Named("TreeStructs")      = wrap(DLM),
     Named("fhat")             = wrap(fhat),
     Named("sigma2")           = wrap(sigma2),
@@ -656,5 +657,15 @@ Rcpp::List monotdlnm_Cpp(const Rcpp::List model)
     Named("gamma")            = wrap(gamma),
     Named("zirtGamma")        = wrap(zirtGamma),
     Named("timeProbs")        = wrap(timeProbs),
-    Named("zirtSplitCounts")  = wrap(zirtSplitCounts)));
+    Named("zirtSplitCounts")  = wrap(zirtSplitCounts));
+
+  // Posterior predictive checks
+  if (ppc.size() > 0)
+    out["ppc"] = ppc;
+
+  // Largest deviation of the running residual from its exact value
+  if (ctr->floatRmat || (ctr->resyncEvery > 0))
+    out["residDrift"] = wrap(ctr->residDrift);
+
+  return(out);
 } // end function monotdlnm_Cpp
@@ -0,0 +1,216 @@
+/**
+ * @file postPredCheck.cpp
+ * @brief Posterior predictive checks from outcomes replicated during the MCMC
+ * @version 1.0
+ *
+ * At each record a replicate y_rep is drawn from the current state: the
+ * linear predictor and sigma2 (Gaussian; group variances and the Student-t
+ * degrees of freedom for scale mixtures), binomialSize (binomial), or the
+ * at-risk probability, count predictor and dispersion r (ZINB). Only the
+ * discrepancy statistics of each replicate are kept, so memory is
+ * (statistics x records) rather than (n x records). Posterior predictive
+ * p-values P(T(y_rep) >= T(y)) are accumulated as replicates are drawn.
+ */
+#include <RcppEigen.h>
+#include "modelCtr.h"
+#include <algorithm>
+#include <cstdio>
+using namespace Rcpp;
+
+enum ppcStat { PPC_MEAN, PPC_SD, PPC_MIN, PPC_MAX, PPC_ZERO, PPC_DISP,
+               PPC_QUANT, PPC_GROUP };
+
+/**
+ * @brief statistics of an outcome vector
+ *
+ * @param ppc posterior predictive check log
+ * @param y outcome (reordered by quantiles)
+ * @param out statistics
+ */
+static void ppcStatistics(ppcLog *ppc, VectorXd &y, Eigen::Ref<VectorXd> out)
+{
+  const int n = y.size();
+  const double mu = y.mean();
+  const double var = (y.array() - mu).square().sum() / (n - 1);
+  VectorXd gSum, gCnt;
+  for (std::size_t k = 0; k < ppc->type.size(); ++k) {
+    switch (ppc->type[k]) {
+      case PPC_MEAN: out(k) = mu;                          break;
+      case PPC_SD:   out(k) = sqrt(var);                   break;
+      case PPC_MIN:  out(k) = y.minCoeff();                break;
+      case PPC_MAX:  out(k) = y.maxCoeff();                break;
+      case PPC_ZERO: out(k) = (y.array() == 0.0).cast<double>().mean(); break;
+      case PPC_DISP: out(k) = var / mu;                    break;
+      case PPC_QUANT: { // type 7 quantile
+        const double h = (n - 1) * ppc->param[k];
+        const int lo = (int) floor(h);
+        std::nth_element(y.data(), y.data() + lo, y.data() + n);
+        const double xlo = y(lo);
+        out(k) = (lo + 1 < n) ?
+          xlo + (h - lo) * (*std::min_element(y.data() + lo + 1, y.data() + n) - xlo) : xlo;
+        break;
+      }
+      case PPC_GROUP: {
+        if (gSum.size() == 0) {
+          gSum = VectorXd::Zero(ppc->nGroup);
+          gCnt = VectorXd::Zero(ppc->nGroup);
+          for (int i = 0; i < n; ++i) {
+            gSum(ppc->group(i)) += y(i);
+            gCnt(ppc->group(i)) += 1.0;
+          }
+        }
+        const int g = (int) ppc->param[k];
+        out(k) = (gCnt(g) > 0) ? gSum(g) / gCnt(g) : NA_REAL;
+        break;
+      }
+    }
+  }
+}
+
+/**
+ * @brief set up posterior predictive checks from the model settings
+ *
+ * @param ppc posterior predictive check log
+ * @param ctr model control data
+ * @param model model settings: ppcStats, ppcProbs, ppcGroup, Y, Ymean and Yscale
+ */
+void ppcInit(ppcLog *ppc, modelCtr *ctr, const Rcpp::List &model)
+{
+  const CharacterVector stats = model["ppcStats"];
+  ppc->active = (stats.size() > 0);
+  if (!ppc->active)
+    return;
+
+  const NumericVector probs = model["ppcProbs"];
+  const IntegerVector group = model["ppcGroup"];
+  ppc->shift  = as<double>(model["Ymean"]);
+  ppc->scale  = as<double>(model["Yscale"]);
+  ppc->nGroup = 0;
+  ppc->group  = VectorXi::Zero(ctr->n);
+  for (int s = 0; s < stats.size(); ++s) {
+    if ((as<std::string>(stats[s]) == "group") && (group.size() != ctr->n))
+      stop("`ppc.group` has " + std::to_string(group.size()) +
+           " values but the model has " + std::to_string(ctr->n) + " observations");
+  }
+  if (group.size() == ctr->n) {
+    for (int i = 0; i < ctr->n; ++i) {
+      ppc->group(i) = (int) group[i];
+      ppc->nGroup   = std::max(ppc->nGroup, (int) group[i] + 1);
+    }
+  }
+
+  char buf[32];
+  for (int s = 0; s < stats.size(); ++s) {
+    const std::string name = as<std::string>(stats[s]);
+    if (name == "quantile") {
+      for (int j = 0; j < probs.size(); ++j) {
+        snprintf(buf, sizeof(buf), "q%g", probs[j]);
+        ppc->stats.push_back(buf);
+        ppc->type.push_back(PPC_QUANT);
+        ppc->param.push_back(probs[j]);
+      }
+    } else if (name == "group") {
+      for (int g = 0; g < ppc->nGroup; ++g) {
+        snprintf(buf, sizeof(buf), "group%d", g + 1);
+        ppc->stats.push_back(buf);
+        ppc->type.push_back(PPC_GROUP);
+        ppc->param.push_back(g);
+      }
+    } else {
+      const char *names[] = {"mean", "sd", "min", "max", "zero", "dispersion"};
+      int code = -1;
+      for (int c = 0; c < 6; ++c)
+        if (name == names[c])
+          code = c;
+      if (code < 0)
+        stop("unknown posterior predictive statistic: " + name);
+      ppc->stats.push_back(name);
+      ppc->type.push_back(code);
+      ppc->param.push_back(0.0);
+    }
+  }
+
+  const int nStat = ppc->stats.size();
+  VectorXd y = ppc->shift + ppc->scale * as<VectorXd>(model["Y"]).array();
+  ppc->obs.resize(nStat);
+  ppcStatistics(ppc, y, ppc->obs);
+  ppc->rep.resize(nStat, ctr->nRec);    ppc->rep.setZero();
+  ppc->nGreater.resize(nStat);          ppc->nGreater.setZero();
+}
+
+/**
+ * @brief draw a replicated outcome from the current state and record its
+ * statistics
+ *
+ * @param ppc posterior predictive check log
+ * @param ctr model control data
+ */
+void ppcRecord(ppcLog *ppc, modelCtr *ctr)
+{
+  if (!(ppc->active) || (ctr->record <= 0))
+    return;
+
+  const int n = ctr->n;
+  VectorXd yRep(n);
+  if (ctr->zinb) {
+    // at-risk zero with prob. logit(Z1 b1), otherwise negative binomial with
+    // success prob. psi = logit(Z b2 + f), i.e. mean r * exp(Z b2 + f)
+    const VectorXd eta1 = ctr->Z1 * ctr->b1;
+    VectorXd eta2 = ctr->Z * ctr->b2 + ctr->fhat;
+    if (ctr->hasOffset)
+      eta2 += ctr->offset;
+    for (int i = 0; i < n; ++i) {
+      const double p1  = 1.0 / (1.0 + exp(-eta1(i)));
+      const double psi = 1.0 / (1.0 + exp(-eta2(i)));
+      yRep(i) = (R::runif(0, 1) < p1) ? 0.0 : R::rnbinom(ctr->r, 1.0 - psi);
+    }
+  } else {
+    VectorXd eta = ctr->fhat + ctr->Z * ctr->gamma;
+    if (ctr->hasOffset)
+      eta += ctr->offset;
+    if (ctr->hasRE)
+      eta += ctr->reFit;
+    if (ctr->binomial) {
+      for (int i = 0; i < n; ++i)
+        yRep(i) = R::rbinom(ctr->binomialSize(i), 1.0 / (1.0 + exp(-eta(i))));
+    } else if (ctr->scaleMix) { // Student-t, group-specific, weighted or AR errors
+      VectorXd err(n);
+      for (int i = 0; i < n; ++i) {
+        const double sd = sqrt(ctr->sigma2 * ctr->sigma2Grp(ctr->varGroup(i)) / ctr->caseWeight(i));
+        err(i) = sd * ((ctr->tDf > 0) ? R::rt(ctr->tDf) : R::rnorm(0.0, 1.0));
+        for (int k = 0; k < ctr->arLags.size(); ++k)
+          if (i >= ctr->arLags(k))
+            err(i) += ctr->arPhi(k) * err(i - ctr->arLags(k));
+        yRep(i) = ppc->shift + ppc->scale * (eta(i) + err(i));
+      }
+    } else {
+      const double sd = sqrt(ctr->sigma2);
+      for (int i = 0; i < n; ++i)
+        yRep(i) = ppc->shift + ppc->scale * R::rnorm(eta(i), sd);
+    }
+  }
+
+  Eigen::Ref<VectorXd> t = ppc->rep.col(ctr->record - 1);
+  ppcStatistics(ppc, yRep, t);
+  for (int k = 0; k < t.size(); ++k)
+    if (t(k) >= ppc->obs(k))
+      ppc->nGreater(k) += 1.0;
+}
+
+/**
+ * @brief summarize posterior predictive checks for R
+ *
+ * @param ppc posterior predictive check log
+ * @param nRec number of completed records
+ * @return list of statistic names, observed statistics, replicate statistics
+ * (records x statistics) and posterior predictive p-values
+ */
+Rcpp::List ppcSummary(ppcLog *ppc, int nRec)
+{
+  const MatrixXd rep = ppc->rep.leftCols(nRec).transpose();
+  const VectorXd pValue = ppc->nGreater / (double) std::max(nRec, 1);
+  return(Rcpp::List::create(Named("stat")     = wrap(ppc->stats),
+                            Named("observed") = wrap(ppc->obs),
+                            Named("rep")      = wrap(rep),
+                            Named("pValue")   = wrap(pValue)));
+}
@@ -0,0 +1,200 @@
+/**
+ * @file shinyBackend.cpp
+ * @brief Precomputed lookup of HDLM/HDLMM lag effects for the shiny apps
+ * @version 1.0
+ *
+ * Terminal node estimates are grouped by their (interned) modifier rule
+ * once, when the app starts. A query then only evaluates each rule on the
+ * requested modifier values as a bitset and adds the estimates of matching
+ * rules to per-iteration lag effects.
+ */
+#include <RcppEigen.h>
+#include <algorithm>
+#include <bitset>
+#include <cstdint>
+using namespace Rcpp;
+
+/**
+ * @brief quantile of x matching R's default (type 7), reorders x
+ *
+ * @param x values
+ * @param p probability
+ */
+static double quantile7(std::vector<double> &x, double p)
+{
+  double h = (x.size() - 1) * p;
+  size_t lo = (size_t) floor(h);
+  std::nth_element(x.begin(), x.begin() + lo, x.end());
+  double xlo = x[lo];
+  if (lo + 1 >= x.size())
+    return(xlo);
+  double xhi = *std::min_element(x.begin() + lo + 1, x.end());
+  return(xlo + (h - lo) * (xhi - xlo));
+}
+
+/**
+ * @brief posterior mean and interval of each lag over iterations
+ *
+ * @param draws iterations x lags (column-major)
+ * @param nIter number of iterations
+ * @param pExp number of lags
+ * @param level interval level
+ * @param row output row
+ * @param est, lower, upper outputs
+ */
+static void summarizeDraws(const std::vector<double> &draws, int nIter, int pExp,
+                           double level, int row, NumericMatrix &est,
+                           NumericMatrix &lower, NumericMatrix &upper)
+{
+  std::vector<double> col(nIter);
+  for (int t = 0; t < pExp; ++t) {
+    double s = 0.0;
+    for (int i = 0; i < nIter; ++i) {
+      col[i] = draws[t * nIter + i];
+      s += col[i];
+    }
+    est(row, t)   = s / nIter;
+    lower(row, t) = quantile7(col, (1.0 - level) / 2.0);
+    upper(row, t) = quantile7(col, 1.0 - (1.0 - level) / 2.0);
+  }
+}
+
+//' Group terminal node estimates by modifier rule for shiny apps
+//'
+//' @param ruleId rule index of each terminal node (0-based)
+//' @param iter MCMC iteration of each terminal node (1-based)
+//' @param exp exposure of each terminal node (0-based)
+//' @param tmin first lag of each terminal node (1-based)
+//' @param tmax last lag of each terminal node (1-based)
+//' @param est estimate of each terminal node
+//' @param nRules number of unique rules
+//' @returns A list of terminal node data sorted by rule with rule offsets
+//' @export
+// [[Rcpp::export]]
+Rcpp::List shinyBackendBuild(const IntegerVector ruleId, const IntegerVector iter,
+                             const IntegerVector exp, const IntegerVector tmin,
+                             const IntegerVector tmax, const NumericVector est,
+                             int nRules)
+{
+  int nTerm = ruleId.size();
+  IntegerVector rulePtr(nRules + 1);
+  for (int i = 0; i < nTerm; ++i)
+    ++rulePtr[ruleId[i] + 1];
+  for (int r = 0; r < nRules; ++r)
+    rulePtr[r + 1] += rulePtr[r];
+
+  IntegerVector sIter(nTerm), sExp(nTerm), sTmin(nTerm), sTmax(nTerm);
+  NumericVector sEst(nTerm);
+  std::vector<int> pos(rulePtr.begin(), rulePtr.end() - 1);
+  for (int i = 0; i < nTerm; ++i) {
+    int k = pos[ruleId[i]]++;
+    sIter[k] = iter[i];
+    sExp[k]  = exp[i];
+    sTmin[k] = tmin[i];
+    sTmax[k] = tmax[i];
+    sEst[k]  = est[i];
+  }
+
+  return(Rcpp::List::create(Named("rulePtr") = rulePtr,
+                            Named("iter")    = sIter,
+                            Named("exp")     = sExp,
+                            Named("tmin")    = sTmin,
+                            Named("tmax")    = sTmax,
+                            Named("est")     = sEst));
+}
+
+//' Individual or subgroup lag effects from a shiny backend
+//'
+//' @param backend A list created by shinyBackend
+//' @param atoms logical matrix of modifier conditions (rows x conditions)
+//' @param exposure exposure index (0-based), or -1 for all terminal nodes
+//' @param level credible interval level
+//' @param average if TRUE return the effect averaged over rows
+//' @returns A list of posterior mean, lower and upper matrices (rows x lags)
+//' @export
+// [[Rcpp::export]]
+Rcpp::List shinyBackendQuery_Cpp(const Rcpp::List backend, const LogicalMatrix atoms,
+                                 int exposure, double level, bool average)
+{
+  const IntegerVector rulePtr = backend["rulePtr"];
+  const IntegerVector iter    = backend["iter"];
+  const IntegerVector exp     = backend["exp"];
+  const IntegerVector tmin    = backend["tmin"];
+  const IntegerVector tmax    = backend["tmax"];
+  const NumericVector est     = backend["est"];
+  const IntegerVector atomPtr = backend["ruleAtomPtr"];
+  const IntegerVector atomIdx = backend["ruleAtomIdx"];
+  const int nIter  = as<int>(backend["mcmcIter"]);
+  const int pExp   = as<int>(backend["pExp"]);
+  const int nRules = rulePtr.size() - 1;
+  const int nRows  = atoms.nrow();
+  const int nAtoms = atoms.ncol();
+  const int nW     = (nRows + 63) / 64;
+
+  // * Bitsets of modifier conditions and rules over the query rows
+  std::vector<uint64_t> atomBits((size_t) nAtoms * nW, 0);
+  for (int a = 0; a < nAtoms; ++a)
+    for (int i = 0; i < nRows; ++i)
+      if (atoms(i, a) == TRUE)
+        atomBits[(size_t) a * nW + i / 64] |= (uint64_t(1) << (i % 64));
+
+  std::vector<uint64_t> ruleBits((size_t) nRules * nW);
+  for (int r = 0; r < nRules; ++r) {
+    uint64_t *rb = &ruleBits[(size_t) r * nW];
+    for (int w = 0; w < nW; ++w)
+      rb[w] = ~uint64_t(0);
+    if (nRows % 64)
+      rb[nW - 1] = (uint64_t(1) << (nRows % 64)) - 1;
+    for (int k = atomPtr[r]; k < atomPtr[r + 1]; ++k) {
+      const uint64_t *ab = &atomBits[(size_t) atomIdx[k] * nW];
+      for (int w = 0; w < nW; ++w)
+        rb[w] &= ab[w];
+    }
+  }
+
+  // * Accumulate lag effects by iteration using differences over lags
+  auto addRule = [&](int r, double wt, std::vector<double> &diff) {
+    for (int k = rulePtr[r]; k < rulePtr[r + 1]; ++k) {
+      if ((exposure >= 0) && (exp[k] != exposure))
+        continue;
+      diff[(tmin[k] - 1) * nIter + iter[k] - 1] += wt * est[k];
+      diff[tmax[k] * nIter + iter[k] - 1]       -= wt * est[k];
+    }
+  };
+  auto cumulate = [&](std::vector<double> &diff) {
+    for (int t = 1; t < pExp; ++t)
+      for (int i = 0; i < nIter; ++i)
+        diff[t * nIter + i] += diff[(t - 1) * nIter + i];
+  };
+
+  int nOut = average ? 1 : nRows;
+  NumericMatrix outEst(nOut, pExp), outLower(nOut, pExp), outUpper(nOut, pExp);
+  std::vector<double> diff((size_t) (pExp + 1) * nIter);
+
+  if (average) { // each rule weighted by the share of rows it covers
+    std::fill(diff.begin(), diff.end(), 0.0);
+    for (int r = 0; r < nRules; ++r) {
+      int cnt = 0;
+      for (int w = 0; w < nW; ++w)
+        cnt += std::bitset<64>(ruleBits[(size_t) r * nW + w]).count();
+      if (cnt > 0)
+        addRule(r, double(cnt) / nRows, diff);
+    }
+    cumulate(diff);
+    summarizeDraws(diff, nIter, pExp, level, 0, outEst, outLower, outUpper);
+  } else {
+    for (int i = 0; i < nRows; ++i) {
+      std::fill(diff.begin(), diff.end(), 0.0);
+      uint64_t mask = uint64_t(1) << (i % 64);
+      for (int r = 0; r < nRules; ++r)
+        if (ruleBits[(size_t) r * nW + i / 64] & mask)
+          addRule(r, 1.0, diff);
+      cumulate(diff);
+      summarizeDraws(diff, nIter, pExp, level, i, outEst, outLower, outUpper);
+    }
+  }
+
+  return(Rcpp::List::create(Named("est")   = outEst,
+                            Named("lower") = outLower,
+                            Named("upper") = outUpper));
+}
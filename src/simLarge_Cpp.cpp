@@ -0,0 +1,287 @@
+/**
+ * @file simLarge_Cpp.cpp
+ * @brief Chunked, multi-threaded data simulator for large benchmark data sets
+ * @version 1.0
+ *
+ * Rows are generated in fixed-size chunks. Each chunk has its own random
+ * stream seeded from (seed, chunk index), so output is reproducible for a
+ * given seed regardless of the number of threads. Exposures are either
+ * returned in memory or streamed to a binary file one batch of chunks at a
+ * time. When streaming, exposure memory is bounded by one batch of
+ * nThreads * chunkSize rows of nExp * lags values, so it does not grow with n
+ * (it still grows with the number of lags and exposures).
+ */
+#include <RcppEigen.h>
+#include <random>
+#include <fstream>
+#ifdef _OPENMP
+  #include <omp.h>
+#endif
+using namespace Rcpp;
+using Eigen::VectorXd;
+using Eigen::MatrixXd;
+using Eigen::VectorXi;
+
+/**
+ * @brief effect terms of a simulation scenario
+ */
+struct simTerms {
+  // Main effects: sum_t w_t g(x_t) for exposure mainExp
+  VectorXi mainExp, mainGate, mainScale, mainFun;
+  VectorXd mainPar;
+  MatrixXd mainW;
+  // Interactions: coef * (w1' x_k1) * (w2' x_k2)
+  VectorXi intExp1, intExp2, intGate;
+  VectorXd intCoef;
+  MatrixXd intW1, intW2;
+};
+
+/**
+ * @brief subgroup defined by the simulated modifiers
+ *
+ * @param gate 0: all, 1: mod_num > 0 & mod_bin = 1, 2: mod_num > 0 & mod_bin = 0,
+ * 3: mod_num <= 0, 4: mod_num > 0
+ * @param modNum continuous modifier
+ * @param modBin binary modifier
+ * @return true if the observation is in the subgroup
+ */
+static inline bool simGate(int gate, double modNum, double modBin)
+{
+  switch (gate) {
+    case 1: return((modNum > 0) && (modBin == 1));
+    case 2: return((modNum > 0) && (modBin == 0));
+    case 3: return(modNum <= 0);
+    case 4: return(modNum > 0);
+    default: return(true);
+  }
+}
+
+/**
+ * @brief exposure-response function
+ *
+ * @param fun 0: x - par, 1: 1{x > par}, 2: logistic 1 / (1 + exp(5(x - par))) - 1
+ * @param x exposure value
+ * @param par location parameter
+ */
+static inline double simFun(int fun, double x, double par)
+{
+  switch (fun) {
+    case 1: return(double(x > par));
+    case 2: return(1.0 / (1.0 + exp(5.0 * (x - par))) - 1.0);
+    default: return(x - par);
+  }
+}
+
+static inline double simLogistic(double x) { return(1.0 / (1.0 + exp(-x))); }
+
+//' Chunked parallel simulator for large data sets
+//'
+//' @param sim A list of scenario settings and effect terms built by sim.large
+//' @returns A list of simulated outcomes, covariates, modifiers and exposures
+//' (or the file they were written to)
+//' @export
+// [[Rcpp::export]]
+Rcpp::List simLarge_Cpp(const Rcpp::List sim)
+{
+  const int n       = as<int>(sim["n"]);
+  const int nExp    = as<int>(sim["nExp"]);
+  const int L       = as<int>(sim["lags"]);
+  const int P       = nExp * L;
+  const int nC      = as<int>(sim["nC"]);
+  const int nB      = as<int>(sim["nB"]);
+  const int pZ      = nC + nB;
+  const int family  = as<int>(sim["family"]); // 0 gaussian, 1 binomial, 2 zinb
+  const int chunk   = std::max(1, as<int>(sim["chunkSize"]));
+  const unsigned int seed = as<unsigned int>(sim["seed"]);
+  const std::string file = as<std::string>(sim["file"]);
+  const bool toFile = (file.size() > 0);
+  int nThreads = as<int>(sim["nThreads"]);
+
+  const MatrixXd expChol = as<MatrixXd>(sim["expChol"]);
+  const VectorXd expMean = as<VectorXd>(sim["expMean"]);
+  if ((expChol.rows() != P) || (expChol.cols() != P) || (expMean.size() != P))
+    stop("exposure covariance must be of dimension nExp * lags");
+
+  simTerms tm;
+  tm.mainExp   = as<VectorXi>(sim["mainExp"]);
+  tm.mainGate  = as<VectorXi>(sim["mainGate"]);
+  tm.mainScale = as<VectorXi>(sim["mainScale"]);
+  tm.mainFun   = as<VectorXi>(sim["mainFun"]);
+  tm.mainPar   = as<VectorXd>(sim["mainPar"]);
+  tm.mainW     = as<MatrixXd>(sim["mainW"]);
+  tm.intExp1   = as<VectorXi>(sim["intExp1"]);
+  tm.intExp2   = as<VectorXi>(sim["intExp2"]);
+  tm.intGate   = as<VectorXi>(sim["intGate"]);
+  tm.intCoef   = as<VectorXd>(sim["intCoef"]);
+  tm.intW1     = as<MatrixXd>(sim["intW1"]);
+  tm.intW2     = as<MatrixXd>(sim["intW2"]);
+
+  const double error  = as<double>(sim["error"]);
+  const double meanP  = as<double>(sim["meanP"]);
+  const double scale  = as<double>(sim["linkScale"]);
+  const double ziInt  = as<double>(sim["ziIntercept"]);
+  const double r      = as<double>(sim["r"]);
+
+  // * Coefficients drawn once from the master stream
+  std::mt19937_64 master(seed);
+  std::normal_distribution<double> stdNorm(0.0, 1.0);
+  VectorXd params(pZ), b1(pZ);
+  for (int j = 0; j < pZ; ++j) params(j) = stdNorm(master);
+  for (int j = 0; j < pZ; ++j) b1(j) = stdNorm(master);
+  const double cMean = 0.5 * params.tail(nB).sum();
+  const double binInt = log(meanP / (1.0 - meanP));
+
+  // * Outputs
+  NumericVector y(n), f(n), w(family == 2 ? n : 0);
+  NumericMatrix Zmat(n, pZ), mods(n, 3);
+  Rcpp::List expOut(toFile ? 0 : nExp);
+  std::vector<double*> expPtr(nExp, (double*)0);
+  if (!toFile) {
+    for (int k = 0; k < nExp; ++k) {
+      NumericMatrix Xk(n, L);
+      expOut[k] = Xk;
+      expPtr[k] = REAL(Xk);
+    }
+  }
+  double *yP = REAL(y), *fP = REAL(f), *zP = REAL(Zmat), *mP = REAL(mods);
+  double *wP = (family == 2) ? REAL(w) : (double*)0;
+
+  std::ofstream out;
+  if (toFile) {
+    out.open(file.c_str(), std::ios::out | std::ios::binary | std::ios::trunc);
+    if (!out.is_open())
+      stop("could not open file for writing: " + file);
+  }
+
+#ifdef _OPENMP
+  if (nThreads <= 0)
+    nThreads = omp_get_max_threads();
+#else
+  nThreads = 1;
+#endif
+
+  // * Generate in batches of chunks, one chunk per thread at a time
+  const int nChunks = (n + chunk - 1) / chunk;
+  const int batch   = toFile ? std::max(1, nThreads) : nChunks;
+  std::vector<MatrixXd> buf(toFile ? batch : 0);
+
+  for (int c0 = 0; c0 < nChunks; c0 += batch) {
+    int c1 = std::min(nChunks, c0 + batch);
+
+    #pragma omp parallel for num_threads(nThreads) schedule(dynamic)
+    for (int ch = c0; ch < c1; ++ch) {
+      std::seed_seq ss{seed, (unsigned int) ch, 0x9e3779b9u};
+      std::mt19937_64 rng(ss);
+      std::normal_distribution<double> rnormStd(0.0, 1.0);
+      std::uniform_real_distribution<double> runifStd(0.0, 1.0);
+
+      int i0 = ch * chunk;
+      int m  = std::min(n, i0 + chunk) - i0;
+
+      // Exposures: mean + chol * z, one column per observation
+      MatrixXd Zs(P, m);
+      for (int i = 0; i < m; ++i)
+        for (int p = 0; p < P; ++p)
+          Zs(p, i) = rnormStd(rng);
+      MatrixXd X = expChol.triangularView<Eigen::Lower>() * Zs;
+      X.colwise() += expMean;
+
+      for (int i = 0; i < m; ++i) {
+        int row = i0 + i;
+
+        // Covariates and modifiers
+        double c = 0.0, eta1 = ziInt;
+        for (int j = 0; j < pZ; ++j) {
+          double z = (j < nC) ? rnormStd(rng) : double(runifStd(rng) < 0.5);
+          zP[row + j * n] = z;
+          c    += z * params(j);
+          eta1 += z * b1(j);
+        }
+        double modNum   = rnormStd(rng);
+        double modBin   = double(runifStd(rng) < 0.5);
+        double modScale = runifStd(rng);
+        mP[row] = modNum; mP[row + n] = modBin; mP[row + 2 * n] = modScale;
+
+        // Exposure effects
+        double fi = 0.0;
+        for (int a = 0; a < tm.mainExp.size(); ++a) {
+          if (!simGate(tm.mainGate(a), modNum, modBin))
+            continue;
+          const int off = tm.mainExp(a) * L;
+          double s = 0.0;
+          for (int t = 0; t < L; ++t)
+            if (tm.mainW(a, t) != 0.0)
+              s += tm.mainW(a, t) * simFun(tm.mainFun(a), X(off + t, i), tm.mainPar(a));
+          fi += tm.mainScale(a) ? s * modScale : s;
+        }
+        for (int a = 0; a < tm.intCoef.size(); ++a) {
+          if (!simGate(tm.intGate(a), modNum, modBin))
+            continue;
+          double s1 = tm.intW1.row(a).transpose().dot(X.col(i).segment(tm.intExp1(a) * L, L));
+          double s2 = tm.intW2.row(a).transpose().dot(X.col(i).segment(tm.intExp2(a) * L, L));
+          fi += tm.intCoef(a) * s1 * s2;
+        }
+        fP[row] = fi;
+
+        // Outcome
+        if (family == 1) {
+          double p = simLogistic(binInt + scale * (c - cMean + fi));
+          yP[row] = double(runifStd(rng) < p);
+        } else if (family == 2) {
+          double wi = double(runifStd(rng) < simLogistic(eta1));
+          wP[row] = wi;
+          if (wi == 1) {
+            yP[row] = 0.0;
+          } else { // negative binomial as gamma-Poisson mixture
+            double psi = simLogistic(scale * (c + fi));
+            std::gamma_distribution<double> rgam(r, psi / (1.0 - psi));
+            std::poisson_distribution<long> rpois(rgam(rng));
+            yP[row] = double(rpois(rng));
+          }
+        } else {
+          yP[row] = c + fi + sqrt(error) * rnormStd(rng);
+        }
+      } // end observation loop
+
+      // Store exposures
+      if (toFile) {
+        buf[ch - c0] = X;
+      } else {
+        for (int k = 0; k < nExp; ++k)
+          for (int t = 0; t < L; ++t)
+            for (int i = 0; i < m; ++i)
+              expPtr[k][i0 + i + t * n] = X(k * L + t, i);
+      }
+    } // end parallel chunk loop
+
+    // Stream batch in chunk order: one row of nExp * lags doubles per observation
+    if (toFile) {
+      for (int ch = c0; ch < c1; ++ch) {
+        MatrixXd &B = buf[ch - c0];
+        out.write(reinterpret_cast<const char*>(B.data()),
+                  sizeof(double) * B.size());
+        B.resize(0, 0);
+      }
+      if (!out.good())
+        stop("error while writing to file: " + file);
+    }
+    Rcpp::checkUserInterrupt();
+  } // end batch loop
+
+  if (toFile)
+    out.close();
+
+  Rcpp::List res = Rcpp::List::create(Named("y")      = y,
+                                      Named("f")      = f,
+                                      Named("Z")      = Zmat,
+                                      Named("mods")   = mods,
+                                      Named("params") = wrap(params),
+                                      Named("b1")     = wrap(b1));
+  if (family == 2)
+    res["w"] = w;
+  if (toFile)
+    res["file"] = file;
+  else
+    res["exposures"] = expOut;
+  return(res);
+} // end simLarge_Cpp
@@ -32,14 +32,13 @@ using namespace Eigen;
  * @param mixVar 
  * @param tree 
  * @param newTree 
- * @returns treeMHR 
+ * @param out MHR workspace to fill
  */
-treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
-                  tdlmCtr *ctr, Eigen::VectorXd ZtR,
-                  double treeVar, double m1Var, double m2Var, double mixVar,
-                  Node* tree, bool newTree)
+void mixMHR(const std::vector<Node*> &nodes1, const std::vector<Node*> &nodes2,
+            tdlmCtr *ctr, const Eigen::VectorXd &ZtR,
+            double treeVar, double m1Var, double m2Var, double mixVar,
+            Node* tree, bool newTree, treeMHR &out)
 {
-  treeMHR out; 
   int pX1 = nodes1.size();  // Number of terminal nodes for tree1
   int pX2 = nodes2.size();  // Number of terminal nodes for tree2
   int pXd = pX1 + pX2;      
@@ -65,7 +64,7 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
     diagVar(i) = 1.0 / (m1Var * treeVar);
 
     // Update ZtX
-    if (ctr->binomial || ctr->zinb) {  // Binomial / ZINB
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb) {  // Binomial / ZINB
       ZtX.col(i) = ctr->Zw.transpose() * (nodes1[i]->nodevals)->X; 
     } else { // Gaussian
       ZtX.col(i) = (nodes1[i]->nodevals)->ZtX;
@@ -81,14 +80,15 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
     diagVar(k) = 1.0 / (m2Var * treeVar);
 
     // Update ZtX
-    if (ctr->binomial || ctr->zinb){  // Binomial / ZINB
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb){  // Binomial / ZINB
       ZtX.col(k) = ctr->Zw.transpose() * (nodes2[j]->nodevals)->X;
     } else { // Gaussian
       ZtX.col(k) = (nodes2[j]->nodevals)->ZtX;
     }
   }
 
-  // Interaction ZtX
+  // Interaction ZtX: products of per-observation node sums, each over its
+  // own exposure's lag window, so trees on different windows pair directly
   if(interaction) {
     for (i = 0; i < pX1; ++i) {
       for (j = 0; j < pX2; ++j) {
@@ -108,8 +108,8 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
   const Eigen::MatrixXd VgZtX = ctr->Vg * ZtX;
   Eigen::MatrixXd tempV(pXd, pXd);
   Eigen::VectorXd XtVzInvR(pXd);
-  if (ctr->binomial) {
-    const Eigen::MatrixXd Xdw = (ctr->Omega).asDiagonal() * out.Xd;     
+  if (ctr->binomial || ctr->scaleMix) {
+    const Eigen::MatrixXd Xdw = weightRows(ctr, out.Xd);
     tempV = Xdw.transpose() * out.Xd;                                
     tempV.noalias() -= ZtX.transpose() * VgZtX;                         
     XtVzInvR = Xdw.transpose() * ctr->R;                                
@@ -135,23 +135,13 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
   // Finalize calculation
   XtVzInvR.noalias() -= VgZtX.transpose() * ZtR; 
   tempV.diagonal().noalias() += diagVar;
+  tempV.diagonal().array() += ctr->nanJitter;
 
 
-  // V_theta
-  Eigen::MatrixXd VTheta(pXd, pXd); 
-  VTheta.triangularView<Eigen::Lower>() =
-    tempV.selfadjointView<Eigen::Lower>().llt().solve(
-        Eigen::MatrixXd::Identity(pXd, pXd));
-  const Eigen::MatrixXd VThetaChol =
-    VTheta.selfadjointView<Eigen::Lower>().llt().matrixL();
-
-  // Mean
-  const Eigen::VectorXd ThetaHat =
-    VTheta.selfadjointView<Eigen::Lower>() * XtVzInvR; // Eq. (11) mean
-  Eigen::VectorXd ThetaDraw = ThetaHat;
-
-  // Variance
-  ThetaDraw.noalias() += VThetaChol * as<Eigen::VectorXd>(rnorm(pXd, 0, sqrt(ctr->sigma2)));
+  // V_theta, Eq. (11) mean and draw
+  Eigen::VectorXd ThetaHat, ThetaDraw;
+  const double logVThetaChol =
+    gaussPostDraw(tempV, XtVzInvR, sqrt(ctr->sigma2), ThetaHat, ThetaDraw);
 
   // Store the draws
   out.drawAll = ThetaDraw;
@@ -168,10 +158,8 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
   }
 
   out.beta = ThetaHat.dot(XtVzInvR);
-  out.logVThetaChol = VThetaChol.diagonal().array().log().sum();
+  out.logVThetaChol = logVThetaChol;
   out.pXd = pXd;
-
-  return(out);
 }
 
 /**
@@ -183,18 +171,21 @@ treeMHR mixMHR(std::vector<Node*> nodes1, std::vector<Node*> nodes2,
  * @param ctr   // model control object
  * @param dgn   // Model logs
  * @param Exp   // Exposure data
+ * @param expNS // Root structures (lag window) of each exposure
  */
 void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
-                   std::vector<exposureDat*> Exp)
+                   std::vector<exposureDat*> Exp,
+                   const std::vector<NodeStruct*> &expNS)
 {
   int m1, m2, newExp, success, step1, step2;
   double stepMhr, ratio;
-  double m1Var, m2Var, mixVar, newExpVar, newMixVar, treeVar;
+  double m1Var, m2Var, mixVar, newExpVar, newMixVar, treeVar, winPrior;
   double RtR = -1.0;
   double RtZVgZtR = 0;
   std::vector<Node*> term1, term2, newTerm;
   Node* newTree = 0;
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   term1 = tree1->listTerminal();       
   term2 = tree2->listTerminal();        
@@ -238,10 +229,16 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
   // Switch exposures (3)
   } else {
     newExp = sampleInt(ctr->expProb);   
-    if (newExp != m1) { 
+    if (newExp != m1) {
+      newTree = new Node(*tree1);
+      if (!dlmSwitchWindow(newTree, expNS[newExp], stepMhr)) {
+        delete newTree;
+        newTree = 0;
+      }
+    }
+    if (newTree != 0) {
       success   = 1;
       newExpVar = ctr->muExp(newExp);
-      newTree   = new Node(*tree1);
       newTree->setUpdate(1);
       newTerm   = newTree->listTerminal();
 
@@ -262,20 +259,20 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
 
   // Tree 1 MHR
   if ((tree1->nodevals->tempV).rows() == 0)
-    mhr0 = mixMHR(term1, term2, ctr, ZtR, treeVar, 
-                  m1Var, m2Var, mixVar, tree1, 1);
+    mixMHR(term1, term2, ctr, ZtR, treeVar, 
+           m1Var, m2Var, mixVar, tree1, 1, mhr0);
   else
-    mhr0 = mixMHR(term1, term2, ctr, ZtR, treeVar, 
-                  m1Var, m2Var, mixVar, tree1, 0);
+    mixMHR(term1, term2, ctr, ZtR, treeVar, 
+           m1Var, m2Var, mixVar, tree1, 0, mhr0);
 
   if (success) {
-    mhr = mixMHR(newTerm, term2, ctr, ZtR, treeVar, 
-                 newExpVar, m2Var, newMixVar, tree1, 1);
+    mixMHR(newTerm, term2, ctr, ZtR, treeVar, 
+           newExpVar, m2Var, newMixVar, tree1, 1, mhr);
     // Combine mhr parts into log-MH ratio
-    if (ctr->binomial || ctr->zinb) {
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
       ratio = stepMhr +                                 
               mhr.logVThetaChol - mhr0.logVThetaChol + 
-              0.5 * (mhr.beta - mhr0.beta) -
+              (0.5 * (mhr.beta - mhr0.beta) * (1 / ctr->sigma2)) -
               (0.5 * ((log(treeVar * newExpVar) * mhr.nTerm1) -
               (log(treeVar * m1Var) * mhr0.nTerm1)));
     } else { // Gaussian
@@ -299,7 +296,7 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
       ratio += 0.5 * log(treeVar * mixVar) * mhr0.nTerm1 * mhr0.nTerm2;   
 
     if (log(R::runif(0, 1)) < ratio) { 
-      mhr0 = mhr; 
+      std::swap(mhr0, mhr); 
       success = 2;
 
       // Switch-exposure transition,
@@ -307,11 +304,12 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
         m1      = newExp;
         m1Var   = newExpVar;
         mixVar  = newMixVar;
+        dlmSwitchWindow(tree1, expNS[newExp], winPrior);
         tree1->replaceNodeVals(newTree);
       } else {
         tree1->accept();
       }
-      if (!(ctr->binomial) && !(ctr->zinb)) { // For Gaussian approach,
+      if (!(ctr->binomial) && !(ctr->scaleMix) && !(ctr->zinb)) { // For Gaussian approach,
         (tree1->nodevals->tempV).resize(mhr0.pXd, mhr0.pXd);
         tree1->nodevals->tempV = mhr0.tempV;
       }
@@ -360,9 +358,15 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
   } else {
     newExp = sampleInt(ctr->expProb);
     if (newExp != m2) {
+      newTree = new Node(*tree2);
+      if (!dlmSwitchWindow(newTree, expNS[newExp], stepMhr)) {
+        delete newTree;
+        newTree = 0;
+      }
+    }
+    if (newTree != 0) {
       success   = 1;
       newExpVar = ctr->muExp(newExp);
-      newTree   = new Node(*tree2);
       newTree->setUpdate(1);
       newTerm   = newTree->listTerminal();
       for (Node* nt : newTerm)
@@ -383,13 +387,13 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
 
   if (success) {
     // calculate new mhr part
-    mhr = mixMHR(term1, newTerm, ctr, ZtR, treeVar, 
-                 m1Var, newExpVar, newMixVar, tree1, 1);
+    mixMHR(term1, newTerm, ctr, ZtR, treeVar, 
+           m1Var, newExpVar, newMixVar, tree1, 1, mhr);
     
     // combine mhr parts into log-MH ratio
-    if (ctr->binomial || ctr->zinb) {
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
       ratio = stepMhr + mhr.logVThetaChol - mhr0.logVThetaChol +
-        0.5 * (mhr.beta - mhr0.beta) -
+        (0.5 * (mhr.beta - mhr0.beta) * (1 / ctr->sigma2)) -
         (0.5 * ((log(treeVar * newExpVar) * mhr.nTerm2) -
          (log(treeVar * m2Var) * mhr0.nTerm2)));
     } else {
@@ -411,19 +415,20 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
       ratio += 0.5 * log(treeVar * mixVar) * mhr0.nTerm1 * mhr0.nTerm2;
 
     if (log(R::runif(0, 1)) < ratio) {
-      mhr0    = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
 
       if (step2 == 3) {
         m2      = newExp;
         m2Var   = newExpVar;
         mixVar  = newMixVar;
+        dlmSwitchWindow(tree2, expNS[newExp], winPrior);
         tree2->replaceNodeVals(newTree);
 
       } else {
         tree2->accept();
       }
-      if (!(ctr->binomial) && !(ctr->zinb)) {
+      if (!(ctr->binomial) && !(ctr->scaleMix) && !(ctr->zinb)) {
         (tree1->nodevals->tempV).resize(mhr0.pXd, mhr0.pXd);
         tree1->nodevals->tempV = mhr0.tempV;
       }
@@ -461,8 +466,13 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
   if (ctr->shrinkage > 1)
     rHalfCauchyFC(&((ctr->tau)(t)), totTerm, tauT2 / (ctr->sigma2 * ctr->nu));
   
-  // if ((ctr->tau)(t) != (ctr->tau)(t)) 
-  //   stop("\nNaN values (tau) occured during model run, rerun model.\n");
+  if (!std::isfinite((ctr->tau)(t)) || !(mhr0.drawAll.allFinite())) {
+    if (ctr->nanRecover) { // main loop rolls back to the last good state
+      ctr->nanFlag = true;
+      return;
+    }
+    stop("\nNaN values (tau) occured during model run, rerun model.\n");
+  }
     
   (ctr->nTerm)(t) = mhr0.nTerm1;
   (ctr->nTerm2)(t) = mhr0.nTerm2;
@@ -491,7 +501,7 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
   }
 
   // Update Rmat
-  (ctr->Rmat).col(t) = mhr0.Xd * mhr0.drawAll; 
+  rmatSet(ctr, t, mhr0.Xd * mhr0.drawAll);
 
   // *** Record ***
   if (ctr->record > 0) {
@@ -549,6 +559,47 @@ void tdlmmTreeMCMC(int t, Node *tree1, Node *tree2, tdlmCtr *ctr, tdlmLog *dgn,
   }
 } // end function tdlmmTreeMCMC
 
+/**
+ * @brief rebuild node values and partial fits of tree pairs restored from a
+ * snapshot, using the main and interaction effects the snapshot kept
+ * 
+ * @param ctr   // model control object
+ * @param trees1 // restored first trees
+ * @param trees2 // restored second trees
+ * @param Exp   // Exposure data
+ */
+void tdlmmRebuild(tdlmCtr *ctr, std::vector<Node*> &trees1,
+                  std::vector<Node*> &trees2, std::vector<exposureDat*> Exp)
+{
+  for (int t = 0; t < ctr->nTrees; ++t) {
+    std::vector<Node*> term1 = trees1[t]->listTerminal();
+    std::vector<Node*> term2 = trees2[t]->listTerminal();
+    for (Node* n : term1)
+      Exp[int(ctr->tree1Exp[t])]->updateNodeVals(n);
+    for (Node* n : term2)
+      Exp[int(ctr->tree2Exp[t])]->updateNodeVals(n);
+
+    // Effects ordered as in mixMHR: tree 1, tree 2, then interactions
+    const Eigen::VectorXd &draw = mhrPair(ctr, t)[0].drawAll;
+    const int pX1 = term1.size(), pX2 = term2.size();
+    Eigen::VectorXd fit(ctr->n);   fit.setZero();
+    if ((draw.size() == pX1 + pX2) || (draw.size() == pX1 + pX2 + pX1 * pX2)) {
+      for (int i = 0; i < pX1; ++i)
+        fit += draw(i) * (term1[i]->nodevals)->X;
+      for (int j = 0; j < pX2; ++j)
+        fit += draw(pX1 + j) * (term2[j]->nodevals)->X;
+      if (draw.size() > pX1 + pX2) {
+        for (int i = 0; i < pX1; ++i)
+          for (int j = 0; j < pX2; ++j)
+            fit += draw(pX1 + pX2 + i * pX2 + j) *
+              (((term1[i]->nodevals)->X).array() * ((term2[j]->nodevals)->X).array()).matrix();
+      }
+    }
+    rmatSet(ctr, t, fit);
+  }
+  backfitReset(ctr);
+} // end function tdlmmRebuild
+
 
 
 //' dlmtree model with tdlmm approach
@@ -577,7 +628,9 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
 
   // Model selection
   ctr->binomial = as<bool>(model["binomial"]);  
+  ctr->scaleMix = as<bool>(model["scaleMix"]);
   ctr->zinb     = as<bool>(model["zinb"]);          
+  ctr->wStore   = as<int>(model["wStore"]);
 
   // Mixture & Shrinkage
   ctr->modKappa = as<double>(model["mixPrior"]);
@@ -587,6 +640,11 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     ctr->modKappa = 1;
   }
   ctr->shrinkage = as<int>(model["shrinkage"]);  
+  ctr->nanRetries = as<int>(model["nanRetries"]);
+  ctr->nanSnapshot = as<int>(model["nanSnapshot"]);
+  ctr->floatRmat = as<bool>(model["floatRmat"]);
+  ctr->resyncEvery = as<int>(model["resyncEvery"]);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   
   // Data
   ctr->Y0     = as<Eigen::VectorXd>(model["Y"]);      
@@ -642,6 +700,9 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     ctr->Ystar = ctr->z2;
   }
 
+  // Offsets enter the linear predictor; remove them from the working response
+  offsetInit(ctr, model);
+
   // Initialize parameters
   ctr->w.resize(ctr->n);  
   ctr->b1 = as<Eigen::VectorXd>(rnorm(ctr->pZ1, 0, sqrt(100))); 
@@ -672,7 +733,7 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   Rcpp::List exp_dat = as<Rcpp::List>(model["X"]); 
   ctr->nExp = exp_dat.size();
   for (int i = 0; i < ctr->nExp; ++i) { 
-    if (ctr->binomial || ctr->zinb)
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb)
       Exp.push_back(
         new exposureDat(
           as<Eigen::MatrixXd>(
@@ -684,8 +745,17 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
             as<Rcpp::List>(exp_dat[i])["Tcalc"]), ctr->Z, ctr->Vg));
   }
 
+  // *** Optionally time thread counts on this data ***
+  std::map<std::string, double> tuneTimes;
+  int tuneThreads = 0;
+  eigenThreadGuard threadGuard; // restore Eigen threads on exit
+  if (as<bool>(model["autotune"]))
+    tuneThreads = autotuneThreads(Exp[0]->Tcalc, tuneTimes);
+
   // *** Mixture/interaction management ***
-  ctr->pX = Exp[0]->pX;  
+  ctr->pX = 0;   // longest lag window, exposures may differ (ragged mixture)
+  for (exposureDat* e : Exp)
+    ctr->pX = std::max(ctr->pX, e->pX);
   ctr->nSplits = 0;
   ctr->interaction = as<int>(model["interaction"]); 
   ctr->nMix = 0;  
@@ -704,16 +774,18 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   (ctr->expCount).resize((ctr->expProb).size());  
   (ctr->expInf).resize((ctr->expProb).size());                       
 
-  // Create root nodes to start trees
+  // Create root nodes to start trees, one per exposure lag window
   std::vector<Node*> trees1; 
   std::vector<Node*> trees2;
-  NodeStruct *ns;           
-  ns = new DLNMStruct(0,                      
-                      ctr->nSplits + 1,          
-                      1,                        
-                      int (ctr->pX),             
-                      as<Eigen::VectorXd>(model["splitProb"]), 
-                      as<Eigen::VectorXd>(model["timeProb"])); 
+  std::vector<NodeStruct*> expNS;
+  Rcpp::List timeProb = as<Rcpp::List>(model["timeProb"]);
+  for (int i = 0; i < ctr->nExp; ++i)
+    expNS.push_back(new DLNMStruct(0,                      
+                                   ctr->nSplits + 1,          
+                                   1,                        
+                                   int (Exp[i]->pX),             
+                                   as<Eigen::VectorXd>(model["splitProb"]), 
+                                   as<Eigen::VectorXd>(timeProb[i]))); 
 
   // Tree initialization
   for (t = 0; t < ctr->nTrees; ++t) { 
@@ -721,15 +793,15 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     ctr->tree2Exp(t) = sampleInt(ctr->expProb); 
     trees1.push_back(new Node(0, 1));          
     trees2.push_back(new Node(0, 1)); 
-    trees1[t]->nodestruct = ns->clone();
-    trees2[t]->nodestruct = ns->clone(); 
+    trees1[t]->nodestruct = expNS[ctr->tree1Exp(t)]->clone();
+    trees2[t]->nodestruct = expNS[ctr->tree2Exp(t)]->clone(); 
     Exp[ctr->tree1Exp(t)]->updateNodeVals(trees1[t]); 
     Exp[ctr->tree2Exp(t)]->updateNodeVals(trees2[t]); 
   }
-  delete ns;
   
   // *** Setup model logs ***
   tdlmLog *dgn = new tdlmLog;                                                
+  topoInit(&(dgn->topo), ctr->nTrees, as<int>(model["topologyK"]));
   (dgn->gamma).resize(ctr->pZ, ctr->nRec);          (dgn->gamma).setZero();   
   (dgn->sigma2).resize(ctr->nRec);                  (dgn->sigma2).setZero();
   (dgn->kappa).resize(ctr->nRec);                   (dgn->kappa).setZero();  
@@ -749,6 +821,7 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   (dgn->expCount).resize(ctr->nExp, ctr->nRec);     (dgn->expCount).setZero();
   (dgn->expInf).resize(ctr->nExp, ctr->nRec);       (dgn->expInf).setZero();
   (dgn->fhat).resize(ctr->n);                       (dgn->fhat).setZero(); 
+  (dgn->probMean).resize(ctr->n);                   (dgn->probMean).setZero();
   (dgn->termNodes).resize(ctr->nTrees, ctr->nRec);  (dgn->termNodes).setZero();
   (dgn->termNodes2).resize(ctr->nTrees, ctr->nRec); (dgn->termNodes2).setZero();
   (dgn->tree1Exp).resize(ctr->nTrees, ctr->nRec);   (dgn->tree1Exp).setZero();
@@ -758,7 +831,10 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   (dgn->b1).resize(ctr->pZ1, ctr->nRec);             (dgn->b1).setZero(); 
   (dgn->b2).resize(ctr->pZ, ctr->nRec);              (dgn->b2).setZero(); 
   (dgn->r).resize(ctr->nRec);                        (dgn->r).setZero(); 
-  (dgn->wMat).resize(ctr->n, ctr->nRec);             (dgn->wMat).setZero(); 
+  zinbWLogInit(ctr, dgn);
+  scaleMixInit(ctr, dgn, model);
+  reInit(ctr, dgn, model);
+  ppcInit(&(dgn->ppc), ctr, model);
 
 
 
@@ -769,14 +845,19 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   // Load initial params for faster convergence in binomial model
   if (ctr->binomial) {
     ctr->gamma = as<VectorXd>(model["initParams"]);
-    ctr->Omega =rcpp_pgdraw(ctr->binomialSize, ctr->fhat + ctr->Z * ctr->gamma);
+    VectorXd psi = ctr->fhat + ctr->Z * ctr->gamma;
+    if (ctr->hasOffset)
+      psi += ctr->offset;
+    ctr->Omega =rcpp_pgdraw(ctr->binomialSize, psi);
     ctr->Zw = ctr->Omega.asDiagonal() * ctr->Z;
     ctr->VgInv =   ctr->Z.transpose() * ctr->Zw;
     ctr->VgInv.diagonal().array() += 1 / 100000.0;
     ctr->Vg = ctr->VgInv.inverse();
     ctr->VgChol = ctr->Vg.llt().matrixL();
     // recalculate 'pseudo-Y' = kappa / omega, kappa = (y - n_b)/2
-    ctr->Ystar = ctr->kappa.array() / ctr->Omega.array();
+    ctr->Ystar = (ctr->Omega.array() > 0).select(ctr->kappa.array() / ctr->Omega.array(), 0.0);
+    if (ctr->hasOffset)
+      ctr->Ystar -= ctr->offset;
   }
   (ctr->totTermExp).resize(ctr->nExp);                (ctr->totTermExp).setZero();    
   (ctr->sumTermT2Exp).resize(ctr->nExp);              (ctr->sumTermT2Exp).setZero();  
@@ -809,20 +890,36 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   }
   ctr->nTerm.resize(ctr->nTrees);                 (ctr->nTerm).setOnes();
   ctr->nTerm2.resize(ctr->nTrees);                (ctr->nTerm2).setOnes();
-  (ctr->Rmat).resize(ctr->n, ctr->nTrees);        (ctr->Rmat).setZero();
+  rmatInit(ctr);
 
 
   // *** Create Progress Meter ***
   progressMeter* prog = new progressMeter(ctr);
 
+  // *** Last-good state for NaN recovery ***
+  int nanRetry = 0;
+  tdlmSnapshot *snap = 0;
+  ctr->nanRecover = (ctr->nanRetries > 0);
+  if (ctr->nanRecover) {
+    ctr->b = 0;
+    snap = new tdlmSnapshot;
+    tdlmSnapshotSave(ctr, dgn, snap, trees1, &trees2);
+  }
+
 
   // *** Beginning of MCMC ***
   double sigmanu;
   std::size_t s;
 
   // MCMC iteration
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) { 
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
 
     // Burn-in & thinning
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) { 
@@ -832,8 +929,7 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     }
 
     // Reset the parameters
-    ctr->R += (ctr->Rmat).col(0); // Remove first tree est from R 
-    ctr->fhat.setZero();                
+    backfitStart(ctr); // Remove first tree est from R 
     ctr->totTerm = 0;                    
     ctr->sumTermT2 = 0;                   
     ctr->totTermExp.setZero();
@@ -849,14 +945,17 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
 
     // Iterate through trees
     for (t = 0; t < ctr->nTrees; ++t) {
-      tdlmmTreeMCMC(t, trees1[t], trees2[t], ctr, dgn, Exp);
-      ctr->fhat += (ctr->Rmat).col(t);
-      if (t < ctr->nTrees - 1) 
-        ctr->R += (ctr->Rmat).col(t + 1) - (ctr->Rmat).col(t); 
+      tdlmmTreeMCMC(t, trees1[t], trees2[t], ctr, dgn, Exp, expNS);
+      if (ctr->nanFlag)
+        break;
+      backfitNext(ctr, t);
     }
 
     // Pre-calculations for control and variance
-    ctr->R = ctr->Ystar - ctr->fhat;             
+    if (ctr->nanFlag)
+      ctr->R = ctr->Ystar - ctr->fhat;
+    else
+      backfitEnd(ctr);
     ctr->sumTermT2 = (ctr->sumTermT2Exp).sum();
     ctr->totTerm = (ctr->totTermExp).sum();
     if(ctr->interaction) {
@@ -865,11 +964,39 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     }
 
     // Update model
-    tdlmModelEst(ctr); // modelEst.cpp::tdlmModelEst
+    if (!(ctr->nanFlag))
+      tdlmModelEst(ctr); // modelEst.cpp::tdlmModelEst
     
     // Horseshoe sampling with IG & Half-cauchy relationship
     // nu (global)
-    rHalfCauchyFC(&(ctr->nu), ctr->totTerm, ctr->sumTermT2 / ctr->sigma2);  
+    if (!(ctr->nanFlag)) {
+      rHalfCauchyFC(&(ctr->nu), ctr->totTerm, ctr->sumTermT2 / ctr->sigma2);  
+      if (!std::isfinite(ctr->sigma2) || !std::isfinite(ctr->nu)) {
+        if (!(ctr->nanRecover))
+          stop("\nNaN values (sigma2, nu) occured during model run, rerun model.\n");
+        ctr->nanFlag = true;
+      }
+    }
+
+    // Roll back to the last good state and retry with a ridge jitter
+    if (ctr->nanFlag) {
+      Eigen::VectorXd ev(4);
+      ev << ctr->b, snap->b, nanRetry + 1, 0;
+      if (++nanRetry > ctr->nanRetries) {
+        tdlmSnapshotRestore(ctr, dgn, snap, trees1, &trees2);
+        tdlmmRebuild(ctr, trees1, trees2, Exp);
+        (dgn->nanEvents).push_back(ev);
+        Rcpp::warning("NaN values persisted after %i retries, returning the %i iterations completed before iteration %i",
+                      ctr->nanRetries, snap->b, (int) ev(0));
+        break;
+      }
+      tdlmSnapshotRestore(ctr, dgn, snap, trees1, &trees2);
+      tdlmmRebuild(ctr, trees1, trees2, Exp);
+      ctr->nanJitter = 1e-8 * pow(10.0, nanRetry);
+      ev(3) = ctr->nanJitter;
+      (dgn->nanEvents).push_back(ev);
+      continue;
+    }
     sigmanu = ctr->sigma2 * ctr->nu;
     
     // Exposure shrinkage
@@ -898,6 +1025,14 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
     // * Record
     if (ctr->record > 0) {
       dgn->fhat += ctr->fhat;
+      if (ctr->binomial) {
+        VectorXd eta = ctr->fhat + ctr->Z * ctr->gamma;
+        if (ctr->hasOffset)
+          eta += ctr->offset;
+        if (ctr->hasRE)
+          eta += ctr->reFit;
+        dgn->probMean.array() += 1.0 / (1.0 + (-eta.array()).exp());
+      }
       (dgn->gamma).col(ctr->record - 1) = ctr->gamma;
       (dgn->sigma2)(ctr->record - 1) = ctr->sigma2;
       (dgn->nu)(ctr->record - 1) = ctr->nu;
@@ -916,7 +1051,14 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
       (dgn->b1).col(ctr->record - 1) = ctr->b1;
       (dgn->b2).col(ctr->record - 1) = ctr->b2;
       (dgn->r)(ctr->record - 1) = ctr->r;
-      (dgn->wMat).col(ctr->record - 1) = ctr->w;
+      zinbWLogRecord(ctr, dgn);
+      scaleMixRecord(ctr, dgn);
+      reRecord(ctr, dgn);
+      for (t = 0; t < ctr->nTrees; ++t)
+        topoRecord(&(dgn->topo), t, trees1[t], 0,
+                   "e" + std::to_string((int) ctr->tree1Exp(t)) + "," +
+                   std::to_string((int) ctr->tree2Exp(t)) + ":", trees2[t]);
+      ppcRecord(&(dgn->ppc), ctr);
       
       // mixture specific
       if (ctr->interaction) {
@@ -934,10 +1076,26 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
       }
     }
 
+    // Refresh last-good state
+    if (ctr->nanRecover && ((ctr->b % ctr->nanSnapshot) == 0)) {
+      tdlmSnapshotSave(ctr, dgn, snap, trees1, &trees2);
+      nanRetry = 0;
+      ctr->nanJitter = 0.0;
+    }
+
     // Progress
     prog->printMark();
   } // End MCMC ******
 
+  // Run cut short by persistent NaN values or shortened by the time budget:
+  // keep completed records only
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    tdlmLogTruncate(dgn, ctr->nRec, ctr->n);
+  }
+  if (snap != 0)
+    delete snap;
+
 
   // * Setup data for return
   Eigen::MatrixXd DLM((dgn->DLMexp).size(), 8);
@@ -946,7 +1104,7 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   Eigen::VectorXd sigma2 = dgn->sigma2;
   Eigen::VectorXd nu = dgn->nu;
   Eigen::VectorXd kappa = dgn->kappa;
-  Eigen::VectorXd fhat = (dgn->fhat).array() / ctr->nRec;
+  Eigen::VectorXd fhat = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   Eigen::MatrixXd gamma = (dgn->gamma).transpose();
   Eigen::MatrixXd tau = (dgn->tau).transpose();
   Eigen::MatrixXd termNodes = (dgn->termNodes).transpose();
@@ -967,6 +1125,29 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   Eigen::MatrixXd b2 = (dgn->b2).transpose();
   Eigen::VectorXd r = dgn->r; 
   Eigen::MatrixXd wMat = dgn->wMat; 
+  std::vector<int> wBits = dgn->wBits;
+  Eigen::VectorXd wMean = (dgn->wMean).array() / (double) std::max(ctr->nRec, 1);
+  int mcmcIter = ctr->nRec;
+  Rcpp::List budget;
+  if (ctr->timeBudget > 0)
+    budget = budgetSummary(ctr, nRecPlanned);
+  bool driftOut = ctr->floatRmat || (ctr->resyncEvery > 0);
+  Rcpp::List topology;
+  if (dgn->topo.topK > 0)
+    topology = topoSummary(&(dgn->topo));
+  Rcpp::List ppc;
+  if (dgn->ppc.active)
+    ppc = ppcSummary(&(dgn->ppc), ctr->nRec);
+  MatrixXd sigma2Grp = (dgn->sigma2Grp).transpose();
+  VectorXd probMean = (dgn->probMean) / (double) std::max(ctr->nRec, 1);
+  VectorXd lambdaMean = (dgn->lambdaMean) / (double) std::max(ctr->nRec, 1);
+  MatrixXd reVar = (dgn->reVar).transpose();
+  MatrixXd arPhi = (dgn->arPhi).transpose();
+  MatrixXd reCoef = (dgn->reCoefMean) / (double) std::max(ctr->nRec, 1);
+  double residDrift = ctr->residDrift;
+  Eigen::MatrixXd nanEvents((dgn->nanEvents).size(), 4);
+  for (s = 0; s < (dgn->nanEvents).size(); ++s)
+    nanEvents.row(s) = dgn->nanEvents[s];
 
   // Interaction
   if (ctr->interaction) {
@@ -980,16 +1161,17 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
   for (s = 0; s < (dgn->TreeAccept).size(); ++s)
     Accept.row(s) = dgn->TreeAccept[s];
   delete prog;
-  delete ctr;
   delete dgn;
-  for (s = 0; s < Exp.size(); ++s)
+  for (s = 0; s < Exp.size(); ++s) {
     delete Exp[s];
+    delete expNS[s];
+  }
   for (s = 0; s < trees1.size(); ++s) {
     delete trees1[s];
     delete trees2[s];
   }
 
-  return(Rcpp::List::create(Named("TreeStructs") = wrap(DLM),
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs") = wrap(DLM),
                             Named("MIX") = wrap(MIX),
                             Named("gamma") = wrap(gamma),
                             // Named("fhat") = wrap(fhat),
@@ -1011,7 +1193,62 @@ Rcpp::List tdlmm_Cpp(const Rcpp::List model)
                             Named("treeAccept") = wrap(Accept),
                             Named("b1") = wrap(b1),
                             Named("b2") = wrap(b2),
-                            Named("r") = wrap(r)));
+                            Named("r") = wrap(r));
+
+  out["mcmcIter"] = mcmcIter;
+  out["nanEvents"] = wrap(nanEvents);
+
+  // ZINB at-risk log, in the storage format requested
+  if (ctr->zinb) {
+    if (ctr->wStore == 1)
+      out["wBits"] = wrap(wBits);
+    else if (ctr->wStore == 2)
+      out["wMean"] = wrap(wMean);
+    else
+      out["wMat"] = wrap(wMat);
+  }
+
+  // Most frequent tree topologies
+  if (topology.size() > 0)
+    out["topology"] = topology;
+
+  // Posterior predictive checks
+  if (ppc.size() > 0)
+    out["ppc"] = ppc;
+
+  // Posterior mean success probabilities
+  if (ctr->binomial)
+    out["prob"] = wrap(probMean);
+
+  // Group variances and posterior mean latent precisions
+  if (ctr->scaleMix) {
+    out["sigma2Group"] = wrap(sigma2Grp);
+    out["lambda"]      = wrap(lambdaMean);
+    if (ctr->arLags.size() > 0)
+      out["arPhi"]     = wrap(arPhi);
+  }
+
+  // Random-effect variances and posterior mean random effects
+  if (ctr->hasRE) {
+    out["reVar"]  = wrap(reVar);
+    out["reCoef"] = wrap(reCoef);
+  }
+
+  // Projected and achieved records under the time budget
+  if (budget.size() > 0)
+    out["budget"] = budget;
+
+  // Largest deviation of the running residual from its exact value
+  if (driftOut)
+    out["residDrift"] = wrap(residDrift);
+
+  // Threads chosen by autotuning and their timings (seconds)
+  if (as<bool>(model["autotune"]))
+    out["autotune"] = Rcpp::List::create(Named("threads") = wrap(tuneThreads),
+                                         Named("timings") = autotuneTimings(tuneTimes));
+
+  delete ctr;
+  return(out);
 } // end tdlmm_Cpp
 
 
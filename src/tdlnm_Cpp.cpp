@@ -39,15 +39,14 @@ using Eigen::Lower;
  * @param var nu*tau
  * @param tree pointer to top of tree
  * @param newTree if true, recalculate node-specific values
- * @return treeMHR 
+ * @param out MHR workspace to fill
  */
-treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
-                VectorXd ZtR, double var, Node* tree, bool newTree)
+void dlnmMHR(const std::vector<Node*> &nodes, tdlmCtr *ctr,
+             const VectorXd &ZtR, double var, Node* tree, bool newTree, treeMHR &out)
 {
-  treeMHR out;
   int pX = int(nodes.size());
   
-  if ((pX == 1) && (!ctr->binomial) && (!ctr->zinb)) { // single terminal node, cont. response
+  if ((pX == 1) && (!ctr->binomial) && (!ctr->scaleMix) && (!ctr->zinb)) { // single terminal node, cont. response
     double VTheta = var / (var * ctr->VTheta1Inv + 1.0);
     double XtVzInvR = (ctr->X1).dot(ctr->R) - (ctr->VgZtX1).dot(ZtR);
     double ThetaHat = VTheta * XtVzInvR;
@@ -60,7 +59,7 @@ treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
     out.beta = ThetaHat * XtVzInvR;
     out.logVThetaChol = log(VThetaChol);
 
-  } else { // 2+ terminal nodes or binomial response
+  } else { // 2+ terminal nodes or weighted response
 
     MatrixXd ZtX(ctr->pZ, pX);      ZtX.setZero();
     MatrixXd VgZtX(ctr->pZ, pX);    VgZtX.setZero();
@@ -70,7 +69,7 @@ treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
     for (std::size_t s = 0; s < nodes.size(); ++s) {
       out.Xd.col(s) = (nodes[s]->nodevals)->X;
       
-      if (ctr->binomial || ctr->zinb) {
+      if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
         ZtX.col(s) = ctr->Zw.transpose() * (nodes[s]->nodevals)->X;
         VgZtX.col(s) = ctr->Vg * ZtX.col(s);
         
@@ -84,8 +83,8 @@ treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
     MatrixXd tempV(pX, pX);
     VectorXd XtVzInvR(pX);
     
-    if (ctr->binomial) {
-      const MatrixXd Xdw = (ctr->Omega).asDiagonal() * out.Xd;
+    if (ctr->binomial || ctr->scaleMix) {
+      const MatrixXd Xdw = weightRows(ctr, out.Xd);
       tempV = Xdw.transpose() * out.Xd;
       tempV.noalias() -= ZtX.transpose() * VgZtX;
       XtVzInvR = Xdw.transpose() * ctr->R;
@@ -109,24 +108,15 @@ treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
     }
 
     XtVzInvR.noalias() -= VgZtX.transpose() * ZtR;
-    tempV.diagonal().array() += 1.0 / var;
-    const MatrixXd VTheta = tempV.inverse();
-    const MatrixXd VThetaChol = VTheta.llt().matrixL();
-    const VectorXd ThetaHat = VTheta * XtVzInvR;
-    
-    // const VectorXd XtVzInvR =
-    //   out.Xd.transpose() * ctr->R - VgZtX.transpose() * ZtR;
-
-    out.draw = ThetaHat;
-    out.draw.noalias() += VThetaChol * as<VectorXd>(rnorm(pX, 0, sqrt(ctr->sigma2)));
+    tempV.diagonal().array() += 1.0 / var + ctr->nanJitter;
+    VectorXd ThetaHat;
+    out.logVThetaChol = gaussPostDraw(tempV, XtVzInvR, sqrt(ctr->sigma2),
+                                      ThetaHat, out.draw);
     out.beta = ThetaHat.dot(XtVzInvR);
-    out.logVThetaChol = VThetaChol.diagonal().array().log().sum();
   } // end 2+ terminal nodes
 
   out.termT2 = (out.draw).dot(out.draw);
   out.nTerm = double(pX);
-
-  return(out);
 } // end drawMHR
 
 /**
@@ -137,9 +127,10 @@ treeMHR dlnmMHR(std::vector<Node*> nodes, tdlmCtr *ctr,
  * @param ctr pointer to model control
  * @param dgn pointer to model log
  * @param Exp pointer to exposure data
+ * @param scenExp exposure data of counterfactual exposure scenarios
  */
 void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn, 
-                   exposureDat *Exp)
+                   exposureDat *Exp, std::vector<exposureDat*> &scenExp)
 {
   int step = 0;
   int success = 0;
@@ -148,12 +139,13 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
   double treevar = ctr->nu * ctr->tau(t);
   std::size_t s;
   std::vector<Node*> dlnmTerm, newDlnmTerm;
-  treeMHR mhr0, mhr;
+  treeMHR *mhrWork = mhrPair(ctr, t);
+  treeMHR &mhr0 = mhrWork[0], &mhr = mhrWork[1];
 
   // List current tree terminal nodes
   dlnmTerm = tree->listTerminal();
   VectorXd ZtR = (ctr->Zw).transpose() * (ctr->R);
-  mhr0 = dlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 0);
+  dlnmMHR(dlnmTerm, ctr, ZtR, treevar, tree, 0, mhr0);
 
   if (dlnmTerm.size() > 1) {
     step = sampleInt(ctr->stepProb, 1);
@@ -168,12 +160,12 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
   if (success) {
     // calculate new tree part of MHR and draw node effects
     newDlnmTerm = tree->listTerminal(1);
-    mhr = dlnmMHR(newDlnmTerm, ctr, ZtR, treevar, tree, 1);
+    dlnmMHR(newDlnmTerm, ctr, ZtR, treevar, tree, 1, mhr);
 
     // combine mhr parts into log-MH ratio
-    if (ctr->binomial || ctr->zinb) {
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb) {
       ratio = stepMhr + (mhr.logVThetaChol - mhr0.logVThetaChol) +
-        0.5 * (mhr.beta - mhr0.beta) -
+        (0.5 * (mhr.beta - mhr0.beta) * (1 / ctr->sigma2)) -
         (log(treevar) * 0.5 * (mhr.nTerm - mhr0.nTerm));
         
     } else {
@@ -188,11 +180,11 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
     }
     
     if (log(R::runif(0, 1)) < ratio) {
-      mhr0 = mhr;
+      std::swap(mhr0, mhr);
       success = 2;
       tree->accept();
       dlnmTerm = tree->listTerminal();
-      if (!ctr->binomial && !(ctr->zinb)) {
+      if (!ctr->binomial && !(ctr->scaleMix) && !(ctr->zinb)) {
         tree->nodevals->tempV.resize(dlnmTerm.size(), dlnmTerm.size());
         tree->nodevals->tempV = mhr0.tempV;
       }
@@ -206,15 +198,21 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
     rHalfCauchyFC(&(ctr->tau(t)), mhr0.nTerm, 
                 mhr0.termT2 / (ctr->sigma2 * ctr->nu));
 
-  if ((ctr->tau)(t) != (ctr->tau)(t)) {
+  if (!std::isfinite((ctr->tau)(t)) || !(mhr0.draw.allFinite())) {
     // Rcout << ctr->gamma << "\n" << ctr->sigma2 << " " << ctr->tau << "\n" << ctr->Omega.mean();
+    if (ctr->nanRecover) { // main loop rolls back to the last good state
+      ctr->nanFlag = true;
+      return;
+    }
     stop("\nNaN values occured during model run, rerun model.\n");
   }
   
   ctr->nTerm(t) = mhr0.nTerm;
   ctr->totTerm += mhr0.nTerm;
   ctr->sumTermT2 += mhr0.termT2 / ctr->tau(t);
-  ctr->Rmat.col(t) = mhr0.Xd * mhr0.draw;
+  rmatSet(ctr, t, mhr0.Xd * mhr0.draw);
+  if (dgn->imp.active)
+    dgn->imp.theta[t] = mhr0.draw;
 
   // Record
   if (ctr->record > 0) {
@@ -233,6 +231,15 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
       (dgn->DLMexp).push_back(rec);
     }
 
+    // Contribution of the tree to each scenario contrast
+    for (std::size_t k = 0; k < scenExp.size(); ++k) {
+      for (s = 0; s < dlnmTerm.size(); ++s) {
+        NodeStruct *ns = dlnmTerm[s]->nodestruct;
+        (dgn->scenario)(k, ctr->record - 1) +=
+          mhr0.draw[s] * (scenExp[k]->nodeMean(ns) - Exp->nodeMean(ns));
+      }
+    }
+
     if (ctr->diagnostics) {
       VectorXd acc(5);
       acc << step, success, dlnmTerm.size(), stepMhr, ratio;
@@ -241,6 +248,43 @@ void tdlnmTreeMCMC(int t, Node *tree, tdlmCtr *ctr, tdlmLog *dgn,
   }
 } // end tdlnmGaussianTreeMCMC
 
+/**
+ * @brief rebuild node values, cached tempV and partial fits of trees restored
+ * from a snapshot, using the terminal node effects the snapshot kept
+ * 
+ * @param ctr pointer to model control
+ * @param trees restored trees
+ * @param Exp pointer to exposure data
+ */
+void tdlnmRebuild(tdlmCtr *ctr, std::vector<Node*> &trees, exposureDat *Exp)
+{
+  for (int t = 0; t < ctr->nTrees; ++t) {
+    std::vector<Node*> term = trees[t]->listTerminal();
+    const VectorXd &draw = mhrPair(ctr, t)[0].draw;
+    VectorXd fit(ctr->n);   fit.setZero();
+    for (std::size_t s = 0; s < term.size(); ++s) {
+      Exp->updateNodeVals(term[s]);
+      if (draw.size() == int(term.size()))
+        fit += draw(s) * (term[s]->nodevals)->X;
+    }
+    rmatSet(ctr, t, fit);
+
+    if ((term.size() > 1) && !(ctr->binomial) && !(ctr->scaleMix) && !(ctr->zinb)) {
+      MatrixXd Xd(ctr->n, term.size());
+      MatrixXd ZtX(ctr->pZ, term.size());
+      MatrixXd VgZtX(ctr->pZ, term.size());
+      for (std::size_t s = 0; s < term.size(); ++s) {
+        Xd.col(s)    = (term[s]->nodevals)->X;
+        ZtX.col(s)   = (term[s]->nodevals)->ZtX;
+        VgZtX.col(s) = (term[s]->nodevals)->VgZtX;
+      }
+      trees[t]->nodevals->tempV = Xd.transpose() * Xd;
+      trees[t]->nodevals->tempV.noalias() -= ZtX.transpose() * VgZtX;
+    }
+  }
+  backfitReset(ctr);
+} // end tdlnmRebuild
+
 
 //' dlmtree model with tdlnm approach
 //'
@@ -273,11 +317,18 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   ctr->diagnostics = as<bool>(model["diagnostics"]);
 
   ctr->binomial = as<bool>(model["binomial"]);
+  ctr->scaleMix = as<bool>(model["scaleMix"]);
   ctr->zinb = as<bool>(model["zinb"]); 
+  ctr->wStore = as<int>(model["wStore"]);
   ctr->stepProb = as<std::vector<double> >(model["stepProbTDLM"]);
   ctr->treePrior = as<std::vector<double> >(model["treePriorTDLM"]);
   ctr->shrinkage = as<int>(model["shrinkage"]);
   ctr->modKappa = 1.0;
+  ctr->nanRetries = as<int>(model["nanRetries"]);
+  ctr->nanSnapshot = as<int>(model["nanSnapshot"]);
+  ctr->floatRmat = as<bool>(model["floatRmat"]);
+  ctr->resyncEvery = as<int>(model["resyncEvery"]);
+  ctr->timeBudget = as<double>(model["timeBudget"]);
   
 
   // * Set up model data
@@ -337,6 +388,9 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
     ctr->Ystar = ctr->z2;
   }
 
+  // Offsets enter the linear predictor; remove them from the working response
+  offsetInit(ctr, model);
+
   // Initialize parameters
   ctr->w.resize(ctr->n);  
   ctr->b1 = as<VectorXd>(rnorm(ctr->pZ1, 0, sqrt(100))); 
@@ -362,22 +416,50 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   ctr->yZeroN = (ctr->yZeroIdx).size(); 
   ctr->nStar = (ctr->NBidx).size();
 
+  // * Optionally time computation strategies on this data
+  bool lowmem = as<bool>(model["lowmem"]);
+  std::map<std::string, double> tuneTimes;
+  int tuneThreads = 0;
+  eigenThreadGuard threadGuard; // restore Eigen threads on exit
+  if (as<bool>(model["autotune"])) {
+    tuneThreads = autotuneThreads(as<MatrixXd>(model["Tcalc"]), tuneTimes);
+    if (as<int>(model["nSplits"]) > 0)
+      lowmem = autotuneLowmem(model, ctr,
+                              as<double>(model["memBudget"]) * 1073741824.0,
+                              tuneTimes);
+  }
+
   // * Create exposure data management
   exposureDat *Exp;
-  if (as<int>(model["nSplits"]) == 0) { // DLM
-    if (ctr->binomial || ctr->zinb)
+  if (as<bool>(model["window"])) { // sliding windows over location series
+    const NumericVector winSE = model["SE"];
+    const double se = (winSE.size() > 0) ? winSE[0] : 0.0;
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb)
+      Exp = new exposureDat(as<VectorXd>(model["series"]),
+                            as<VectorXi>(model["winPos"]),
+                            as<int>(model["pExp"]),
+                            as<VectorXd>(model["Xsplits"]),
+                            se);
+    else
+      Exp = new exposureDat(as<VectorXd>(model["series"]),
+                            as<VectorXi>(model["winPos"]),
+                            as<int>(model["pExp"]),
+                            as<VectorXd>(model["Xsplits"]),
+                            se, ctr->Z, ctr->Vg);
+  } else if (as<int>(model["nSplits"]) == 0) { // DLM
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb)
       Exp = new exposureDat(as<MatrixXd>(model["Tcalc"]));
     else
       Exp = new exposureDat(as<MatrixXd>(model["Tcalc"]),
                             ctr->Z, ctr->Vg);
   } else { // DLNM
-    if (ctr->binomial || ctr->zinb)
+    if (ctr->binomial || ctr->scaleMix || ctr->zinb)
       Exp = new exposureDat(as<MatrixXd>(model["X"]),
                             as<MatrixXd>(model["SE"]),
                             as<VectorXd>(model["Xsplits"]),
                             as<MatrixXd>(model["Xcalc"]),
                             as<MatrixXd>(model["Tcalc"]),
-                            as<bool>(model["lowmem"]));
+                            lowmem);
     else
       Exp = new exposureDat(as<MatrixXd>(model["X"]),
                             as<MatrixXd>(model["SE"]),
@@ -385,13 +467,35 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
                             as<MatrixXd>(model["Xcalc"]),
                             as<MatrixXd>(model["Tcalc"]),
                             ctr->Z, ctr->Vg,
-                            as<bool>(model["lowmem"]));
+                            lowmem);
   }
   ctr->pX = Exp->pX;
   ctr->nSplits = Exp->nSplits;
 
+  // * Counterfactual exposure scenarios, valued by the same bins
+  std::vector<exposureDat*> scenExp;
+  Rcpp::List scenarios = model["scenario"];
+  for (int k = 0; k < scenarios.size(); ++k) {
+    Rcpp::List sc = scenarios[k];
+    if (ctr->nSplits == 0)
+      scenExp.push_back(new exposureDat(as<MatrixXd>(sc["Tcalc"])));
+    else
+      scenExp.push_back(new exposureDat(as<MatrixXd>(sc["X"]),
+                                        as<MatrixXd>(model["SE"]),
+                                        as<VectorXd>(model["Xsplits"]),
+                                        as<MatrixXd>(sc["Xcalc"]),
+                                        as<MatrixXd>(model["Tcalc"]),
+                                        true));
+    scenExp[k]->setColMeans();
+  }
+  if (scenExp.size() > 0)
+    Exp->setColMeans();
+
   // * Calculations used in special case: single-node trees
-  ctr->X1 = (Exp->Tcalc).col(ctr->pX - 1);
+  if (Exp->window)
+    ctr->X1 = Exp->windowVals(0, ctr->nSplits + 1, 1, ctr->pX);
+  else
+    ctr->X1 = (Exp->Tcalc).col(ctr->pX - 1);
   ctr->ZtX1 = (ctr->Z).transpose() * (ctr->X1);
   ctr->VgZtX1 = (ctr->Vg).selfadjointView<Lower>() * (ctr->ZtX1);
   ctr->VTheta1Inv = (ctr->X1).dot(ctr->X1) - (ctr->ZtX1).dot(ctr->VgZtX1);
@@ -410,24 +514,31 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   }
   delete ns;
   ctr->nTerm.resize(ctr->nTrees);                   ctr->nTerm.setOnes();
-  ctr->Rmat.resize(ctr->n, ctr->nTrees);            ctr->Rmat.setZero();
+  rmatInit(ctr);
 
   // * Setup model logs
   tdlmLog *dgn = new tdlmLog;
+  topoInit(&(dgn->topo), ctr->nTrees, as<int>(model["topologyK"]));
   (dgn->gamma).resize(ctr->pZ, ctr->nRec);          (dgn->gamma).setZero();
   (dgn->sigma2).resize(ctr->nRec);                  (dgn->sigma2).setZero();
   (dgn->nu).resize(ctr->nRec);                      (dgn->nu).setZero();
   (dgn->tau).resize(ctr->nTrees, ctr->nRec);        (dgn->tau).setZero();
   (dgn->fhat).resize(ctr->n);                       (dgn->fhat).setZero();
+  (dgn->probMean).resize(ctr->n);                   (dgn->probMean).setZero();
   (dgn->termNodes).resize(ctr->nTrees, ctr->nRec);  (dgn->termNodes).setZero();
   dgn->timeProbs.resize(ctr->pX - 1, ctr->nRec);    (dgn->timeProbs).setZero();
-  VectorXd Yhat(ctr->n);                             Yhat.setZero();
+  (dgn->Yhat).resize(ctr->n);                       (dgn->Yhat).setZero();
 
   // ZINB specific log
   (dgn->b1).resize(ctr->pZ1, ctr->nRec);             (dgn->b1).setZero(); 
   (dgn->b2).resize(ctr->pZ, ctr->nRec);              (dgn->b2).setZero(); 
   (dgn->r).resize(ctr->nRec);                        (dgn->r).setZero(); 
-  (dgn->wMat).resize(ctr->n, ctr->nRec);             (dgn->wMat).setZero(); 
+  zinbWLogInit(ctr, dgn);
+  scaleMixInit(ctr, dgn, model);
+  reInit(ctr, dgn, model);
+  ppcInit(&(dgn->ppc), ctr, model);
+  imputeInit(&(dgn->imp), Exp, ctr, model);
+  (dgn->scenario).resize(scenExp.size(), ctr->nRec); (dgn->scenario).setZero();
   
   // * Initial values and draws
   ctr->fhat.resize(ctr->n);                         (ctr->fhat).setZero();
@@ -436,14 +547,19 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   // Load initial params for faster convergence in binomial model
   if (ctr->binomial) {
     ctr->gamma = as<VectorXd>(model["initParams"]);
-    ctr->Omega = rcpp_pgdraw(ctr->binomialSize, ctr->fhat + ctr->Z * ctr->gamma);
+    VectorXd psi = ctr->fhat + ctr->Z * ctr->gamma;
+    if (ctr->hasOffset)
+      psi += ctr->offset;
+    ctr->Omega = rcpp_pgdraw(ctr->binomialSize, psi);
     ctr->Zw = ctr->Omega.asDiagonal() * ctr->Z;
     ctr->VgInv = ctr->Z.transpose() * ctr->Zw;
     ctr->VgInv.diagonal().array() += 1 / 1000.0;
     ctr->Vg = ctr->VgInv.inverse();
     ctr->VgChol = ctr->Vg.llt().matrixL();
     // recalculate 'pseudo-Y' = kappa / omega, kappa = (y - n_b)/2
-    ctr->Ystar = ctr->kappa.array() / ctr->Omega.array();
+    ctr->Ystar = (ctr->Omega.array() > 0).select(ctr->kappa.array() / ctr->Omega.array(), 0.0);
+    if (ctr->hasOffset)
+      ctr->Ystar -= ctr->offset;
   }
   ctr->totTerm = 0;
   ctr->sumTermT2 = 0;
@@ -463,10 +579,26 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   // * Create progress meter
   progressMeter* prog = new progressMeter(ctr);
 
+  // * Last-good state for NaN recovery
+  int nanRetry = 0;
+  tdlmSnapshot *snap = 0;
+  ctr->nanRecover = (ctr->nanRetries > 0);
+  if (ctr->nanRecover) {
+    ctr->b = 0;
+    snap = new tdlmSnapshot;
+    tdlmSnapshotSave(ctr, dgn, snap, trees);
+  }
+
   // * Beginning of MCMC
   std::size_t s;
+  int nRecPlanned = ctr->nRec;
+  budgetStart(ctr);
   for (ctr->b = 1; ctr->b <= (ctr->iter + ctr->burn); (ctr->b)++) {
     Rcpp::checkUserInterrupt();
+    if (!budgetContinue(ctr)) { // deadline reached: keep completed iterations
+      --(ctr->b);
+      break;
+    }
 
     if ((ctr->b > ctr->burn) && (((ctr->b - ctr->burn) % ctr->thin) == 0)) {
       ctr->record = floor((ctr->b - ctr->burn) / ctr->thin);
@@ -475,25 +607,58 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
     }
 
     // * Update trees
-    ctr->R += (ctr->Rmat).col(0);
-    (ctr->fhat).setZero();
+    backfitStart(ctr);
     ctr->totTerm = 0.0; 
     ctr->sumTermT2 = 0.0;
+    if ((ctr->record > 0) && (scenExp.size() > 0)) // clear a rolled-back record
+      (dgn->scenario).col(ctr->record - 1).setZero();
     for (t = 0; t < ctr->nTrees; ++t) {
-      tdlnmTreeMCMC(t, trees[t], ctr, dgn, Exp);
-      ctr->fhat += (ctr->Rmat).col(t);
-      if (t < ctr->nTrees - 1) {
-        ctr->R += (ctr->Rmat).col(t + 1) - (ctr->Rmat).col(t);
-      }
+      tdlnmTreeMCMC(t, trees[t], ctr, dgn, Exp, scenExp);
+      if (ctr->nanFlag)
+        break;
+      backfitNext(ctr, t);
     } // end update trees
 
     // * Update model
-    ctr->R = ctr->Ystar - ctr->fhat; 
-    tdlmModelEst(ctr);
-    rHalfCauchyFC(&(ctr->nu), ctr->totTerm, ctr->sumTermT2 / ctr->sigma2);
-    if ((ctr->sigma2 != ctr->sigma2) || (ctr->nu != ctr->nu)) {
-      // Rcout << ctr->gamma << "\n" << ctr->sigma2 << " " << ctr->nu << "\n" << ctr->Omega.mean() << " " << ctr->Y.mean();
-      stop("\nNaN values occured during model run, rerun model.\n");
+    if (!(ctr->nanFlag)) {
+      backfitEnd(ctr);
+      tdlmModelEst(ctr);
+    }
+    if (!(ctr->nanFlag)) {
+      rHalfCauchyFC(&(ctr->nu), ctr->totTerm, ctr->sumTermT2 / ctr->sigma2);
+      if (!std::isfinite(ctr->sigma2) || !std::isfinite(ctr->nu)) {
+        // Rcout << ctr->gamma << "\n" << ctr->sigma2 << " " << ctr->nu << "\n" << ctr->Omega.mean() << " " << ctr->Y.mean();
+        if (!(ctr->nanRecover))
+          stop("\nNaN values occured during model run, rerun model.\n");
+        ctr->nanFlag = true;
+      }
+    }
+
+    // * Impute missing exposures
+    if (!(ctr->nanFlag))
+      imputeUpdate(&(dgn->imp), Exp, ctr, trees);
+
+    // * Roll back to the last good state and retry with a ridge jitter
+    if (ctr->nanFlag) {
+      MatrixXd impX = dgn->imp.X; // exposures held by Exp
+      VectorXd ev(4);
+      ev << ctr->b, snap->b, nanRetry + 1, 0;
+      if (++nanRetry > ctr->nanRetries) {
+        tdlmSnapshotRestore(ctr, dgn, snap, trees);
+        imputeSync(&(dgn->imp), Exp, ctr, impX);
+        tdlnmRebuild(ctr, trees, Exp);
+        (dgn->nanEvents).push_back(ev);
+        Rcpp::warning("NaN values persisted after %i retries, returning the %i iterations completed before iteration %i",
+                      ctr->nanRetries, snap->b, (int) ev(0));
+        break;
+      }
+      tdlmSnapshotRestore(ctr, dgn, snap, trees);
+      imputeSync(&(dgn->imp), Exp, ctr, impX);
+      tdlnmRebuild(ctr, trees, Exp);
+      ctr->nanJitter = 1e-8 * pow(10.0, nanRetry);
+      ev(3) = ctr->nanJitter;
+      (dgn->nanEvents).push_back(ev);
+      continue;
     }
 
     // * Record
@@ -505,30 +670,60 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
       (dgn->termNodes).col(ctr->record - 1) = ctr->nTerm;
       dgn->timeProbs.col(ctr->record -1) = trees[0]->nodestruct->getTimeProbs();
       dgn->fhat += ctr->fhat;
-      Yhat += ctr->fhat + ctr->Z * ctr->gamma;
+      if (ctr->binomial) {
+        VectorXd eta = ctr->fhat + ctr->Z * ctr->gamma;
+        if (ctr->hasOffset)
+          eta += ctr->offset;
+        if (ctr->hasRE)
+          eta += ctr->reFit;
+        dgn->probMean.array() += 1.0 / (1.0 + (-eta.array()).exp());
+      }
+      dgn->Yhat += ctr->fhat + ctr->Z * ctr->gamma;
 
       // ZINB
       (dgn->b1).col(ctr->record - 1) = ctr->b1;
       (dgn->b2).col(ctr->record - 1) = ctr->b2;
       (dgn->r)(ctr->record - 1) = ctr->r;
-      (dgn->wMat).col(ctr->record - 1) = ctr->w;
+      zinbWLogRecord(ctr, dgn);
+      scaleMixRecord(ctr, dgn);
+      reRecord(ctr, dgn);
+      for (t = 0; t < ctr->nTrees; ++t)
+        topoRecord(&(dgn->topo), t, trees[t]);
+      ppcRecord(&(dgn->ppc), ctr);
     }
+
+    // * Refresh last-good state
+    if (ctr->nanRecover && ((ctr->b % ctr->nanSnapshot) == 0)) {
+      tdlmSnapshotSave(ctr, dgn, snap, trees);
+      nanRetry = 0;
+      ctr->nanJitter = 0.0;
+    }
+
     // * Update progress
     prog->printMark();
   } // end MCMC
 
+  // * Run cut short by persistent NaN values or shortened by the time budget:
+  // keep completed records only
+  if (budgetRecords(ctr) < ctr->nRec) {
+    ctr->nRec = budgetRecords(ctr);
+    tdlmLogTruncate(dgn, ctr->nRec, ctr->n);
+  }
+  if (snap != 0)
+    delete snap;
+
   // * Setup data for return
   MatrixXd DLM((dgn->DLMexp).size(), 8);
   for (s = 0; s < (dgn->DLMexp).size(); ++s)
     DLM.row(s) = dgn->DLMexp[s];
   VectorXd sigma2 = dgn->sigma2;
   VectorXd nu = dgn->nu;
-  VectorXd fhat = (dgn->fhat).array() / ctr->nRec;
+  VectorXd fhat = (dgn->fhat).array() / (double) std::max(ctr->nRec, 1);
   MatrixXd gamma = (dgn->gamma).transpose();
   MatrixXd tau = (dgn->tau).transpose();
   MatrixXd termNodes = (dgn->termNodes).transpose();
   MatrixXd timeProbs = (dgn->timeProbs).transpose();
-  VectorXd YhatOut = Yhat / ctr->nRec;
+  VectorXd YhatOut = (dgn->Yhat) / (double) std::max(ctr->nRec, 1);
   MatrixXd Accept((dgn->TreeAccept).size(), 5);
   for (s = 0; s < (dgn->TreeAccept).size(); ++s){
     Accept.row(s) = dgn->TreeAccept[s];
@@ -539,15 +734,39 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
   Eigen::MatrixXd b2 = (dgn->b2).transpose();
   Eigen::VectorXd r = dgn->r; 
   Eigen::MatrixXd wMat = dgn->wMat; 
+  std::vector<int> wBits = dgn->wBits;
+  Eigen::VectorXd wMean = (dgn->wMean).array() / (double) std::max(ctr->nRec, 1);
+  MatrixXd nanEvents((dgn->nanEvents).size(), 4);
+  for (s = 0; s < (dgn->nanEvents).size(); ++s)
+    nanEvents.row(s) = dgn->nanEvents[s];
+
+  Rcpp::List topology;
+  if (dgn->topo.topK > 0)
+    topology = topoSummary(&(dgn->topo));
+  Rcpp::List ppc;
+  if (dgn->ppc.active)
+    ppc = ppcSummary(&(dgn->ppc), ctr->nRec);
+  MatrixXd sigma2Grp = (dgn->sigma2Grp).transpose();
+  VectorXd probMean = (dgn->probMean) / (double) std::max(ctr->nRec, 1);
+  VectorXd lambdaMean = (dgn->lambdaMean) / (double) std::max(ctr->nRec, 1);
+  MatrixXd reVar = (dgn->reVar).transpose();
+  MatrixXd arPhi = (dgn->arPhi).transpose();
+  MatrixXd reCoef = (dgn->reCoefMean) / (double) std::max(ctr->nRec, 1);
+  MatrixXd scenario = (dgn->scenario).transpose();
+  Rcpp::List impute;
+  if (dgn->imp.active)
+    impute = imputeSummary(&(dgn->imp));
 
   delete prog;
   // delete ctr;
   delete dgn;
   delete Exp;
+  for (s = 0; s < scenExp.size(); ++s)
+    delete scenExp[s];
   for (s = 0; s < trees.size(); ++s)
     delete trees[s];
 
-  return(Rcpp::List::create(Named("TreeStructs")  = wrap(DLM),
+  Rcpp::List out = Rcpp::List::create(Named("TreeStructs")  = wrap(DLM),
                             Named("fhat")         = wrap(fhat),
                             Named("Yhat")         = wrap(YhatOut),
                             Named("sigma2")       = wrap(sigma2),
@@ -560,5 +779,66 @@ Rcpp::List tdlnm_Cpp(const Rcpp::List model)
                             Named("b1")           = wrap(b1),
                             Named("b2")           = wrap(b2),
                             Named("r")            = wrap(r),
-                            Named("wMat")         = wrap(wMat)));
+                            Named("mcmcIter")     = wrap(ctr->nRec),
+                            Named("nanEvents")    = wrap(nanEvents));
+
+  // ZINB at-risk log, in the storage format requested
+  if (ctr->zinb) {
+    if (ctr->wStore == 1)
+      out["wBits"] = wrap(wBits);
+    else if (ctr->wStore == 2)
+      out["wMean"] = wrap(wMean);
+    else
+      out["wMat"] = wrap(wMat);
+  }
+
+  // Most frequent tree topologies
+  if (topology.size() > 0)
+    out["topology"] = topology;
+
+  // Posterior predictive checks
+  if (ppc.size() > 0)
+    out["ppc"] = ppc;
+
+  // Posterior mean success probabilities
+  if (ctr->binomial)
+    out["prob"] = wrap(probMean);
+
+  // Group variances and posterior mean latent precisions
+  if (ctr->scaleMix) {
+    out["sigma2Group"] = wrap(sigma2Grp);
+    out["lambda"]      = wrap(lambdaMean);
+    if (ctr->arLags.size() > 0)
+      out["arPhi"]     = wrap(arPhi);
+  }
+
+  // Random-effect variances and posterior mean random effects
+  if (ctr->hasRE) {
+    out["reVar"]  = wrap(reVar);
+    out["reCoef"] = wrap(reCoef);
+  }
+
+  // Counterfactual exposure scenario contrasts (records x scenarios)
+  if (scenario.cols() > 0)
+    out["scenario"] = wrap(scenario);
+
+  // Missing exposure imputation
+  if (impute.size() > 0)
+    out["impute"] = impute;
+
+  // Projected and achieved records under the time budget
+  if (ctr->timeBudget > 0)
+    out["budget"] = budgetSummary(ctr, nRecPlanned);
+
+  // Largest deviation of the running residual from its exact value
+  if (ctr->floatRmat || (ctr->resyncEvery > 0))
+    out["residDrift"] = wrap(ctr->residDrift);
+
+  // Strategies chosen by autotuning and their timings (seconds, bytes)
+  if (as<bool>(model["autotune"]))
+    out["autotune"] = Rcpp::List::create(Named("lowmem")  = wrap(lowmem),
+                                         Named("threads") = wrap(tuneThreads),
+                                         Named("timings") = autotuneTimings(tuneTimes));
+
+  return(out);
 } // end tdlnm_Cpp
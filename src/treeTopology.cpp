@@ -0,0 +1,205 @@
+/**
+ * @file treeTopology.cpp
+ * @brief Posterior tree topology counts and modal trees
+ * @version 1.0
+ *
+ * At each record a tree is serialized in a recursive pre-order pass: each
+ * internal node writes its split (NodeStruct::splitKey) and each terminal
+ * node writes '.', followed by its nested tree in brackets if it has one.
+ * The serialization is canonical, so its 64-bit FNV-1a hash identifies the
+ * topology. Counts are kept for every hash; serialized trees and terminal
+ * regions are kept only for the current top k of each tree slot. A hash can
+ * only enter the top k when its count increases, i.e. when its tree is at
+ * hand, so the top k is exact.
+ */
+#include <RcppEigen.h>
+#include "modelCtr.h"
+#include "Node.h"
+#include "NodeStruct.h"
+#include "modDat.h"
+#include <cstdio>
+#include <algorithm>
+using namespace Rcpp;
+
+/**
+ * @brief append the pre-order serialization of a tree to key
+ *
+ * @param n root node
+ * @param key serialization
+ */
+static void topoSerialize(Node *n, std::string &key)
+{
+  if (n->c1 == 0) {
+    key += '.';
+    if ((n->nodevals != 0) && (n->nodevals->nestedTree != 0)) {
+      key += '[';
+      topoSerialize(n->nodevals->nestedTree, key);
+      key += ']';
+    }
+    return;
+  }
+  key += n->nodestruct->splitKey();
+  topoSerialize(n->c1, key);
+  topoSerialize(n->c2, key);
+}
+
+/**
+ * @brief 64-bit FNV-1a hash of a string
+ */
+static unsigned long long topoHash(const std::string &key)
+{
+  unsigned long long h = 14695981039346656037ULL;
+  for (unsigned char c : key) {
+    h ^= c;
+    h *= 1099511628211ULL;
+  }
+  return(h);
+}
+
+/**
+ * @brief terminal regions of a tree: modifier rules for modifier trees,
+ * exposure and lag ranges for DLNM/DLM trees
+ *
+ * @param tree root node
+ * @param Mod modifier data for modifier trees, 0 otherwise
+ */
+static std::vector<std::string> topoPartition(Node *tree, modDat *Mod)
+{
+  std::vector<std::string> part;
+  char buf[96];
+  for (Node *tn : tree->listTerminal()) {
+    if (Mod != 0) {
+      part.push_back(modRuleStr(tn, Mod));
+    } else {
+      snprintf(buf, sizeof(buf), "x[%d,%d] t[%d,%d]",
+               tn->nodestruct->get(1), tn->nodestruct->get(2),
+               tn->nodestruct->get(3), tn->nodestruct->get(4));
+      part.push_back(std::string(buf));
+    }
+  }
+  return(part);
+}
+
+/**
+ * @brief set up a topology log
+ *
+ * @param topo topology log
+ * @param nSlots number of tree slots
+ * @param topK number of most frequent topologies kept per slot
+ */
+void topoInit(topoLog *topo, int nSlots, int topK)
+{
+  topo->topK = topK;
+  topo->counts.assign(nSlots, std::unordered_map<unsigned long long, int>());
+  topo->top.assign(nSlots, std::map<unsigned long long, topoEntry>());
+}
+
+/**
+ * @brief count the topology of a tree in slot
+ *
+ * @param topo topology log
+ * @param slot tree slot
+ * @param tree root node
+ * @param Mod modifier data if tree is a modifier tree, 0 otherwise
+ * @param prefix prepended to the serialization (e.g. exposures of a tree)
+ * @param tree2 second tree of the slot (DLM tree of a pair), 0 if none
+ */
+void topoRecord(topoLog *topo, int slot, Node *tree, modDat *Mod,
+                const std::string &prefix, Node *tree2)
+{
+  if (topo->topK <= 0)
+    return;
+  std::string key = prefix;
+  topoSerialize(tree, key);
+  if (tree2 != 0) {
+    key += '|';
+    topoSerialize(tree2, key);
+  }
+  unsigned long long h = topoHash(key);
+  int count = ++(topo->counts[slot][h]);
+
+  std::map<unsigned long long, topoEntry> &top = topo->top[slot];
+  auto it = top.find(h);
+  if (it != top.end()) {
+    it->second.count = count;
+    return;
+  }
+
+  // least frequent of the current top k
+  auto minIt = top.begin();
+  for (auto jt = top.begin(); jt != top.end(); ++jt)
+    if (jt->second.count < minIt->second.count)
+      minIt = jt;
+  if (((int) top.size() >= topo->topK) && (count <= minIt->second.count))
+    return;
+  if ((int) top.size() >= topo->topK)
+    top.erase(minIt);
+
+  topoEntry e;
+  e.count     = count;
+  e.key       = key;
+  e.partition = topoPartition(tree, Mod);
+  if (tree2 != 0) { // label regions of each tree
+    std::vector<std::string> part2 = topoPartition(tree2, 0);
+    for (std::string &p : e.partition)
+      p = "[1] " + p;
+    for (std::string &p : part2)
+      e.partition.push_back("[2] " + p);
+  }
+  top[h]      = e;
+}
+
+/**
+ * @brief summarize a topology log for R
+ *
+ * @param topo topology log
+ * @return list of the top k topologies of each slot (slot, rank, count, hash,
+ * structure, partition) and the number and effective number
+ * (exponential of the entropy) of distinct topologies per slot
+ */
+Rcpp::List topoSummary(topoLog *topo)
+{
+  int nSlots = topo->counts.size();
+  std::vector<int> slot, rank, count;
+  std::vector<std::string> hash, structure;
+  std::vector<std::vector<std::string> > partition;
+  IntegerVector nDistinct(nSlots);
+  NumericVector effDistinct(nSlots);
+  char buf[17];
+
+  for (int k = 0; k < nSlots; ++k) {
+    double tot = 0.0, ent = 0.0;
+    for (const auto &c : topo->counts[k])
+      tot += c.second;
+    for (const auto &c : topo->counts[k])
+      ent -= (c.second / tot) * log((c.second / tot));
+    nDistinct[k]   = topo->counts[k].size();
+    effDistinct[k] = (tot > 0) ? exp(ent) : 0.0;
+
+    std::vector<std::pair<unsigned long long, const topoEntry*> > ord;
+    for (const auto &e : topo->top[k])
+      ord.push_back(std::make_pair(e.first, &(e.second)));
+    std::sort(ord.begin(), ord.end(), [](const std::pair<unsigned long long, const topoEntry*> &a,
+                                         const std::pair<unsigned long long, const topoEntry*> &b) {
+      return(a.second->count > b.second->count);
+    });
+    for (std::size_t r = 0; r < ord.size(); ++r) {
+      snprintf(buf, sizeof(buf), "%016llx", ord[r].first);
+      slot.push_back(k + 1);
+      rank.push_back(r + 1);
+      count.push_back(ord[r].second->count);
+      hash.push_back(std::string(buf));
+      structure.push_back(ord[r].second->key);
+      partition.push_back(ord[r].second->partition);
+    }
+  }
+
+  return(Rcpp::List::create(Named("slot")        = wrap(slot),
+                            Named("rank")        = wrap(rank),
+                            Named("count")       = wrap(count),
+                            Named("hash")        = wrap(hash),
+                            Named("structure")   = wrap(structure),
+                            Named("partition")   = wrap(partition),
+                            Named("nDistinct")   = nDistinct,
+                            Named("effDistinct") = effDistinct));
+}